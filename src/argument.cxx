@@ -28,7 +28,7 @@ namespace tglng {
     dst.clear();
     if (left && !interp.exec(dst, left)) return false;
     if (right && !interp.exec(r, right)) return false;
-    dst += r;
+    appendMove(dst, r);
     return true;
   }
 
@@ -361,11 +361,10 @@ namespace tglng {
 
   ArgumentSyntaxSugar<ArgumentExtractor<CharArgument> >
   ArgumentParser::h() {
-    static wchar_t ignore;
     return ArgumentSyntaxSugar<ArgumentExtractor<CharArgument> >(
       ArgumentExtractor<CharArgument>(
         CharArgument(interp, text, offset, left),
-        ignore));
+        ignoredChar));
   }
 
   ArgumentSyntaxSugar<ArgumentExtractor<CharArgument> >
@@ -434,8 +433,7 @@ namespace tglng {
 
   ArgumentSyntaxSugar<ArgumentExtractor<ExactCharacterArgument> >
   ArgumentParser::x(wchar_t expect) {
-    static bool ignore;
-    return x(ignore, expect);
+    return x(ignoredMatch, expect);
   }
 
   ArgumentSyntaxSugar<ArgumentExtractor<CommandArgument> >
@@ -393,6 +393,9 @@ namespace tglng {
     unsigned& offset;
     unsigned startingOffset;
     Command*& left;
+    //Destinations for the values of arguments which are discarded
+    wchar_t ignoredChar;
+    bool ignoredMatch;
 
   public:
     /**
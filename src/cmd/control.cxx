@@ -12,6 +12,7 @@
 #include "../interp.hxx"
 #include "../common.hxx"
 #include "../tokeniser.hxx"
+#include "data_tokenisers.hxx"
 
 using namespace std;
 
@@ -121,6 +122,7 @@ namespace tglng {
       signed slim, sinit, sinc;
 
       //Initialise the parms and register
+      interp.bindRegisters();
       if (limit.get()) {
         if (!interp.exec(str, limit.get())) return false;
         if (!parseInteger(slim, str)) {
@@ -137,10 +139,10 @@ namespace tglng {
           wcerr << L"Invalid integer for for-integer init: " << str << endl;
           return false;
         }
-        interp.registers[reg] = str;
+        interp.writeRegister(reg) = str;
       } else {
         sinit = 0;
-        interp.registers[reg] = L"0";
+        interp.writeRegister(reg) = L"0";
       }
 
       if (increment.get()) {
@@ -159,30 +161,32 @@ namespace tglng {
            /* Increment performed in body */) {
         //Run the body parts
         if (!interp.exec(str, body.left)) return false;
-        dst += str;
+        appendMove(dst, str);
         if (emitCounterImplicitly) {
-          map<wchar_t,wstring>::const_iterator it = interp.registers.find(reg);
+          Interpreter::registers_t::const_iterator it =
+            interp.registers.find(reg);
           if (it == interp.registers.end()) {
             wcerr << L"for-integer loop register " << reg
                   << L" was unset during execution." << endl;
             return false;
           }
-          dst += it->second;
+          it->second.appendTo(dst);
         }
         if (!interp.exec(str, body.right)) return false;
-        dst += str;
+        appendMove(dst, str);
 
         //Increment the value
-        map<wchar_t,wstring>::iterator it = interp.registers.find(reg);
+        Interpreter::registers_t::iterator it = interp.registers.find(reg);
         if (it == interp.registers.end()) {
           wcerr << L"for-integer loop register " << reg
                 << L" was unset during execution." << endl;
           return false;
         }
 
-        if (!parseInteger(curr, it->second)) {
+        it->second.get(str);
+        if (!parseInteger(curr, str)) {
           wcerr << L"for-integer loop register " << reg
-                << L" was set to invalid integer " << it->second
+                << L" was set to invalid integer " << str
                 << " during execution." << endl;
           return false;
         }
@@ -249,22 +253,23 @@ namespace tglng {
     virtual bool exec(wstring& dst, Interpreter& interp) {
       wstring text, item;
       if (!list.exec(text, interp)) return false;
-      tokeniser.reset(text);
+      Tokeniser tokeniser(this->tokeniser, interp, text);
 
       dst.clear();
+      interp.bindRegisters();
 
       while (tokeniser.hasMore()) {
         for (unsigned i = 0; i < registers.size() && tokeniser.next(item); ++i)
-          interp.registers[registers[i]] = item;
+          interp.writeRegister(registers[i]) = item;
 
         if (tokeniser.error()) break;
 
         if (!interp.exec(text, body.left)) return false;
-        dst += text;
+        appendMove(dst, text);
         if (emitItemImplicitly)
           dst += item;
         if (!interp.exec(text, body.right)) return false;
-        dst += text;
+        appendMove(dst, text);
       }
 
       //Successful iff the tokeniser didn't fail.
@@ -285,14 +290,15 @@ namespace tglng {
         tokeniser(L"default-tokeniser"),
         options(L"");
       unsigned preprocessorOffset(offset), tokeniserOffset(offset);
-      bool prependPlus(false), prependMinus(false);
+      bool hasPreprocessor(false), prependPlus(false), prependMinus(false);
       AutoSection list, body;
       ArgumentParser a(interp, text, offset, out);
       Function preprocessorFun, tokeniserFun;
 
       if (!a[a.h(),
              -a.an(registers),
-             -(a.x(L'%'), a.to(preprocessor, L'%') >> preprocessorOffset),
+             -(a.x(hasPreprocessor, L'%'),
+               a.to(preprocessor, L'%') >> preprocessorOffset),
              -(a.x(L'#'), a.to(tokeniser, L'#') >> tokeniserOffset),
              -(a.x(prependPlus, L'+') | a.x(prependMinus, L'-'),
                a.ns(options)),
@@ -332,12 +338,15 @@ namespace tglng {
                      text, preprocessorOffset);
         return ParseError;
       }
-      if (!tokeniserFun.compatible(2,2)) {
-        interp.error(wstring(L"Incompatible with (2 <- 2): ") + tokeniser,
-                     text, tokeniserOffset);
+      if (!Tokeniser::isNext(tokeniserFun, false)) {
+        interp.error(wstring(L"Incompatible with (2 <- 2) or (2 <- 3): ") +
+                     tokeniser, text, tokeniserOffset);
         return ParseError;
       }
 
+      if (!hasPreprocessor)
+        dataTokeniserPre(preprocessorFun, tokeniserFun);
+
       //OK, the call is good
       out = new ForEach(out, registers,
                         Tokeniser(interp, preprocessorFun, tokeniserFun,
@@ -372,7 +381,7 @@ namespace tglng {
 
         if (!body.exec(result, interp))
           return false;
-        dst += result;
+        appendMove(dst, result);
       }
 
       return true;
@@ -0,0 +1,367 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <cwchar>
+#include <cwctype>
+#include <iostream>
+
+#include "../command.hxx"
+#include "../interp.hxx"
+#include "../function.hxx"
+#include "../common.hxx"
+#include "../slice.hxx"
+#include "../tokeniser.hxx"
+#include "data_tokenisers.hxx"
+
+using namespace std;
+
+namespace tglng {
+  /* Native tokenisers for common data formats. Each is a next Function using
+   * the offset protocol (see Tokeniser), so the text is never copied except
+   * for the tokens themselves. Tokeniser calls the underlying *Next()
+   * functions directly, bypassing even the conversion of offsets to and from
+   * strings.
+   */
+
+  /**
+   * Reads the offset argument of an offset-protocol tokeniser, checking that
+   * it lies within text.
+   */
+  static bool getOffset(unsigned& dst, const Slice& text,
+                        const Slice& offset) {
+    signed off;
+    if (!parseInteger(off, offset.str()) || off < 0 ||
+        (unsigned)off > text.size) {
+      wcerr << L"tglng: error: Invalid tokeniser offset: "
+            << offset.str() << endl;
+      return false;
+    }
+
+    dst = off;
+    return true;
+  }
+
+  /**
+   * Returns the offset just past the line terminator at off in text, which
+   * may be \n, \r\n or a lone \r.
+   */
+  static unsigned skipLineEnd(const Slice& text, unsigned off) {
+    if (text[off] == L'\r' && off+1 < text.size && text[off+1] == L'\n')
+      return off+2;
+    else
+      return off+1;
+  }
+
+  /**
+   * Moves past the separator, if any, at off in text, which ended a CSV or
+   * TSV field. Sets trailing if it is a field separator ending the text.
+   */
+  static unsigned skipSeparator(const Slice& text, unsigned off,
+                                wchar_t separator, bool& trailing) {
+    trailing = false;
+    if (off >= text.size)
+      return off;
+
+    if (text[off] != separator)
+      return skipLineEnd(text, off);
+
+    trailing = (off+1 == text.size);
+    return off+1;
+  }
+
+  unsigned csvTokeniserNext(wstring& field, const Slice& text, unsigned off,
+                            bool& trailing) {
+    const wchar_t* p = text.begin() + off, * end = text.end();
+    field.clear();
+    if (p != end && *p == L'"') {
+      //Quoted field; copy everything up to each quote, then decide whether
+      //it is doubled or closes the field.
+      ++p;
+      while (p != end) {
+        const wchar_t* quote = wmemchr(p, L'"', end - p);
+        if (!quote) quote = end;
+        field.append(p, quote);
+        p = quote;
+        if (p == end) break;
+
+        if (p+1 != end && p[1] == L'"') {
+          field += L'"';
+          p += 2;
+        } else {
+          ++p;
+          break;
+        }
+      }
+
+      //Anything between the closing quote and the separator is kept, as most
+      //tools do
+      const wchar_t* tail = p;
+      while (p != end && *p != L',' && *p != L'\n' && *p != L'\r') ++p;
+      field.append(tail, p);
+    } else {
+      const wchar_t* begin = p;
+      while (p != end && *p != L',' && *p != L'\n' && *p != L'\r') ++p;
+      field.assign(begin, p);
+    }
+
+    return skipSeparator(text, p - text.begin(), L',', trailing);
+  }
+
+  unsigned tsvTokeniserNext(wstring& field, const Slice& text, unsigned off,
+                            bool& trailing) {
+    const wchar_t* p = text.begin() + off, * end = text.end();
+    field.clear();
+    while (p != end) {
+      const wchar_t* begin = p;
+      while (p != end && *p != L'\t' && *p != L'\n' && *p != L'\r' &&
+             *p != L'\\') ++p;
+      field.append(begin, p);
+      if (p == end || *p != L'\\') break;
+
+      if (p+1 == end) {
+        field += *p++;
+        break;
+      }
+
+      switch (p[1]) {
+      case L't':  field += L'\t'; break;
+      case L'n':  field += L'\n'; break;
+      case L'r':  field += L'\r'; break;
+      case L'\\': field += L'\\'; break;
+      default:
+        field += p[0];
+        field += p[1];
+        break;
+      }
+      p += 2;
+    }
+
+    return skipSeparator(text, p - text.begin(), L'\t', trailing);
+  }
+
+  static bool isJsonSpace(wchar_t ch) {
+    return ch == L' ' || ch == L'\t' || ch == L'\n' || ch == L'\r';
+  }
+
+  /**
+   * Returns the offset just past the JSON string beginning with the quote at
+   * off in text, or the length of text if it is unterminated.
+   */
+  static unsigned skipJsonString(const Slice& text, unsigned off) {
+    for (++off; off < text.size; ++off) {
+      if (text[off] == L'\\') ++off;
+      else if (text[off] == L'"') return off+1;
+    }
+
+    return text.size;
+  }
+
+  /**
+   * Returns the offset just past the JSON array or object beginning at off in
+   * text, or the length of text if it is unterminated.
+   */
+  static unsigned skipJsonContainer(const Slice& text, unsigned off) {
+    unsigned depth = 0;
+    while (off < text.size) {
+      switch (text[off]) {
+      case L'"':
+        off = skipJsonString(text, off);
+        continue;
+
+      case L'[':
+      case L'{':
+        ++depth;
+        break;
+
+      case L']':
+      case L'}':
+        if (!--depth) return off+1;
+        break;
+      }
+
+      ++off;
+    }
+
+    return text.size;
+  }
+
+  static unsigned hexValue(wchar_t ch) {
+    if (ch >= L'0' && ch <= L'9') return ch - L'0';
+    if (ch >= L'a' && ch <= L'f') return ch - L'a' + 10;
+    if (ch >= L'A' && ch <= L'F') return ch - L'A' + 10;
+    return 0;
+  }
+
+  /**
+   * Reads the four hex digits of a \u escape at off in text.
+   */
+  static unsigned readJsonHex(const Slice& text, unsigned off) {
+    unsigned value = 0;
+    for (unsigned i = 0; i < 4 && off+i < text.size; ++i)
+      value = value*16 + hexValue(text[off+i]);
+    return value;
+  }
+
+  /**
+   * Decodes the JSON string beginning with the quote at off in text into
+   * dst. Returns the offset just past the closing quote.
+   */
+  static unsigned decodeJsonString(wstring& dst, const Slice& text,
+                                   unsigned off) {
+    dst.clear();
+    ++off;
+    while (off < text.size) {
+      //Copy the run up to the next quote or backslash in one go
+      unsigned begin = off;
+      while (off < text.size && text[off] != L'"' && text[off] != L'\\')
+        ++off;
+      dst.append(text.begin() + begin, off - begin);
+      if (off >= text.size) break;
+      if (text[off] == L'"') return off+1;
+
+      //Backslash
+      if (++off >= text.size) break;
+      switch (text[off]) {
+      case L'b': dst += L'\b'; break;
+      case L'f': dst += L'\f'; break;
+      case L'n': dst += L'\n'; break;
+      case L'r': dst += L'\r'; break;
+      case L't': dst += L'\t'; break;
+      case L'u': {
+        unsigned code = readJsonHex(text, off+1);
+        off += 4;
+        //Combine surrogate pairs where wchar_t can hold the result
+        if (sizeof(wchar_t) >= 4 && code >= 0xD800 && code < 0xDC00 &&
+            off+2 < text.size && text[off+1] == L'\\' &&
+            text[off+2] == L'u') {
+          unsigned low = readJsonHex(text, off+3);
+          if (low >= 0xDC00 && low < 0xE000) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            off += 6;
+          }
+        }
+        dst += (wchar_t)code;
+      } break;
+
+      default:
+        //\" \\ \/ and anything invalid
+        dst += text[off];
+        break;
+      }
+      ++off;
+    }
+
+    return text.size;
+  }
+
+  /**
+   * Strips the outermost brackets or braces, along with surrounding
+   * whitespace, from a JSON array or object, so that json-tokeniser sees
+   * only the elements. Anything else is only stripped of whitespace.
+   *
+   * (text options <- text options)
+   */
+  bool jsonTokeniserPre(wstring* out, const Slice* in,
+                        Interpreter&, unsigned) {
+    const Slice& text(in[0]);
+    unsigned begin = 0, end = text.size;
+    while (begin < end && isJsonSpace(text[begin])) ++begin;
+
+    if (begin < end && (text[begin] == L'[' || text[begin] == L'{')) {
+      end = skipJsonContainer(text, begin);
+      ++begin;
+      //Drop the closing character, unless it was missing
+      if (end > begin && (text[end-1] == L']' || text[end-1] == L'}'))
+        --end;
+    }
+
+    while (begin < end && isJsonSpace(text[begin])) ++begin;
+    while (end > begin && isJsonSpace(text[end-1])) --end;
+
+    text.sub(begin, end - begin).assignTo(out[0]);
+    in[1].assignTo(out[1]);
+    return true;
+  }
+
+  unsigned jsonTokeniserNext(wstring& element, const Slice& text,
+                             unsigned off, bool& trailing) {
+    trailing = false;
+    while (off < text.size && isJsonSpace(text[off])) ++off;
+
+    if (off < text.size && text[off] == L'"') {
+      off = decodeJsonString(element, text, off);
+    } else if (off < text.size && (text[off] == L'[' || text[off] == L'{')) {
+      unsigned begin = off;
+      off = skipJsonContainer(text, off);
+      text.sub(begin, off - begin).assignTo(element);
+    } else {
+      unsigned begin = off;
+      while (off < text.size && text[off] != L',' && text[off] != L':' &&
+             !isJsonSpace(text[off]))
+        ++off;
+      text.sub(begin, off - begin).assignTo(element);
+    }
+
+    //Move past the separator and up to the next element
+    while (off < text.size && isJsonSpace(text[off])) ++off;
+    if (off < text.size && (text[off] == L',' || text[off] == L':')) ++off;
+    while (off < text.size && isJsonSpace(text[off])) ++off;
+
+    return off;
+  }
+
+  /**
+   * Adapts one of the *Next() functions to the offset protocol.
+   */
+  template<dataTokeniserNext_t Next>
+  bool dataTokeniser(wstring* out, const Slice* in,
+                            Interpreter&, unsigned) {
+    unsigned off;
+    bool trailing;
+    if (!getOffset(off, in[0], in[1]))
+      return false;
+
+    /* The offset protocol cannot express the empty token following a
+     * trailing separator, so it is only produced when Tokeniser calls Next
+     * directly.
+     */
+    out[1] = intToStr(Next(out[0], in[0], off, trailing));
+    return true;
+  }
+
+  dataTokeniserNext_t dataTokeniserNext(const Function& fun) {
+    if (fun.execView == dataTokeniser<csvTokeniserNext>)
+      return csvTokeniserNext;
+    if (fun.execView == dataTokeniser<tsvTokeniserNext>)
+      return tsvTokeniserNext;
+    if (fun.execView == dataTokeniser<jsonTokeniserNext>)
+      return jsonTokeniserNext;
+    return NULL;
+  }
+
+  bool dataTokeniserPre(Function& pre, const Function& next) {
+    if (next.execView == dataTokeniser<jsonTokeniserNext>)
+      pre = Function(2, 2, sliceAdapter<2, jsonTokeniserPre>,
+                     jsonTokeniserPre);
+    else if (dataTokeniserNext(next))
+      pre = Tokeniser::defaultInit;
+    else
+      return false;
+
+    return true;
+  }
+
+  static GlobalBinding<TViewFunctionParser<2,3,
+                                           dataTokeniser<csvTokeniserNext> > >
+  _csvTokeniser(L"csv-tokeniser");
+  static GlobalBinding<TViewFunctionParser<2,3,
+                                           dataTokeniser<tsvTokeniserNext> > >
+  _tsvTokeniser(L"tsv-tokeniser");
+  static GlobalBinding<TViewFunctionParser<2,2,jsonTokeniserPre> >
+  _jsonTokeniserPre(L"json-tokeniser-pre");
+  static GlobalBinding<TViewFunctionParser<2,3,
+                                           dataTokeniser<jsonTokeniserNext> > >
+  _jsonTokeniser(L"json-tokeniser");
+}
@@ -0,0 +1,67 @@
+#ifndef CMD_DATA_TOKENISERS_HXX_
+#define CMD_DATA_TOKENISERS_HXX_
+
+#include <string>
+
+#include "../slice.hxx"
+
+namespace tglng {
+  class Function;
+
+  /**
+   * The signature of the native implementations of the data tokenisers.
+   * Each extracts the token beginning at offset off within text (which must
+   * be less than the length of text) into token, and returns the offset at
+   * which the following token begins, which is always greater than off.
+   *
+   * trailing is set to whether the token was followed by a separator which
+   * ends the text, in which case an empty token follows at the end of the
+   * text.
+   */
+  typedef unsigned (*dataTokeniserNext_t)(std::wstring& token,
+                                          const Slice& text, unsigned off,
+                                          bool& trailing);
+
+  /**
+   * Tokenises CSV as described by RFC 4180, returning one field at a time.
+   * Fields are separated by commas or line terminators; a field enclosed in
+   * double quotes may contain either, with "" standing for a literal quote.
+   * Records are not distinguished from each other; the fields of all records
+   * are returned in one sequence.
+   */
+  unsigned csvTokeniserNext(std::wstring& field, const Slice& text,
+                            unsigned off, bool& trailing);
+  /**
+   * Tokenises TSV, returning one field at a time. Fields are separated by
+   * tabs or line terminators. The escape sequences \t, \n, \r and \\ stand
+   * for the corresponding characters; a backslash followed by anything else
+   * is kept as-is. As with csvTokeniserNext(), records are flattened.
+   */
+  unsigned tsvTokeniserNext(std::wstring& field, const Slice& text,
+                            unsigned off, bool& trailing);
+  /**
+   * Tokenises the elements of a JSON array, or the alternating keys and
+   * values of a JSON object, after json-tokeniser-pre has removed the
+   * enclosing brackets. Strings are decoded; nested arrays and objects, as
+   * well as numbers, true, false and null, are returned as their JSON text.
+   */
+  unsigned jsonTokeniserNext(std::wstring& element, const Slice& text,
+                             unsigned off, bool& trailing);
+
+  /**
+   * If the given Function is one of the data tokenisers, returns its native
+   * implementation. Otherwise, returns NULL.
+   */
+  dataTokeniserNext_t dataTokeniserNext(const Function&);
+
+  /**
+   * If the given Function is one of the data tokenisers, sets pre to the
+   * preprocessor to use with it when none is given explicitly, and returns
+   * true. This is json-tokeniser-pre for json-tokeniser, and one which leaves
+   * the text untouched for the others, since every character of CSV or TSV
+   * is significant. Otherwise, returns false without modifying pre.
+   */
+  bool dataTokeniserPre(Function& pre, const Function& next);
+}
+
+#endif /* CMD_DATA_TOKENISERS_HXX_ */
@@ -4,154 +4,21 @@
 
 #include <string>
 #include <cctype>
+#include <cwchar>
 #include <vector>
-#include <map>
-#include <set>
+#include <algorithm>
 
 #include "../command.hxx"
 #include "../function.hxx"
 #include "../interp.hxx"
 #include "../argument.hxx"
+#include "../slice.hxx"
+#include "default_tokeniser.hxx"
+#include "../thread.hxx"
 
 using namespace std;
 
 namespace tglng {
-  /** Defines the possible options for the default tokeniser. */
-  struct DefaultTokeniserOptions {
-    /**
-     * Whether spaces (via iswspace) are considered delimiters.
-     * Default: true
-     */
-    bool spacesAreDelims;
-    /**
-     * Whether line feeds (\n, \r\n, or \r) are considered delimiters.
-     * Default: false
-     */
-    bool linesAreDelims;
-    /**
-     * Whether NUL characters are considered delimiters.
-     * Default: false
-     */
-    bool nulsAreDelims;
-    /**
-     * Additional characters to consider as delimiters.
-     * Default: empty
-     */
-    set<wchar_t> additionalDelimiters;
-    /**
-     * If true, consecutive delimiters are treated as one delimiter. For
-     * example, if comma were the only delimiter, the strings
-     *   foo,,,bar
-     *   foo,bar
-     * would equivalently describe two tokens, "foo" and "bar"; but if this
-     * setting is false, the former describes "foo", "", "", "bar".
-     * Default: true
-     */
-    bool coalesceDelims;
-
-    /**
-     * Maps pairs of characters which must be balanced before a delimiter
-     * counts. The closing character is always checked before the opening, so
-     * they may be the same (eg, quote marks). Counting is only performed on
-     * the outermost parenthesis.
-     * Default: (), [], {}
-     */
-    map<wchar_t,wchar_t> parentheses;
-    /**
-     * Maps pairs of characters, which, if they enclose a string (taking
-     * balancing into account, as in the parenthesis field), are stripped.
-     * Ex:
-     *   "(  foo )" -> "  foo "
-     *   "(foo)bar(baz)" -> "(foo)bar(baz)"
-     * Default: (), [], {}
-     */
-    map<wchar_t,wchar_t> trimParentheses;
-
-    /**
-     * If true, C-style backlash escape sequences will be processed. The
-     * following are supported:
-     *   \\     \
-     *   \a     BEL
-     *   \b     BS
-     *   \e     ESC
-     *   \f     FF
-     *   \n     LF
-     *   \r     CR
-     *   \t     HT
-     *   \v     VT
-     *   \octal The Unicode character indicated by the following octal digits.
-     *   \x##   The hex character ##
-     *   \X##   Same as \x##
-     *   \u#### The Unicode character #### (hex)
-     *   \U######## The unicode character ########
-     *   \u{...}
-     *   \U{...} Same as \u or \U, but with any number of hexits within the
-     *           braces.
-     *   Anything else: The character being escaped
-     *
-     * Note that substitution is performed AFTER tokenisation and trimming. The
-     * tokenisation/trim step is only aware of escape sequences enough to know
-     * to ignore the character after the backslash.
-     *
-     * Default: true
-     */
-    bool escapeSequences;
-
-    /**
-     * Parses options from the given string.
-     *
-     * Each option starts with an optional '+' or '-' ('+' implied if omitted)
-     * followed by an alphanumeric character indicating the option. '+'
-     * indicates to set or add the option, and '-' to unset or delete it.
-     *
-     * The ! character will reset all options to the defaults, and _ will clear
-     * all options.
-     *
-     * Each option may be followed by zero, one, or two other characters,
-     * depending on the option, which affect exactly what it does.
-     * The options are:
-     *   s      Whether space characters are considered delimiters.
-     *   l      Whether newlines are considered delimiters.
-     *   n      Whether NUL characters are considered delimiters.
-     *   dA     Understand the character A as a delimiter.
-     *   S      Equivalent to +D+s-l-n+c. "-S" is meaningless.
-     *   L      Equivalent to +D-s+l-n-c. "-L" is meaningless.
-     *   0      Equivalent to _+n. "-0" is meaningless.
-     *   D      Clears all delimiters set by d. "-D" is meaningless.
-     *   c      Whether consecutive delimiters are coalesced.
-     *   bAB    Treat A and B as parentheses, requiring them to be balanced
-     *          before honouring delimiters. Implicitly sets "-tAB" if negative.
-     *   tAB    If the characters A and B form a balanced pair around a token,
-     *          strip them. Implicitly sets "+bAB" if positive.
-     *   e      Whether backslash escape sequences are understood.
-     *
-     * If a "#" is encountered, characters are read to the next "#". The string
-     * "tokfmt-" is prepended to the result, which is then looked up as a
-     * command. This command must be a (1 <- 0) function. It is executed, and
-     * its result is recursively parsed for more options.
-     */
-    DefaultTokeniserOptions(const wstring&, Interpreter& interp);
-
-    /**
-     * Resets this DefaultTokeniserOptions to the default settings.
-     */
-    void setDefaults();
-
-    /**
-     * Sets all boolean options to false, and clears all sets and maps.
-     */
-    void nuke();
-
-    /**
-     * Parses the given string, applying option adjustments as indicated within
-     * the string.
-     *
-     * @param str The string to parse
-     * @param interp The Interpreter to use for command lookup and execution.
-     */
-    void parse(const wstring& str, Interpreter& interp);
-  };
-
   DefaultTokeniserOptions::DefaultTokeniserOptions(const wstring& str,
                                                    Interpreter& interp) {
     setDefaults();
@@ -163,11 +30,8 @@ namespace tglng {
     spacesAreDelims = true;
     coalesceDelims = true;
     escapeSequences = true;
-    static const wstring parens(L"()[]{}");
-    for (unsigned i = 0; i < parens.size(); i += 2) {
-      parentheses[parens[i]] = parens[i+1];
-      trimParentheses[parens[i]] = parens[i+1];
-    }
+    parentheses = trimParentheses = L"()[]{}";
+    compile();
   }
 
   void DefaultTokeniserOptions::nuke() {
@@ -178,6 +42,71 @@ namespace tglng {
     trimParentheses.clear();
   }
 
+  /**
+   * Sets the closing character of the pair opened by l in the given flat pair
+   * list (see DefaultTokeniserOptions::parentheses).
+   */
+  static void setPair(wstring& pairs, wchar_t l, wchar_t r) {
+    for (unsigned i = 0; i < pairs.size(); i += 2)
+      if (pairs[i] == l) {
+        pairs[i+1] = r;
+        return;
+      }
+
+    pairs += l;
+    pairs += r;
+  }
+
+  /**
+   * Removes the pair opened by l from the given flat pair list, if present.
+   */
+  static void erasePair(wstring& pairs, wchar_t l) {
+    for (unsigned i = 0; i < pairs.size(); i += 2)
+      if (pairs[i] == l) {
+        pairs.erase(i, 2);
+        return;
+      }
+  }
+
+  /**
+   * Adds the given class bits to every character in chars (taking every
+   * stride-th character), returning whether any character was not ASCII.
+   */
+  static bool classify(unsigned char* asciiClass, const wstring& chars,
+                       unsigned stride, unsigned char bits) {
+    bool nonAscii = false;
+    for (unsigned i = 0; i < chars.size(); i += stride) {
+      if (chars[i] >= 0 && chars[i] < 128)
+        asciiClass[chars[i]] |= bits;
+      else
+        nonAscii = true;
+    }
+
+    return nonAscii;
+  }
+
+  void DefaultTokeniserOptions::compile() {
+    for (wchar_t ch = 0; ch < 128; ++ch)
+      asciiClass[ch] =
+        ((spacesAreDelims && iswspace(ch)) ||
+         (linesAreDelims && (ch == L'\n' || ch == L'\r')) ||
+         (nulsAreDelims && !ch)?
+         ClassDelimiter | ClassSpecial : 0);
+
+    if (escapeSequences)
+      asciiClass[L'\\'] |= ClassSpecial;
+
+    nonAsciiClasses = false;
+    if (classify(asciiClass, additionalDelimiters, 1,
+                 ClassDelimiter | ClassSpecial))
+      nonAsciiClasses = true;
+    if (classify(asciiClass, parentheses, 2,
+                 ClassParenthesis | ClassSpecial))
+      nonAsciiClasses = true;
+    if (classify(asciiClass, trimParentheses, 2, ClassTrimParenthesis))
+      nonAsciiClasses = true;
+  }
+
   void DefaultTokeniserOptions::parse(const wstring& str, Interpreter& interp) {
     bool positive = true;
     for (unsigned i = 0; i < str.size(); ++i) {
@@ -214,8 +143,11 @@ namespace tglng {
 
       case L'd':
         if (++i < str.size()) {
-          if (positive) additionalDelimiters.insert(str[i]);
-          else          additionalDelimiters.erase (str[i]);
+          size_t ix = additionalDelimiters.find(str[i]);
+          if (positive && ix == wstring::npos)
+            additionalDelimiters += str[i];
+          else if (!positive && ix != wstring::npos)
+            additionalDelimiters.erase(ix, 1);
         }
         break;
 
@@ -242,10 +174,10 @@ namespace tglng {
         if ((i += 2) < str.size()) {
           wchar_t l = str[i-1], r = str[i];
           if (positive)
-            parentheses[l] = r;
+            setPair(parentheses, l, r);
           else {
-            parentheses.erase(l);
-            trimParentheses.erase(l);
+            erasePair(parentheses, l);
+            erasePair(trimParentheses, l);
           }
         }
         break;
@@ -254,10 +186,10 @@ namespace tglng {
         if ((i += 2) < str.size()) {
           wchar_t l = str[i-1], r = str[i];
           if (positive) {
-            parentheses[l] = r;
-            trimParentheses[l] = r;
+            setPair(parentheses, l, r);
+            setPair(trimParentheses, l, r);
           } else
-            trimParentheses.erase(l);
+            erasePair(trimParentheses, l);
         }
 
         break;
@@ -290,24 +222,49 @@ namespace tglng {
       //Reset positive if we didn't just make it false
       if (str[i] != L'-') positive = true;
     }
+
+    compile();
   }
 
-  /**
-   * Returns whether the given character is considered a delimiter according to
-   * the given options.
-   *
-   * Note that, if true is returned, the caller MUST check whether:
-   *   opts.linesAreDelims
-   *   ch == L'\r'
-   *   the character after ch == L'\n'
-   * and, if those conditions are true, skip the next character.
-   */
-  static bool isdelim(wchar_t ch, const DefaultTokeniserOptions& opts) {
-    return
-      (opts.spacesAreDelims && iswspace(ch)) ||
-      (opts.linesAreDelims && (ch == L'\n' || ch == L'\r')) ||
-      (opts.nulsAreDelims && !ch) ||
-      opts.additionalDelimiters.count(ch);
+  namespace {
+    struct CachedOptions {
+      wstring str;
+      DefaultTokeniserOptions opts;
+    };
+
+    const unsigned OPTIONS_CACHE_SIZE = 4;
+    struct OptionsCache {
+      CachedOptions entries[OPTIONS_CACHE_SIZE];
+      bool valid[OPTIONS_CACHE_SIZE];
+      unsigned next;
+
+      OptionsCache() : next(0) {
+        for (unsigned i = 0; i < OPTIONS_CACHE_SIZE; ++i)
+          valid[i] = false;
+      }
+    };
+    ThreadLocal<OptionsCache> optionsCache;
+  }
+
+  const DefaultTokeniserOptions& defaultTokeniserOptions(const Slice& str,
+                                                         Interpreter& interp) {
+    OptionsCache& cache(optionsCache.get());
+    for (unsigned i = 0; i < OPTIONS_CACHE_SIZE; ++i)
+      if (cache.valid[i] && Slice(cache.entries[i].str) == str)
+        return cache.entries[i].opts;
+
+    //Options containing "#" are cached under the full string as well, so the
+    //tokfmt- functions are only run the first time it is seen. Running them
+    //may use the tokeniser, so don't parse into the cache directly.
+    wstring owned(str.str());
+    DefaultTokeniserOptions opts(owned, interp);
+
+    CachedOptions& entry(cache.entries[cache.next]);
+    cache.valid[cache.next] = true;
+    cache.next = (cache.next + 1) % OPTIONS_CACHE_SIZE;
+    entry.str.swap(owned);
+    entry.opts = opts;
+    return entry.opts;
   }
 
   /**
@@ -316,55 +273,181 @@ namespace tglng {
    * Iff options.coalesceDelims is true, skip all delimiters in the input
    * string.
    */
-  bool defaultTokeniserPreprocessor(wstring* out, const wstring* in,
+  bool defaultTokeniserPreprocessor(wstring* out, const Slice* in,
                                     Interpreter& interp, unsigned) {
-    const wstring& str(in[0]);
-    DefaultTokeniserOptions opts(in[1], interp);
+    const DefaultTokeniserOptions& opts(defaultTokeniserOptions(in[1], interp));
+    in[0].sub(defaultTokeniserSkip(in[0], 0, opts)).assignTo(out[0]);
+    return true;
+  }
 
-    unsigned off = 0;
+  unsigned defaultTokeniserSkip(const Slice& str, unsigned off,
+                                const DefaultTokeniserOptions& opts) {
     if (opts.coalesceDelims)
-      while (off < str.size() && isdelim(str[off], opts))
+      while (off < str.size && opts.isDelimiter(str[off]))
         ++off;
 
-    out[0].assign(str, off, wstring::npos);
-    return true;
+    return off;
   }
 
   /**
-   * Default tokeniser implementation.
+   * Returns the value of the given hexadecimal digit.
    */
-  bool defaultTokeniser(wstring* out, const wstring* in,
-                        Interpreter& interp, unsigned) {
-    const wstring& str(in[0]);
-    DefaultTokeniserOptions opts(in[1], interp);
+  static unsigned hexDigitValue(wchar_t ch) {
+    if (ch >= L'0' && ch <= L'9')
+      return ch - L'0';
+    else if (ch >= L'A' && ch <= L'F')
+      return ch - L'A' + 10;
+    else /* (ch >= L'a' && ch <= L'f') */
+      return ch - L'a' + 10;
+  }
+
+  /**
+   * Writes the given raw token text to dst, performing backslash
+   * substitution.
+   */
+  static void decodeEscapes(wstring& dst, const wchar_t* token,
+                            unsigned len) {
+    dst.clear();
+    dst.reserve(len);
+
+    unsigned ix = 0;
+    while (ix < len) {
+      const wchar_t* bs = wmemchr(token + ix, L'\\', len - ix);
+      if (!bs) {
+        dst.append(token + ix, len - ix);
+        break;
+      }
+
+      dst.append(token + ix, bs - token - ix);
+      ix = bs - token;
+
+      //Move past backslash and handle whatever follows
+      if (++ix < len) {
+        switch (token[ix]) {
+        case L'a': dst += L'\a'; break;
+        case L'b': dst += L'\b'; break;
+        case L'e': dst += L'\033'; break;
+        case L'f': dst += L'\f'; break;
+        case L'n': dst += L'\n'; break;
+        case L'r': dst += L'\r'; break;
+        case L't': dst += L'\t'; break;
+        case L'v': dst += L'\v'; break;
+
+        case L'0':
+        case L'1':
+        case L'2':
+        case L'3':
+        case L'4':
+        case L'5':
+        case L'6':
+        case L'7': {
+          //Octal sequence
+          wchar_t ch = 0;
+          while (ix < len && (token[ix] >= L'0' && token[ix] <= L'7')) {
+            ch *= 8;
+            ch += token[ix++] - L'0';
+          }
+
+          dst += ch;
+          //Move back one since we increment ix after the switch
+          --ix;
+        } break;
+
+        case L'x':
+        case L'X':
+        case L'u':
+        case L'U': {
+          unsigned fixedLen =
+            (token[ix] == L'x'? 2 :
+             token[ix] == L'X'? 2 :
+             token[ix] == L'u'? 4 :
+             /*         == L'U'*/8);
+          wchar_t ch = 0;
 
-    unsigned off;
+          ++ix;
+          if (ix < len) {
+            if (token[ix] == L'{') {
+              ++ix;
+              //Enclosed sequence
+              while (ix < len && iswxdigit(token[ix])) {
+                ch *= 16;
+                ch += hexDigitValue(token[ix]);
+                ++ix;
+              }
+              //Move past closing brace
+              if (ix < len && token[ix] == L'}')
+                ++ix;
+            } else {
+              //Exact count
+              while (ix < len && iswxdigit(token[ix]) && fixedLen--) {
+                ch *= 16;
+                ch += hexDigitValue(token[ix]);
+                ++ix;
+              }
+            }
+          }
+
+          dst += ch;
+          //Move back one since we increment ix after the switch
+          --ix;
+        } break;
+
+        default:
+          dst += token[ix];
+        } //end switch(wchar_t)
+        ++ix;
+      } //end if (anything after backslash)
+    } //end while (more input)
+  }
 
-    for (off = 0; off < str.size() && !isdelim(str[off], opts); ++off) {
-      if (opts.escapeSequences && str[off] == L'\\') {
+  unsigned defaultTokeniserNext(wstring& token, const Slice& text,
+                                unsigned begin,
+                                const DefaultTokeniserOptions& opts) {
+    const Slice str(text.sub(begin));
+    const wchar_t* p = str.begin(), * end = str.end();
+    bool sawBackslash = false;
+    wchar_t r;
+
+    //Find the end of the token. Ordinary characters are skipped in bulk; only
+    //the special ones (see DefaultTokeniserOptions::ClassSpecial) are
+    //examined individually.
+    while ((p = opts.skipOrdinary(p, end)) != end && !opts.isDelimiter(*p)) {
+      if (opts.escapeSequences && *p == L'\\') {
         //Ignore the next character
-        ++off;
-      } else if (opts.parentheses.count(str[off])) {
+        sawBackslash = true;
+        p += (end - p >= 2? 2 : 1);
+      } else if (opts.isParenthesis(*p, r)) {
         //Balance the parens
-        wchar_t l = str[off], r = opts.parentheses[str[off]];
-        ++off;
-        for (unsigned count = 1; count && off < str.size(); count && ++off)
-          if      (str[off] == r) --count;
-          else if (str[off] == l) ++count;
+        wchar_t l = *p;
+        unsigned count = 1;
+        for (++p; p != end; ++p) {
+          if (*p == r) {
+            if (!--count) break;
+          } else if (*p == l) {
+            ++count;
+          } else if (*p == L'\\') {
+            sawBackslash = true;
+          }
+        }
 
-        //The above ends on the closing character, which is correct since the
-        //outer loop update will advance beyond it.
+        //Move beyond the closing character
+        if (p != end) ++p;
+      } else {
+        //Special only in that it needed a closer look
+        ++p;
       }
     }
 
-    out[0].assign(str, 0, off /* excludes the delimiter we hit */);
+    unsigned off = p - str.begin();
+    const wchar_t* tokenText = str.begin();
+    unsigned tokenLen = off /* excludes the delimiter we hit */;
 
     //Move past the delimiter if we didn't hit the end of the string
-    if (off < str.size()) {
+    if (off < str.size) {
       //We know str[off] is a delimiter
       ++off;
       //But handle \r\n
-      if (opts.linesAreDelims && off < str.size() &&
+      if (opts.linesAreDelims && off < str.size &&
           str[off-1] == L'\r' && str[off] == L'\n')
         ++off;
 
@@ -372,140 +455,239 @@ namespace tglng {
       //We don't need to check for \r\n here, since both of them are delimiters
       //anyway in line mode.
       if (opts.coalesceDelims)
-        while (off < str.size() && isdelim(str[off], opts))
+        while (off < str.size && opts.isDelimiter(str[off]))
           ++off;
     }
 
-    //Set the new remainder
-    if (off < str.size())
-      out[1].assign(str, off, wstring::npos);
-    else
-      out[1].clear();
+    //The remainder begins here
+    unsigned next = begin + off;
 
     //Trim parens from the token if requested
-    if (out[0].size() >= 2 && opts.trimParentheses.count(out[0][0])) {
-      wchar_t l = out[0][0], r = opts.trimParentheses[out[0][0]];
+    if (tokenLen >= 2 && opts.isTrimParenthesis(tokenText[0], r)) {
+      wchar_t l = tokenText[0];
 
       unsigned count, i;
-      for (count = i = 1; i < out[0].size() && count; ++i)
-        if      (out[0][i] == r) --count;
-        else if (out[0][i] == l) ++count;
+      for (count = i = 1; i < tokenLen && count; ++i)
+        if      (tokenText[i] == r) --count;
+        else if (tokenText[i] == l) ++count;
 
       //Trim if perfectly balanced; that is, if count == 0 and i == the length
       //of the string (in which case it was the final character which balanced
       //the initial).
-      if (count == 0 && i == out[0].size())
-        out[0] = out[0].substr(1, out[0].size()-2);
+      if (count == 0 && i == tokenLen) {
+        ++tokenText;
+        tokenLen -= 2;
+      }
     }
 
-    //Backslash substitution
-    if (opts.escapeSequences) {
-      wstring s;
-      size_t ix = 0, next;
-      while (ix < out[0].size()) {
-        next = out[0].find(L'\\', ix);
-        s.append(out[0], ix, next-ix);
-        ix = next;
-        if (ix == wstring::npos) break;
-
-        //Move past backslash and handle whatever follows
-        if (++ix < out[0].size()) {
-          switch (out[0][ix]) {
-          case L'a': s += L'\a'; break;
-          case L'b': s += L'\b'; break;
-          case L'e': s += L'\033'; break;
-          case L'f': s += L'\f'; break;
-          case L'n': s += L'\n'; break;
-          case L'r': s += L'\r'; break;
-          case L't': s += L'\t'; break;
-          case L'v': s += L'\v'; break;
-
-          case L'0':
-          case L'1':
-          case L'2':
-          case L'3':
-          case L'4':
-          case L'5':
-          case L'6':
-          case L'7': {
-            //Octal sequence
-            wchar_t ch = 0;
-            while (ix < out[0].size() &&
-                   (out[0][ix] >= L'0' && out[0][ix] <= L'7')) {
-              ch *= 8;
-              ch += out[0][ix++] - L'0';
-            }
+    //Backslash substitution, which only needs to look at the token again if
+    //it actually contains a backslash
+    if (opts.escapeSequences && sawBackslash)
+      decodeEscapes(token, tokenText, tokenLen);
+    else
+      token.assign(tokenText, tokenLen);
 
-            s += ch;
-            //Move back one since we increment ix after the switch
-            --ix;
-          } break;
-
-          case L'x':
-          case L'X':
-          case L'u':
-          case L'U': {
-            unsigned fixedLen =
-              (out[0][ix] == L'x'? 2 :
-               out[0][ix] == L'X'? 2 :
-               out[0][ix] == L'u'? 4 :
-               /*         == L'U'*/8);
-            wchar_t ch = 0;
-
-            ++ix;
-            if (ix < out[0].size()) {
-              if (out[0][ix] == L'{') {
-                ++ix;
-                //Enclosed sequence
-                while (ix < out[0].size() && iswxdigit(out[0][ix])) {
-                  ch *= 16;
-                  if (out[0][ix] >= L'0' && out[0][ix] <= L'9')
-                    ch += out[0][ix] - L'0';
-                  else if (out[0][ix] <= 'A' && out[0][ix] <= 'F')
-                    ch += out[0][ix] - L'A' + 10;
-                  else /* (out[0][ix] <= 'a' && out[0][ix] <= 'f') */
-                    ch += out[0][ix] - L'a' + 10;
-                  ++ix;
-                }
-                //Move past closing brace
-                if (ix < out[0].size() && out[0][ix] == L'}')
-                  ++ix;
-              } else {
-                //Exact count
-                while (ix < out[0].size() && iswxdigit(out[0][ix]) &&
-                       fixedLen--) {
-                  ch *= 16;
-                  if (out[0][ix] >= L'0' && out[0][ix] <= L'9')
-                    ch += out[0][ix] - L'0';
-                  else if (out[0][ix] <= 'A' && out[0][ix] <= 'F')
-                    ch += out[0][ix] - L'A' + 10;
-                  else /* (out[0][ix] <= 'a' && out[0][ix] <= 'f') */
-                    ch += out[0][ix] - L'a' + 10;
-                  ++ix;
-                }
-              }
-            }
+    return next;
+  }
 
-            s += ch;
-            //Move back one since we increment ix after the switch
-            --ix;
-          } break;
+  /* Parallel tokenisation.
+   *
+   * Where a token begins depends on everything before it (an earlier
+   * parenthesis or backslash may hide a delimiter), so chunks of the text
+   * cannot simply be tokenised independently. However, the tokens following
+   * a token boundary depend only on the text after it. Each chunk after the
+   * first is therefore tokenised speculatively, starting just after its
+   * first delimiter. The chunks are then stitched together in order: once
+   * the true sequence of boundaries, coming from the previous chunk, meets a
+   * boundary found in the speculative pass, the rest of that chunk's tokens
+   * are correct as they are. Until it does (eg, because the chunk began
+   * inside parentheses), tokens are extracted one at a time on the calling
+   * thread. The result is thus always exactly that of the sequential
+   * tokeniser; only the amount of work saved varies.
+   */
+  const unsigned DEFAULT_TOKENISER_PARALLEL_MIN = 1 << 20;
+  //Chunks are no smaller than this
+  static const unsigned PARALLEL_CHUNK_MIN = 1 << 18;
+
+  namespace {
+    struct TokeniseChunk {
+      const Slice* text;
+      const DefaultTokeniserOptions* opts;
+      bool keepTokens;
+      //Tokens are extracted while they begin before end
+      unsigned begin, end;
+
+      //The offset at which each token begins
+      std::vector<unsigned> starts;
+      std::vector<wstring> tokens;
+      //The offset after the last token
+      unsigned next;
+    };
+  }
 
-          default:
-            s += out[0][ix];
-          } //end switch(wchar_t)
-          ++ix;
-        } //end if (is backslash),
-      } //end for (each character)
+  /**
+   * Returns the offset of the first probable token boundary at or after off:
+   * the offset after the first delimiter (and any coalesced with it).
+   */
+  static unsigned syncPoint(const Slice& text, unsigned off,
+                            const DefaultTokeniserOptions& opts) {
+    while (off < text.size && !opts.isDelimiter(text[off]))
+      ++off;
+    if (off >= text.size)
+      return text.size;
+
+    ++off;
+    if (opts.linesAreDelims && off < text.size &&
+        text[off-1] == L'\r' && text[off] == L'\n')
+      ++off;
+    return defaultTokeniserSkip(text, off, opts);
+  }
+
+  static void tokeniseChunk(void* vchunk) {
+    TokeniseChunk& chunk(*(TokeniseChunk*)vchunk);
+    const Slice& text(*chunk.text);
+    wstring token;
+    unsigned off = chunk.begin;
+    while (off < chunk.end && off < text.size) {
+      chunk.starts.push_back(off);
+      off = defaultTokeniserNext(token, text, off, *chunk.opts);
+      if (chunk.keepTokens) {
+        chunk.tokens.push_back(wstring());
+        chunk.tokens.back().swap(token);
+      }
+    }
 
-      out[0] = s;
-    } //end if (escape sequences)
+    chunk.next = off;
+  }
+
+  /**
+   * Extracts the tokens which begin at or after off and before limit,
+   * appending them to tokens if it is not NULL and counting them in
+   * count. Returns the offset after the last one.
+   */
+  static unsigned tokeniseRange(vector<wstring>* tokens, unsigned& count,
+                                const Slice& text, unsigned off,
+                                unsigned limit,
+                                const DefaultTokeniserOptions& opts) {
+    if (limit > text.size) limit = text.size;
+
+    unsigned nchunks = 1;
+    if (off < limit && limit - off >= DEFAULT_TOKENISER_PARALLEL_MIN)
+      nchunks = min(hardwareConcurrency(), (limit - off) / PARALLEL_CHUNK_MIN);
+    if (nchunks < 1) nchunks = 1;
+
+    vector<TokeniseChunk> chunks(nchunks);
+    vector<void*> args(nchunks);
+    unsigned chunkSize = (limit - off) / nchunks;
+    for (unsigned i = 0; i < nchunks; ++i) {
+      TokeniseChunk& chunk(chunks[i]);
+      chunk.text = &text;
+      chunk.opts = &opts;
+      chunk.keepTokens = !!tokens;
+      chunk.end = (i+1 == nchunks? limit : off + (i+1)*chunkSize);
+      chunk.begin = (i? syncPoint(text, off + i*chunkSize, opts) : off);
+      args[i] = &chunk;
+    }
+
+    runParallel(tokeniseChunk, &args[0], nchunks);
+
+    //Stitch the chunks together; see above.
+    wstring token;
+    for (unsigned i = 0; i < nchunks && off < limit; ++i) {
+      TokeniseChunk& chunk(chunks[i]);
+      while (off < limit) {
+        std::vector<unsigned>::const_iterator it =
+          lower_bound(chunk.starts.begin(), chunk.starts.end(), off);
+        //Nothing in this chunk is any use any more
+        if (it == chunk.starts.end()) break;
+
+        if (*it == off) {
+          unsigned ix = it - chunk.starts.begin();
+          count += chunk.starts.size() - ix;
+          if (tokens) {
+            unsigned base = tokens->size();
+            tokens->resize(base + chunk.tokens.size() - ix);
+            for (unsigned j = ix; j < chunk.tokens.size(); ++j)
+              (*tokens)[base + j - ix].swap(chunk.tokens[j]);
+          }
+          off = chunk.next;
+          break;
+        }
+
+        off = defaultTokeniserNext(token, text, off, opts);
+        ++count;
+        if (tokens) tokens->push_back(token);
+      }
+    }
+
+    //Anything past the last chunk's coverage
+    while (off < limit) {
+      off = defaultTokeniserNext(token, text, off, opts);
+      ++count;
+      if (tokens) tokens->push_back(token);
+    }
+
+    return off;
+  }
+
+  unsigned defaultTokeniserAll(vector<wstring>* tokens,
+                               const Slice& text, unsigned off,
+                               const DefaultTokeniserOptions& opts) {
+    unsigned count = 0;
+    tokeniseRange(tokens, count, text, defaultTokeniserSkip(text, off, opts),
+                  text.size, opts);
+    return count;
+  }
+
+  unsigned defaultTokeniserSome(vector<wstring>& tokens,
+                                const Slice& text, unsigned off,
+                                const DefaultTokeniserOptions& opts) {
+    unsigned count = 0;
+    unsigned span = max(DEFAULT_TOKENISER_PARALLEL_MIN,
+                        hardwareConcurrency() * PARALLEL_CHUNK_MIN);
+    return tokeniseRange(&tokens, count, text, off,
+                         text.size - off > span? off + span : text.size,
+                         opts);
+  }
+
+  /**
+   * Extracts the first token from str according to opts, writing the token
+   * to out[0] and the remainder to out[1].
+   */
+  static void tokenise(wstring* out, const Slice& str,
+                       const DefaultTokeniserOptions& opts) {
+    str.sub(defaultTokeniserNext(out[0], str, 0, opts)).assignTo(out[1]);
+  }
+
+  /**
+   * Default tokeniser implementation.
+   */
+  bool defaultTokeniser(wstring* out, const Slice* in,
+                        Interpreter& interp, unsigned) {
+    tokenise(out, in[0], defaultTokeniserOptions(in[1], interp));
+    return true;
+  }
+
+  bool defaultTokeniserBatch(wstring* out, const Slice* in, unsigned count,
+                             Interpreter& interp, unsigned) {
+    //Successive invocations nearly always share their options, so only look
+    //them up again when they change.
+    const DefaultTokeniserOptions* opts = NULL;
+    Slice optsStr;
+    for (unsigned i = 0; i < count; ++i) {
+      if (!opts || in[i*2+1] != optsStr) {
+        optsStr = in[i*2+1];
+        opts = &defaultTokeniserOptions(optsStr, interp);
+      }
+
+      tokenise(out + i*2, in[i*2], *opts);
+    }
 
     return true;
   }
 
-  static GlobalBinding<TFunctionParser<2,2,defaultTokeniserPreprocessor> >
+  static GlobalBinding<TViewFunctionParser<2,2,defaultTokeniserPreprocessor> >
   _defaultTokeniserPre(L"default-tokeniser-pre");
-  static GlobalBinding<TFunctionParser<2,2,defaultTokeniser> >
+  static GlobalBinding<TBatchFunctionParser<2,2,defaultTokeniserBatch> >
   _defaultTokeniser(L"default-tokeniser");
 }
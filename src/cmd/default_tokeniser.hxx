@@ -2,21 +2,359 @@
 #define CMD_DEFAULT_TOKENISER_HXX_
 
 #include <string>
+#include <vector>
+#include <cwctype>
+
+#include "../slice.hxx"
 
 namespace tglng {
+  class Interpreter;
+
+  /**
+   * Defines the possible options for the default tokeniser.
+   *
+   * The options are held in a flat form which is cheap to copy and to query;
+   * in particular, the classification of ASCII characters is precomputed by
+   * compile().
+   */
+  struct DefaultTokeniserOptions {
+    /**
+     * Whether spaces (via iswspace) are considered delimiters.
+     * Default: true
+     */
+    bool spacesAreDelims;
+    /**
+     * Whether line feeds (\n, \r\n, or \r) are considered delimiters.
+     * Default: false
+     */
+    bool linesAreDelims;
+    /**
+     * Whether NUL characters are considered delimiters.
+     * Default: false
+     */
+    bool nulsAreDelims;
+    /**
+     * Additional characters to consider as delimiters, each occurring once.
+     * Default: empty
+     */
+    std::wstring additionalDelimiters;
+    /**
+     * If true, consecutive delimiters are treated as one delimiter. For
+     * example, if comma were the only delimiter, the strings
+     *   foo,,,bar
+     *   foo,bar
+     * would equivalently describe two tokens, "foo" and "bar"; but if this
+     * setting is false, the former describes "foo", "", "", "bar".
+     * Default: true
+     */
+    bool coalesceDelims;
+
+    /**
+     * Maps pairs of characters which must be balanced before a delimiter
+     * counts. The closing character is always checked before the opening, so
+     * they may be the same (eg, quote marks). Counting is only performed on
+     * the outermost parenthesis.
+     *
+     * Stored as alternating opening and closing characters; each opening
+     * character occurs only once.
+     * Default: (), [], {}
+     */
+    std::wstring parentheses;
+    /**
+     * Maps pairs of characters, which, if they enclose a string (taking
+     * balancing into account, as in the parenthesis field), are stripped.
+     * Ex:
+     *   "(  foo )" -> "  foo "
+     *   "(foo)bar(baz)" -> "(foo)bar(baz)"
+     * Stored in the same way as parentheses.
+     * Default: (), [], {}
+     */
+    std::wstring trimParentheses;
+
+    /**
+     * If true, C-style backlash escape sequences will be processed. The
+     * following are supported:
+     *   \\     \
+     *   \a     BEL
+     *   \b     BS
+     *   \e     ESC
+     *   \f     FF
+     *   \n     LF
+     *   \r     CR
+     *   \t     HT
+     *   \v     VT
+     *   \octal The Unicode character indicated by the following octal digits.
+     *   \x##   The hex character ##
+     *   \X##   Same as \x##
+     *   \u#### The Unicode character #### (hex)
+     *   \U######## The unicode character ########
+     *   \u{...}
+     *   \U{...} Same as \u or \U, but with any number of hexits within the
+     *           braces.
+     *   Anything else: The character being escaped
+     *
+     * Note that substitution is performed AFTER tokenisation and trimming. The
+     * tokenisation/trim step is only aware of escape sequences enough to know
+     * to ignore the character after the backslash.
+     *
+     * Default: true
+     */
+    bool escapeSequences;
+
+    /** Bits of asciiClass. */
+    enum {
+      ///The character is a delimiter
+      ClassDelimiter = 1,
+      ///The character opens a pair in parentheses
+      ClassParenthesis = 2,
+      ///The character opens a pair in trimParentheses
+      ClassTrimParenthesis = 4,
+      /**
+       * The character needs attention while scanning a token: it is a
+       * delimiter, opens a pair in parentheses, or is a backslash and
+       * escapeSequences is true.
+       */
+      ClassSpecial = 8
+    };
+    /**
+     * The classification of each ASCII character under the above options, as
+     * a combination of the Class* bits. Maintained by compile().
+     */
+    unsigned char asciiClass[128];
+    /**
+     * Whether any non-ASCII character is an additional delimiter or opens a
+     * pair in parentheses or trimParentheses. Maintained by compile().
+     */
+    bool nonAsciiClasses;
+
+    /**
+     * Parses options from the given string.
+     *
+     * Each option starts with an optional '+' or '-' ('+' implied if omitted)
+     * followed by an alphanumeric character indicating the option. '+'
+     * indicates to set or add the option, and '-' to unset or delete it.
+     *
+     * The ! character will reset all options to the defaults, and _ will clear
+     * all options.
+     *
+     * Each option may be followed by zero, one, or two other characters,
+     * depending on the option, which affect exactly what it does.
+     * The options are:
+     *   s      Whether space characters are considered delimiters.
+     *   l      Whether newlines are considered delimiters.
+     *   n      Whether NUL characters are considered delimiters.
+     *   dA     Understand the character A as a delimiter.
+     *   S      Equivalent to +D+s-l-n+c. "-S" is meaningless.
+     *   L      Equivalent to +D-s+l-n-c. "-L" is meaningless.
+     *   0      Equivalent to _+n. "-0" is meaningless.
+     *   D      Clears all delimiters set by d. "-D" is meaningless.
+     *   c      Whether consecutive delimiters are coalesced.
+     *   bAB    Treat A and B as parentheses, requiring them to be balanced
+     *          before honouring delimiters. Implicitly sets "-tAB" if negative.
+     *   tAB    If the characters A and B form a balanced pair around a token,
+     *          strip them. Implicitly sets "+bAB" if positive.
+     *   e      Whether backslash escape sequences are understood.
+     *
+     * If a "#" is encountered, characters are read to the next "#". The string
+     * "tokfmt-" is prepended to the result, which is then looked up as a
+     * command. This command must be a (1 <- 0) function. It is executed, and
+     * its result is recursively parsed for more options.
+     */
+    DefaultTokeniserOptions(const std::wstring&, Interpreter& interp);
+
+    /**
+     * Constructs a DefaultTokeniserOptions with the default settings.
+     */
+    DefaultTokeniserOptions() { setDefaults(); }
+
+    /**
+     * Resets this DefaultTokeniserOptions to the default settings.
+     */
+    void setDefaults();
+
+    /**
+     * Sets all boolean options to false, and clears all sets and maps.
+     */
+    void nuke();
+
+    /**
+     * Parses the given string, applying option adjustments as indicated within
+     * the string.
+     *
+     * @param str The string to parse
+     * @param interp The Interpreter to use for command lookup and execution.
+     */
+    void parse(const std::wstring& str, Interpreter& interp);
+
+    /**
+     * Recomputes asciiClass from the other fields. Done automatically by the
+     * constructors, setDefaults() and parse().
+     */
+    void compile();
+
+    /**
+     * Returns whether the given character is a delimiter.
+     *
+     * Note that, if true is returned, the caller MUST check whether:
+     *   linesAreDelims
+     *   ch == L'\r'
+     *   the character after ch == L'\n'
+     * and, if those conditions are true, skip the next character.
+     */
+    bool isDelimiter(wchar_t ch) const {
+      if (ch >= 0 && ch < 128)
+        return asciiClass[ch] & ClassDelimiter;
+      return (spacesAreDelims && mayBeSpace(ch) && iswspace(ch)) ||
+        (nonAsciiClasses &&
+         std::wstring::npos != additionalDelimiters.find(ch));
+    }
+
+    /**
+     * Returns a pointer to the first character in [begin,end) which may need
+     * attention while scanning a token (see ClassSpecial), or end if there
+     * is none.
+     */
+    const wchar_t* skipOrdinary(const wchar_t* begin,
+                                const wchar_t* end) const {
+      for (; begin != end; ++begin) {
+        wchar_t ch = *begin;
+        if (ch >= 0 && ch < 128) {
+          if (asciiClass[ch] & ClassSpecial) break;
+        } else if (nonAsciiClasses || (spacesAreDelims && mayBeSpace(ch))) {
+          break;
+        }
+      }
+
+      return begin;
+    }
+
+    /**
+     * If ch opens a pair in parentheses, sets close to the closing character
+     * and returns true. Otherwise, returns false.
+     */
+    bool isParenthesis(wchar_t ch, wchar_t& close) const {
+      if (ch >= 0 && ch < 128 && !(asciiClass[ch] & ClassParenthesis))
+        return false;
+      return findPair(parentheses, ch, close);
+    }
+
+    /**
+     * Like isParenthesis(), but for trimParentheses.
+     */
+    bool isTrimParenthesis(wchar_t ch, wchar_t& close) const {
+      if (ch >= 0 && ch < 128 && !(asciiClass[ch] & ClassTrimParenthesis))
+        return false;
+      return findPair(trimParentheses, ch, close);
+    }
+
+  private:
+    /**
+     * Returns false if the given non-ASCII character cannot be whitespace;
+     * the Unicode White_Space characters outside ASCII all lie in these
+     * ranges. This saves calling iswspace() on most text.
+     */
+    static bool mayBeSpace(wchar_t ch) {
+      return ch <= 0xA0 || ch == 0x1680 || ch == 0x180E ||
+        (ch >= 0x2000 && ch <= 0x205F) || ch == 0x3000;
+    }
+
+    static bool findPair(const std::wstring& pairs, wchar_t open,
+                         wchar_t& close) {
+      for (unsigned i = 0; i < pairs.size(); i += 2)
+        if (pairs[i] == open) {
+          close = pairs[i+1];
+          return true;
+        }
+
+      return false;
+    }
+  };
+
+  /**
+   * Returns the parsed form of the given option string.
+   *
+   * Recently used option strings are not parsed again. This includes strings
+   * which invoke tokfmt- commands ("#...#"); those commands are only run when
+   * the string is first parsed.
+   *
+   * The result is only valid until the next call.
+   */
+  const DefaultTokeniserOptions& defaultTokeniserOptions(const Slice& str,
+                                                         Interpreter& interp);
+
+  /**
+   * Returns the offset of the first character at or after off in str which
+   * is not a delimiter to be skipped before a token; ie, skips delimiters iff
+   * opts.coalesceDelims is true.
+   */
+  unsigned defaultTokeniserSkip(const Slice& str, unsigned off,
+                                const DefaultTokeniserOptions& opts);
+
+  /**
+   * Extracts the token beginning at offset off within str into token, as
+   * the default tokeniser would.
+   *
+   * @return The offset within str of the remainder after the token and its
+   * delimiter(s).
+   */
+  unsigned defaultTokeniserNext(std::wstring& token, const Slice& str,
+                                unsigned off,
+                                const DefaultTokeniserOptions& opts);
+
+  /**
+   * Texts at least this long are split into chunks which
+   * defaultTokeniserAll() tokenises concurrently, if the system has more
+   * than one processor.
+   */
+  extern const unsigned DEFAULT_TOKENISER_PARALLEL_MIN;
+
+  /**
+   * Extracts every token from str, starting at offset off, as successive
+   * calls to defaultTokeniserSkip() and defaultTokeniserNext() would.
+   *
+   * Large texts are tokenised on several threads; the result is the same
+   * regardless.
+   *
+   * @param tokens If not NULL, the tokens are appended here.
+   * @return The number of tokens.
+   */
+  unsigned defaultTokeniserAll(std::vector<std::wstring>* tokens,
+                               const Slice& str, unsigned off,
+                               const DefaultTokeniserOptions& opts);
+
+  /**
+   * Extracts the tokens from str which begin within the next stretch of text
+   * starting at offset off, appending them to tokens, as successive calls to
+   * defaultTokeniserNext() would. The stretch is long enough to be worth
+   * tokenising on several threads (see defaultTokeniserAll()), but bounded,
+   * so that a large text can be tokenised in parallel a piece at a time.
+   *
+   * @return The offset within str after the last token extracted.
+   */
+  unsigned defaultTokeniserSome(std::vector<std::wstring>& tokens,
+                                const Slice& str, unsigned off,
+                                const DefaultTokeniserOptions& opts);
+
   /**
    * Default tokeniser preprocessor.
    *
    * Iff options.coalesceDelims is true, skip all delimiters in the input
    * string.
    */
-  bool defaultTokeniserPreprocessor(std::wstring* out, const std::wstring* in,
+  bool defaultTokeniserPreprocessor(std::wstring* out, const Slice* in,
                                     Interpreter& interp, unsigned);
   /**
    * Default tokeniser implementation.
    */
-  bool defaultTokeniser(std::wstring* out, const std::wstring* in,
+  bool defaultTokeniser(std::wstring* out, const Slice* in,
                         Interpreter& interp, unsigned);
+  /**
+   * Batch implementation of the default tokeniser.
+   *
+   * @see Function::execb_t
+   */
+  bool defaultTokeniserBatch(std::wstring* out, const Slice* in,
+                             unsigned count, Interpreter& interp, unsigned);
 }
 
 #endif /* CMD_DEFAULT_TOKENISER_HXX_ */
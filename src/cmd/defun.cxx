@@ -15,6 +15,7 @@
 #include "../argument.hxx"
 #include "fundamental.hxx"
 #include "../common.hxx"
+#include "../thread.hxx"
 
 using namespace std;
 
@@ -24,26 +25,137 @@ namespace tglng {
     wstring outputs, inputs;
   };
 
-  static bool executeUserFunction(wstring* out, const wstring* in,
-                                  Interpreter& interp, unsigned ref) {
-    UserFunction* uf = (UserFunction*)interp.external(ref);
-    //Backup all registers
-    Interpreter::registers_t regbak(interp.registers);
+  /**
+   * Supplies the input registers of a user function from the arguments it
+   * was called with, so that an input is only copied if it is read as a
+   * whole. A tokeniser using the offset protocol, for example, is passed the
+   * whole text for every token, but normally only looks at a few characters
+   * of it with str-ix.
+   *
+   * The registers are never bound for real when this object is destroyed,
+   * since the caller restores the registers afterwards anyway. Input may be
+   * std::wstring or Slice.
+   */
+  template<typename Input>
+  class InputRegisters: public Interpreter::LazyRegisters {
+    Interpreter& interp;
+    const wstring& names;
+    const Input* values;
+
+  public:
+    InputRegisters(Interpreter& interp_, const wstring& names_,
+                   const Input* values_)
+    : interp(interp_), names(names_), values(values_)
+    {
+      interp.bindRegisters();
+      interp.lazyRegisters = this;
+    }
+
+    virtual ~InputRegisters() {
+      if (interp.lazyRegisters == this)
+        interp.lazyRegisters = NULL;
+    }
+
+    virtual bool get(wstring& dst, wchar_t reg) const {
+      Slice value;
+      if (!view(value, reg)) return false;
+      value.assignTo(dst);
+      return true;
+    }
+
+    virtual bool view(Slice& dst, wchar_t reg) const {
+      //If an input is named twice, the later one wins, as if they had been
+      //written in order
+      for (unsigned i = names.size(); i-- > 0; ) {
+        if (names[i] == reg) {
+          dst = Slice(values[i]);
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    virtual bool supplies(wchar_t reg) const {
+      return wstring::npos != names.find(reg);
+    }
 
+    virtual void bind(Interpreter& interp) const {
+      for (unsigned i = 0; i < names.size(); ++i)
+        interp.writeRegister(names[i]).assign(Slice(values[i]));
+    }
+  };
+
+  /**
+   * Performs one invocation of the given UserFunction, without saving or
+   * restoring the registers. Input may be std::wstring or Slice.
+   */
+  template<typename Input>
+  static bool runUserFunction(UserFunction* uf, wstring* out, const Input* in,
+                              Interpreter& interp) {
     //Bind inputs
-    for (unsigned i = 0; i < uf->inputs.size(); ++i)
-      interp.registers[uf->inputs[i]] = in[i];
+    InputRegisters<Input> inputs(interp, uf->inputs, in);
 
     //Call main command
-    bool result = interp.exec(out[0], uf->body.get());
+    if (!interp.exec(out[0], uf->body.get()))
+      return false;
+
+    //Bind outputs; an output register left unset yields the empty string
+    for (unsigned i = 0; i < uf->outputs.size(); ++i)
+      if (!interp.readRegister(out[i+1], uf->outputs[i]))
+        out[i+1].clear();
+
+    return true;
+  }
+
+  template<typename Input>
+  static bool executeUserFunction(wstring* out, const Input* in,
+                                  Interpreter& interp, unsigned ref) {
+    UserFunction* uf = (UserFunction*)interp.external(ref);
+    //Only the registers the body changes are saved, by a RegisterLog, rather
+    //than copying all of them
+    interp.bindRegisters();
+    Interpreter::RegisterLog log;
+    Interpreter::RegisterLog* outerLog = interp.registerLog;
+    interp.registerLog = &log;
 
-    //If successful, bind outputs
-    for (unsigned i = 0; result && i < uf->outputs.size(); ++i)
-      out[i] = interp.registers[uf->outputs[i]];
+    bool result = runUserFunction(uf, out, in, interp);
 
     //Restore registers
-    interp.registers = regbak;
+    interp.bindRegisters();
+    log.undo(interp.registers);
+    interp.registerLog = outerLog;
+
+    return result;
+  }
 
+  /**
+   * Default batch adapter for user functions. Rather than copying all the
+   * registers, only those the body actually changes are saved (by a
+   * RegisterLog) and restored between invocations, so each invocation still
+   * begins with the caller's registers.
+   */
+  static bool executeUserFunctionBatch(wstring* out, const Slice* in,
+                                       unsigned count,
+                                       Interpreter& interp, unsigned ref) {
+    UserFunction* uf = (UserFunction*)interp.external(ref);
+    unsigned outputArity = uf->outputs.size()+1;
+    unsigned inputArity = uf->inputs.size();
+    interp.bindRegisters();
+    Interpreter::RegisterLog log;
+    Interpreter::RegisterLog* outerLog = interp.registerLog;
+    interp.registerLog = &log;
+
+    bool result = true;
+    for (unsigned i = 0; result && i < count; ++i) {
+      if (i) log.undo(interp.registers);
+      result = runUserFunction(uf, out + i*outputArity, in + i*inputArity,
+                               interp);
+      interp.bindRegisters();
+    }
+
+    log.undo(interp.registers);
+    interp.registerLog = outerLog;
     return result;
   }
 
@@ -71,7 +183,9 @@ namespace tglng {
 
       interp.commandsL[longName] =
         new FunctionParser(
-          Function(outputs.size()+1, inputs.size(), executeUserFunction, ref));
+          Function(outputs.size()+1, inputs.size(),
+                   executeUserFunction<wstring>, executeUserFunction<Slice>,
+                   executeUserFunctionBatch, ref));
       if (shortName)
         interp.commandsS[shortName] = interp.commandsL[longName];
 
@@ -117,6 +231,8 @@ namespace tglng {
   static GlobalBinding<DefunParser> _defun(L"defun");
 
   static unsigned nextLambdaName = 0;
+  //Guards nextLambdaName, since list-pmap workers may parse code
+  static Mutex nextLambdaNameMutex;
   class LambdaParser: public CommandParser, private BasicFunctionDefiner {
   public:
     ParseResult parse(Interpreter& interp,
@@ -137,7 +253,10 @@ namespace tglng {
       wostringstream name;
       //It is impossible for the user to define command names containing a
       //hash, so this guarantees that there will be no collision
-      name << L"lambda#" << nextLambdaName++;
+      {
+        MutexLock lock(nextLambdaNameMutex);
+        name << L"lambda#" << nextLambdaName++;
+      }
 
       assert(!interp.commandsL.count(name.str()));
       if (!defineFunction(interp,
@@ -166,7 +285,7 @@ namespace tglng {
     DynamicFunctionInvocation(Command* left,
                               auto_ptr<Command>& dynfun_,
                               const wstring& outregs,
-                              const vector<Command*> args)
+                              const vector<Command*>& args)
     : FunctionInvocation(left, Function(), outregs, args),
       dynfun(dynfun_)
     { }
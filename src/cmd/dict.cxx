@@ -0,0 +1,260 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "../interp.hxx"
+#include "../function.hxx"
+#include "../common.hxx"
+#include "../unordered.hxx"
+#include "../thread.hxx"
+#include "list.hxx"
+
+using namespace std;
+
+namespace tglng {
+  /* A dictionary is a list of alternating keys and values, in the order the
+   * keys were first inserted. If a key occurs more than once, the last value
+   * given for it wins. A trailing key without a value maps to the empty
+   * string.
+   *
+   * Like lists, dictionaries are passed around as text. The parsed form of
+   * the last few dictionaries seen is kept along with their text, so that a
+   * lookup in an already-seen dictionary costs one comparison of its text
+   * (no more than reading it out of a register already did) plus a hash
+   * table lookup, rather than parsing it again. Updates modify the cached
+   * form in place, since the old version of a dictionary is normally
+   * discarded; they still take time proportional to the size of the text,
+   * since the result is a new text.
+   *
+   * Each thread has its own cache (see list-pmap). The memory it holds counts
+   * toward the memory limit.
+   */
+  namespace {
+    struct Dict {
+      wstring text;
+      //Deleted entries stay in keys and values, so that the others need not
+      //be reindexed, but are marked as not live
+      vector<wstring> keys, values;
+      vector<bool> live;
+      //Maps each live key to its index in keys and values
+      hash_map<wstring,unsigned>::type index;
+      //Whether text ends with a key without a value, which must be given one
+      //before anything is appended, lest it swallow the next key
+      bool dangling;
+      //The number of characters in keys (counted twice, for index) and
+      //values, including deleted entries
+      unsigned long itemChars;
+      //The memory held, as added to Interpreter::cachedMemory
+      unsigned long bytes;
+
+      Dict() : dangling(false), itemChars(0), bytes(0) {}
+      ~Dict() { clear(); }
+
+      void clear() {
+        releaseStorage(text);
+        releaseStorage(keys);
+        releaseStorage(values);
+        releaseStorage(live);
+        releaseStorage(index);
+        dangling = false;
+        itemChars = 0;
+        account();
+      }
+
+      /**
+       * Updates Interpreter::cachedMemory after the contents have changed.
+       */
+      void account() {
+        unsigned long now = (text.size() + itemChars) * sizeof(wchar_t);
+        Interpreter::cachedMemory.add(now - bytes);
+        bytes = now;
+      }
+
+      void put(const wstring& key, const wstring& value) {
+        pair<hash_map<wstring,unsigned>::type::iterator,bool> ins =
+          index.insert(make_pair(key, (unsigned)keys.size()));
+        if (ins.second) {
+          keys.push_back(key);
+          values.push_back(value);
+          live.push_back(true);
+          itemChars += 2*key.size() + value.size();
+        } else {
+          wstring& old(values[ins.first->second]);
+          itemChars += value.size() - old.size();
+          old = value;
+        }
+      }
+
+      /**
+       * Removes the given key, returning whether it was present.
+       */
+      bool erase(const wstring& key) {
+        hash_map<wstring,unsigned>::type::iterator it = index.find(key);
+        if (it == index.end())
+          return false;
+
+        live[it->second] = false;
+        index.erase(it);
+        return true;
+      }
+
+      void serialise() {
+        text.clear();
+        for (unsigned i = 0; i < keys.size(); ++i) {
+          if (live[i]) {
+            list::lappend(text, keys[i]);
+            list::lappend(text, values[i]);
+          }
+        }
+        dangling = false;
+      }
+    };
+
+    const unsigned DICT_CACHE_SIZE = 8;
+    struct DictCache {
+      Dict entries[DICT_CACHE_SIZE];
+      bool valid[DICT_CACHE_SIZE];
+      unsigned next;
+
+      DictCache() : next(0) {
+        for (unsigned i = 0; i < DICT_CACHE_SIZE; ++i)
+          valid[i] = false;
+      }
+    };
+    ThreadLocal<DictCache> dictCache;
+  }
+
+  /**
+   * Returns the parsed form of the given dictionary, parsing it into the
+   * cache if necessary. The result is valid until the next call.
+   */
+  static Dict& parseDict(const wstring& text) {
+    DictCache& cache(dictCache.get());
+    for (unsigned i = 0; i < DICT_CACHE_SIZE; ++i)
+      if (cache.valid[i] && cache.entries[i].text == text)
+        return cache.entries[i];
+
+    unsigned slot = cache.next;
+    cache.next = (cache.next + 1) % DICT_CACHE_SIZE;
+    Dict& dict(cache.entries[slot]);
+    dict.clear();
+
+    list::Items items(text);
+    for (unsigned i = 0; i < items.size(); i += 2)
+      dict.put(items[i], i+1 < items.size()? items[i+1] : wstring());
+
+    dict.text = text;
+    dict.dangling = items.size() % 2;
+    dict.account();
+    cache.valid[slot] = true;
+    return dict;
+  }
+
+  /**
+   * Looks the given key up in the dictionary. Returns the value, or NULL if
+   * the key is not present.
+   */
+  static const wstring* dictFind(const Dict& dict, const wstring& key) {
+    hash_map<wstring,unsigned>::type::const_iterator it =
+      dict.index.find(key);
+    return it == dict.index.end()? NULL : &dict.values[it->second];
+  }
+
+  /**
+   * Returns the value associated with the given key, or the default if the
+   * dictionary does not contain the key.
+   *
+   * (value <- dict key [default])
+   */
+  static bool dictGet(wstring* out, const wstring* in,
+                      Interpreter&, unsigned) {
+    const wstring* value = dictFind(parseDict(in[0]), in[1]);
+    out[0] = value? *value : in[2];
+    return true;
+  }
+
+  /**
+   * Returns whether the dictionary contains the given key.
+   *
+   * (has <- dict key)
+   */
+  static bool dictHas(wstring* out, const wstring* in,
+                      Interpreter&, unsigned) {
+    out[0] = dictFind(parseDict(in[0]), in[1])? L"1" : L"0";
+    return true;
+  }
+
+  /**
+   * Associates the given value with the given key, replacing any existing
+   * value.
+   *
+   * (dict <- dict key value)
+   */
+  static bool dictPut(wstring* out, const wstring* in,
+                      Interpreter&, unsigned) {
+    Dict& dict(parseDict(in[0]));
+    unsigned oldSize = dict.keys.size();
+    dict.put(in[1], in[2]);
+
+    if (dict.keys.size() != oldSize) {
+      //New keys go at the end, so the text can simply be extended
+      if (dict.dangling)
+        list::lappend(dict.text, wstring());
+      dict.dangling = false;
+      list::lappend(dict.text, in[1]);
+      list::lappend(dict.text, in[2]);
+    } else {
+      dict.serialise();
+    }
+
+    dict.account();
+    out[0] = dict.text;
+    return true;
+  }
+
+  /**
+   * Removes the given key from the dictionary, if present.
+   *
+   * (dict <- dict key)
+   */
+  static bool dictDelete(wstring* out, const wstring* in,
+                         Interpreter&, unsigned) {
+    Dict& dict(parseDict(in[0]));
+    if (dict.erase(in[1])) {
+      dict.serialise();
+      dict.account();
+    }
+
+    out[0] = dict.text;
+    return true;
+  }
+
+  /**
+   * Returns a list of the keys in the dictionary, in insertion order.
+   *
+   * (keys <- dict)
+   */
+  static bool dictKeys(wstring* out, const wstring* in,
+                       Interpreter&, unsigned) {
+    const Dict& dict(parseDict(in[0]));
+    vector<wstring> keys;
+    keys.reserve(dict.index.size());
+    for (unsigned i = 0; i < dict.keys.size(); ++i)
+      if (dict.live[i])
+        keys.push_back(dict.keys[i]);
+    list::build(out[0], keys);
+    return true;
+  }
+
+  static GlobalBinding<TFunctionParser<1,3,dictGet> > _dictGet(L"dict-get");
+  static GlobalBinding<TFunctionParser<1,2,dictHas> > _dictHas(L"dict-has");
+  static GlobalBinding<TFunctionParser<1,3,dictPut> > _dictPut(L"dict-put");
+  static GlobalBinding<TFunctionParser<1,2,dictDelete> >
+  _dictDelete(L"dict-del");
+  static GlobalBinding<TFunctionParser<1,1,dictKeys> >
+  _dictKeys(L"dict-keys");
+}
@@ -10,6 +10,7 @@
 #include "../interp.hxx"
 #include "../argument.hxx"
 #include "../common.hxx"
+#include "../thread.hxx"
 
 using namespace std;
 
@@ -17,6 +18,8 @@ namespace tglng {
   class Ensemble;
   typedef map<pair<Interpreter*,wstring>, Ensemble*> ensembles_t;
   static ensembles_t ensembles;
+  //Guards ensembles, since list-pmap workers may parse code
+  static Mutex ensemblesMutex;
 
   class Ensemble: public CommandParser {
     Interpreter*const parentInterp;
@@ -26,10 +29,12 @@ namespace tglng {
   public:
     Ensemble(Interpreter* par, const wstring& name_)
     : parentInterp(par), name(name_) {
+      MutexLock lock(ensemblesMutex);
       ensembles.insert(make_pair(make_pair(par,name_), this));
     }
 
     virtual ~Ensemble() {
+      MutexLock lock(ensemblesMutex);
       ensembles.erase(make_pair(parentInterp, name));
     }
 
@@ -96,9 +101,16 @@ namespace tglng {
              a.h(shortname)])
         return ParseError;
 
-      ensembles_t::const_iterator eit =
-        ensembles.find(make_pair(&interp, ename));
-      if (eit == ensembles.end()) {
+      Ensemble* ensemble = NULL;
+      {
+        MutexLock lock(ensemblesMutex);
+        ensembles_t::const_iterator eit =
+          ensembles.find(make_pair(&interp, ename));
+        if (eit != ensembles.end())
+          ensemble = eit->second;
+      }
+
+      if (!ensemble) {
         interp.error(wstring(L"No such ensemble: ") + ename, text, enameOffset);
         return ParseError;
       }
@@ -116,7 +128,7 @@ namespace tglng {
         return ParseError;
       }
 
-      eit->second->bind(shortname, cit->second);
+      ensemble->bind(shortname, cit->second);
       return ContinueParsing;
     }
   };
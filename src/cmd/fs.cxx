@@ -38,6 +38,7 @@ namespace tglng {
     glob_t results;
 
     out->clear();
+    vector<wstring> names;
 
     //Transcode in[0] to a narrow string
     vector<char> pattern;
@@ -62,10 +63,11 @@ namespace tglng {
         }
 
         //OK, add to the list
-        list::lappend(*out, name);
+        names.push_back(name);
       }
 
       globfree(&results);
+      list::build(*out, names);
     }
 
     return true;
@@ -12,6 +12,7 @@
 #include "../argument.hxx"
 #include "../common.hxx"
 #include "../function.hxx"
+#include "../regex.hxx"
 #include "basic_parsers.hxx"
 
 using namespace std;
@@ -166,6 +167,14 @@ namespace tglng {
       if (!a[a.h(), a.to(wlocaleName, L'#') >> nameOffset])
         return ParseError;
 
+      //The locale is global to the process, so other workers would see it
+      //change under them
+      if (interp.isWorker) {
+        interp.error(L"Cannot change the locale within list-pmap",
+                     text, nameOffset);
+        return ParseError;
+      }
+
       //All known non-EBCDIC systems use ASCII-only locale names, so transcode
       //the easy way
       string nlocaleName;
@@ -175,6 +184,7 @@ namespace tglng {
 
       setlocale(LC_ALL, nlocaleName.c_str());
       setlocale(LC_NUMERIC, "C");
+      regexLocaleChanged();
       try {
         locale::global(locale(nlocaleName.c_str()));
       } catch (...) {
@@ -229,14 +239,16 @@ namespace tglng {
       return true;
     }
 
-    bool characterCode(wstring* out, const wstring* in,
+    bool characterCode(wstring* out, const Slice* in, unsigned count,
                        Interpreter& interp, unsigned) {
-      if (in->empty()) {
-        wcerr << L"Empty string to character-code" << endl;
-        return false;
-      }
+      for (unsigned i = 0; i < count; ++i) {
+        if (in[i].empty()) {
+          wcerr << L"Empty string to character-code" << endl;
+          return false;
+        }
 
-      *out = intToStr((signed)(*in)[0]);
+        out[i] = intToStr((signed)in[i][0]);
+      }
       return true;
     }
 
@@ -244,7 +256,7 @@ namespace tglng {
     static GlobalBinding<TFunctionParser<1,1,warn > > _warn (L"warn" );
     static GlobalBinding<TFunctionParser<1,1,character> >
     _character(L"character");
-    static GlobalBinding<TFunctionParser<1,1,characterCode> >
+    static GlobalBinding<TBatchFunctionParser<1,1,characterCode> >
     _characterCode(L"character-code");
   }
 
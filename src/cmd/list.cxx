@@ -4,6 +4,8 @@
 
 #include <string>
 #include <cctype>
+#include <vector>
+#include <algorithm>
 
 #include "list.hxx"
 #include "../interp.hxx"
@@ -12,28 +14,41 @@
 #include "../function.hxx"
 #include "../tokeniser.hxx"
 #include "../common.hxx"
+#include "../unordered.hxx"
+#include "../thread.hxx"
 #include "default_tokeniser.hxx"
+#include "data_tokenisers.hxx"
 
 using namespace std;
 
 namespace tglng {
-  bool list::escape(wstring* out, const wstring* in,
-                    Interpreter& interp, unsigned) {
-    wstring str(in[0]);
-
+  /**
+   * Appends the escaped form of the given item (see list::escape()) to dst.
+   *
+   * The item is classified in a single pass, which also determines the exact
+   * size of the output, so that the result can be written directly into dst
+   * with at most one reallocation. item must not point into dst.
+   */
+  static void appendEscaped(wstring& dst, const wchar_t* item, unsigned len) {
     //See what characters of concern are present
     bool
       hasSpace = false,
       hasParen = false,
       hasBrack = false,
-      hasBrace = false,
-      hasSlash = false;
-    for (unsigned i = 0; i < str.size(); ++i) {
-      hasSpace |= iswspace(str[i]);
-      hasParen |= str[i] == L'(' || str[i] == L')';
-      hasBrack |= str[i] == L'[' || str[i] == L']';
-      hasBrace |= str[i] == L'{' || str[i] == L'}';
-      hasSlash |= str[i] == L'\\';
+      hasBrace = false;
+    unsigned slashes = 0, braces = 0;
+    for (unsigned i = 0; i < len; ++i) {
+      wchar_t ch = item[i];
+      switch (ch) {
+      case L'\\': ++slashes; break;
+      case L'(': case L')': hasParen = true; break;
+      case L'[': case L']': hasBrack = true; break;
+      case L'{': case L'}': hasBrace = true; ++braces; break;
+      default:
+        //All ASCII whitespace is at or below the space character
+        if ((ch <= L' ' || ch >= 0x80) && iswspace(ch))
+          hasSpace = true;
+      }
     }
 
     /* The string must be enclosed in a parenthesis-like pair only if it
@@ -42,76 +57,247 @@ namespace tglng {
      * used, use braces and escape the others.
      */
     bool escapeBraces = hasParen && hasBrack && hasBrace;
-
-    //Escape backslashes, and braces if needed
-    if (hasSlash || escapeBraces) {
-      for (unsigned i = 0; i < str.size(); ++i) {
-        if (str[i] == L'\\')
-          str.insert(i++, 1, L'\\');
-        else if ((str[i] == L'{' || str[i] == L'}') &&
-                 escapeBraces)
-          str.insert(i++, 1, L'\\');
+    bool enclose = hasSpace || hasParen || hasBrack || hasBrace || !len;
+    wchar_t open = L'{', close = L'}';
+    if (!hasParen)
+      open = L'(', close = L')';
+    else if (!hasBrack)
+      open = L'[', close = L']';
+
+    unsigned outlen = len + slashes + (escapeBraces? braces : 0) +
+      (enclose? 2 : 0);
+    unsigned base = dst.size();
+    dst.resize(base + outlen);
+    wchar_t* out = &dst[base];
+
+    if (enclose) *out++ = open;
+    if (!slashes && !escapeBraces) {
+      wstring::traits_type::copy(out, item, len);
+      out += len;
+    } else {
+      //Escape backslashes, and braces if needed
+      for (unsigned i = 0; i < len; ++i) {
+        wchar_t ch = item[i];
+        if (ch == L'\\' || (escapeBraces && (ch == L'{' || ch == L'}')))
+          *out++ = L'\\';
+        *out++ = ch;
       }
     }
+    if (enclose) *out++ = close;
+  }
 
-    if (hasSpace || hasParen || hasBrack || hasBrace || str.empty()) {
-      if (!hasParen)
-        str = L'(' + str + L')';
-      else if (!hasBrack)
-        str = L'[' + str + L']';
-      else
-        str = L'{' + str + L'}';
-    }
-
-    out[0] = str;
+  bool list::escape(wstring* out, const wstring* in,
+                    Interpreter&, unsigned) {
+    wstring escaped;
+    appendEscaped(escaped, in[0].data(), in[0].size());
+    out[0].swap(escaped);
     return true;
   }
 
   void list::lappend(wstring& list, const wstring& item) {
-    if (list.empty())
-      escape(&list, &item, *(Interpreter*)NULL, 0);
-    else {
-      wstring escaped;
-      escape(&escaped, &item, *(Interpreter*)NULL, 0);
-      list += L' ';
-      list += escaped;
+    if (&list == &item) {
+      //Cannot write into the item being read
+      wstring copy(item);
+      lappend(list, copy);
+      return;
     }
+
+    if (!list.empty())
+      list += L' ';
+    appendEscaped(list, item.data(), item.size());
   }
 
   bool list::append(wstring* out, const wstring* in,
-                    Interpreter& interp, unsigned) {
-    if (!escape(out, in+1, interp, 0)) return false;
-    if (!in[0].empty())
-      out[0] = in[0] + L' ' + out[0];
+                    Interpreter&, unsigned) {
+    wstring result(in[0]);
+    if (!result.empty())
+      result += L' ';
+    appendEscaped(result, in[1].data(), in[1].size());
+    out[0].swap(result);
     return true;
   }
 
   bool list::lcar(wstring& car, wstring& cdr,
                   const wstring& list, Interpreter& interp) {
-    wstring preout[2], prein[2];
-    prein[0] = list;
-    prein[1] = L"e";
-    if (!defaultTokeniserPreprocessor(preout, prein,
-                                      interp, 0))
-      return false;
+    return lcar(car, cdr, Slice(list), interp);
+  }
 
-    if (preout[0].empty()) {
+  bool list::lcar(wstring& car, wstring& cdr,
+                  const Slice& list, Interpreter&) {
+    //list may refer to car or cdr, so the results are only swapped in once
+    //the scanner is done with it.
+    Scanner scanner(list);
+    wstring item;
+    if (!scanner.next(item))
       return false;
-    }
 
-    prein[0] = preout[0];
+    wstring rest(scanner.remainder().str());
+    car.swap(item);
+    cdr.swap(rest);
+    return true;
+  }
+
+  /* Lists are tokenised with the default tokeniser's default options, which
+   * are what "e" amounts to.
+   */
+  static const DefaultTokeniserOptions listOptions;
 
-    if (!defaultTokeniser(preout, prein, interp, 0))
+  bool list::Scanner::next(wstring& item) {
+    offset = defaultTokeniserSkip(text, offset, listOptions);
+    if (offset >= text.size)
       return false;
 
-    car = preout[0];
-    cdr = preout[1];
+    offset = defaultTokeniserNext(item, text, offset, listOptions);
     return true;
   }
 
-  bool list::car(wstring* out, const wstring* in,
+  /* Values in TglNG are always strings, so lists passed between builtins
+   * have to be serialised and tokenised again at every step. To avoid most of
+   * the latter, the items of the last few large lists built or read are kept
+   * together with their text; a list whose text matches one of them exactly
+   * need not be tokenised.
+   *
+   * Comparing the text is a plain memory comparison, much cheaper than
+   * tokenising, but small lists are not worth evicting larger ones for. The
+   * cached items are lent out in place (see list::Items) or moved out (see
+   * list::split()), never copied, and the memory they hold counts toward the
+   * memory limit.
+   *
+   * Each thread has its own cache (see list-pmap).
+   */
+  struct list::CachedList {
+    wstring text;
+    vector<wstring> items;
+    //The number of Items reading items; while non-zero, the entry must not
+    //be changed
+    unsigned pins;
+    //The memory held, as added to Interpreter::cachedMemory
+    unsigned long bytes;
+
+    CachedList() : pins(0), bytes(0) {}
+    ~CachedList() { clear(); }
+
+    /**
+     * Replaces the contents of this entry with the given list, taking the
+     * contents of newItems.
+     */
+    void fill(const Slice& list, vector<wstring>& newItems) {
+      clear();
+      list.assignTo(text);
+      items.swap(newItems);
+
+      unsigned long chars = text.size();
+      for (unsigned i = 0; i < items.size(); ++i)
+        chars += items[i].size();
+      bytes = chars * sizeof(wchar_t);
+      Interpreter::cachedMemory.add(bytes);
+    }
+
+    void clear() {
+      releaseStorage(text);
+      releaseStorage(items);
+      Interpreter::cachedMemory.add(-bytes);
+      bytes = 0;
+    }
+  };
+
+  namespace {
+    const unsigned LIST_CACHE_SIZE = 4;
+    const unsigned LIST_CACHE_MIN_ITEMS = 16;
+    struct ListCache {
+      list::CachedList entries[LIST_CACHE_SIZE];
+      unsigned next;
+
+      ListCache() : next(0) {}
+    };
+    ThreadLocal<ListCache> listCache;
+  }
+
+  /**
+   * Returns the cache entry for the given list, or NULL if it is not in the
+   * cache.
+   */
+  static list::CachedList* recall(const Slice& list) {
+    ListCache& cache(listCache.get());
+    for (unsigned i = 0; i < LIST_CACHE_SIZE; ++i)
+      if (!cache.entries[i].items.empty() &&
+          Slice(cache.entries[i].text) == list)
+        return &cache.entries[i];
+
+    return NULL;
+  }
+
+  /**
+   * Adds the given list to the cache, taking the contents of items, and
+   * returns its entry. If the list is too small, or every entry is in use,
+   * nothing is done, and NULL is returned.
+   */
+  static list::CachedList* remember(const Slice& list,
+                                    vector<wstring>& items) {
+    if (items.size() < LIST_CACHE_MIN_ITEMS) return NULL;
+
+    ListCache& cache(listCache.get());
+    for (unsigned i = 0; i < LIST_CACHE_SIZE; ++i) {
+      list::CachedList& entry(cache.entries[cache.next]);
+      cache.next = (cache.next + 1) % LIST_CACHE_SIZE;
+      if (!entry.pins) {
+        entry.fill(list, items);
+        return &entry;
+      }
+    }
+
+    return NULL;
+  }
+
+  void list::split(vector<wstring>& dst, const Slice& list) {
+    CachedList* cached = recall(list);
+    if (!cached) {
+      defaultTokeniserAll(&dst, list, 0, listOptions);
+    } else if (cached->pins) {
+      //Being read elsewhere, so it has to stay
+      dst.insert(dst.end(), cached->items.begin(), cached->items.end());
+    } else if (dst.empty()) {
+      dst.swap(cached->items);
+      cached->clear();
+    } else {
+      unsigned base = dst.size();
+      dst.resize(base + cached->items.size());
+      for (unsigned i = 0; i < cached->items.size(); ++i)
+        dst[base+i].swap(cached->items[i]);
+      cached->clear();
+    }
+  }
+
+  list::Items::Items(const Slice& list)
+  : items(&own), pinned(recall(list))
+  {
+    if (!pinned) {
+      defaultTokeniserAll(&own, list, 0, listOptions);
+      pinned = remember(list, own);
+    }
+
+    if (pinned) {
+      ++pinned->pins;
+      items = &pinned->items;
+    }
+  }
+
+  list::Items::~Items() {
+    if (pinned)
+      --pinned->pins;
+  }
+
+  void list::build(wstring& dst, vector<wstring>& items) {
+    dst.clear();
+    for (unsigned i = 0; i < items.size(); ++i)
+      lappend(dst, items[i]);
+
+    remember(dst, items);
+  }
+
+  bool list::car(wstring* out, const Slice* in,
                  Interpreter& interp, unsigned silent) {
-    if (lcar(out[0], out[1], in[1], interp))
+    if (lcar(out[0], out[1], in[0], interp))
       return true;
     else {
       if (!silent)
@@ -120,6 +306,19 @@ namespace tglng {
     }
   }
 
+  /**
+   * Applies fun, which is compatible with (1 <- 1), to every item in items as
+   * one batch.
+   */
+  static bool applyBatch(vector<wstring>& results, const Function& fun,
+                         const vector<wstring>& items, Interpreter& interp) {
+    results.resize(items.size());
+    if (items.empty()) return true;
+
+    vector<Slice> args(items.begin(), items.end());
+    return fun.callBatch(&results[0], &args[0], items.size(), 1, 1, interp);
+  }
+
   bool list::map(wstring* out, const wstring* in,
                  Interpreter& interp, unsigned) {
     Function fun;
@@ -127,17 +326,110 @@ namespace tglng {
                        in[0], 1, 1))
       return false;
 
-    out[0].clear();
+    Items items(in[1]);
+    vector<wstring> results;
+    if (!applyBatch(results, fun, *items, interp))
+      return false;
 
-    wstring remainder(in[1]), item;
-    while (lcar(item, remainder, remainder, interp)) {
-      wstring result;
-      if (!fun.exec(&result, &item, interp, fun.parm))
-        return false;
+    build(out[0], results);
+    return true;
+  }
+
+  namespace {
+    /**
+     * State shared by all threads of one list-pmap.
+     */
+    struct ParallelMap {
+      Function fun;
+      const vector<wstring>* items;
+      vector<wstring> results;
+      Mutex mutex;
+      //The next item to be claimed by a thread, guarded by mutex
+      unsigned next;
+      //Whether any invocation has failed, guarded by mutex
+      bool failed;
+    };
+
+    struct ParallelMapWorker {
+      ParallelMap* shared;
+      Interpreter* interp;
+    };
+  }
 
-      lappend(out[0], result);
+  static void parallelMapWorker(void* vworker) {
+    ParallelMapWorker& worker(*(ParallelMapWorker*)vworker);
+    ParallelMap& shared(*worker.shared);
+
+    while (true) {
+      unsigned ix;
+      {
+        MutexLock lock(shared.mutex);
+        if (shared.failed || shared.next >= shared.items->size())
+          return;
+        ix = shared.next++;
+      }
+
+      Slice in((*shared.items)[ix]);
+      if (!shared.fun.call(&shared.results[ix], &in, *worker.interp)) {
+        MutexLock lock(shared.mutex);
+        shared.failed = true;
+        return;
+      }
     }
+  }
 
+  bool list::pmap(wstring* out, const wstring* in,
+                  Interpreter& interp, unsigned) {
+    ParallelMap shared;
+    if (!Function::get(shared.fun, interp,
+                       in[0], 1, 1))
+      return false;
+
+    signed threads = hardwareConcurrency();
+    if (!in[2].empty() && (!parseInteger(threads, in[2]) || threads < 1)) {
+      wcerr << L"tglng: error: Invalid thread count for list-pmap: "
+            << in[2] << endl;
+      return false;
+    }
+
+    Items items(in[1]);
+    shared.items = &*items;
+    shared.results.resize(items.size());
+    shared.next = 0;
+    shared.failed = false;
+    if ((unsigned)threads > items.size())
+      threads = items.size();
+
+    /* The workers are cloned up-front on this thread, since cloning reads the
+     * parent's command table. Each gets its own copy of the registers and of
+     * the let variables; the items are handed out one at a time so that
+     * uneven costs balance out.
+     */
+    vector<Interpreter*> interps(threads);
+    vector<ParallelMapWorker> workers(threads);
+    vector<void*> args(threads);
+    interp.bindRegisters();
+    for (signed i = 0; i < threads; ++i) {
+      interps[i] = new Interpreter(&interp);
+      interps[i]->registers = interp.registers;
+      interps[i]->isWorker = true;
+      workers[i].shared = &shared;
+      workers[i].interp = interps[i];
+      args[i] = &workers[i];
+    }
+
+    if (threads)
+      runParallel(parallelMapWorker, &args[0], threads);
+
+    for (signed i = 0; i < threads; ++i) {
+      interp.joinWorker(*interps[i]);
+      delete interps[i];
+    }
+
+    if (shared.failed || interp.limitExceeded())
+      return false;
+
+    build(out[0], shared.results);
     return true;
   }
 
@@ -150,12 +442,13 @@ namespace tglng {
 
     out[0] = in[2];
 
-    wstring remainder(in[1]), item;
-    while (lcar(item, remainder, remainder, interp)) {
-      wstring funin[2];
-      funin[0] = item;
-      funin[1] = out[0];
-      if (!fun.exec(out, funin, interp, fun.parm))
+    Items items(in[1]);
+    wstring accum;
+    for (unsigned i = 0; i < items.size(); ++i) {
+      //The accumulator is an input as well as the output
+      accum.swap(out[0]);
+      Slice funin[2] = { Slice(items[i]), Slice(accum) };
+      if (!fun.call(out, funin, interp))
         return false;
     }
 
@@ -169,31 +462,25 @@ namespace tglng {
                        in[0], 1, 1))
       return false;
 
-    out[0].clear();
-    out[1].clear();
-    wstring remainder(in[1]), item;
-    while (lcar(item, remainder, remainder, interp)) {
-      wstring result;
-      if (!fun.exec(&result, &item, interp, fun.parm))
-        return false;
+    Items items(in[1]);
+    vector<wstring> results;
+    if (!applyBatch(results, fun, *items, interp))
+      return false;
 
-      if (parseBool(result))
-        lappend(out[0], item);
-      else
-        lappend(out[1], item);
-    }
+    vector<wstring> accepted, rejected;
+    for (unsigned i = 0; i < items.size(); ++i)
+      (parseBool(results[i])? accepted : rejected).push_back(items[i]);
 
+    build(out[0], accepted);
+    build(out[1], rejected);
     return true;
   }
 
-  unsigned list::llength(const wstring& list, Interpreter& interp) {
-    wstring remainder(list), item;
-    unsigned len = 0;
-    while (lcar(item, remainder, remainder, interp)) {
-      ++len;
-    }
+  unsigned list::llength(const wstring& list, Interpreter&) {
+    if (const CachedList* cached = recall(list))
+      return cached->items.size();
 
-    return len;
+    return defaultTokeniserAll(NULL, list, 0, listOptions);
   }
 
   bool list::length(wstring* out, const wstring* in,
@@ -221,13 +508,25 @@ namespace tglng {
       }
     }
 
+    if (const CachedList* cached = recall(in[0])) {
+      if ((unsigned)ix >= cached->items.size()) {
+        wcerr << L"Integer out of range for list index: "
+              << in[1] << L" (list length is " << cached->items.size()
+              << L")" << endl;
+        return false;
+      }
+
+      out[0] = cached->items[ix];
+      return true;
+    }
+
     //We must loop one additional time since the first call returns the zeroth
     //item.
     ++ix;
 
-    wstring remainder(in[0]);
+    Scanner scanner(in[0]);
     unsigned len = 0;
-    while (ix && lcar(out[0], remainder, remainder, interp)) {
+    while (ix && scanner.next(out[0])) {
       --ix, ++len;
     }
 
@@ -242,38 +541,37 @@ namespace tglng {
 
   bool list::zip(wstring* out, const wstring* in,
                  Interpreter& interp, unsigned) {
-    vector<wstring> lists;
-    wstring item, remainder(in[0]);
-
-    while (lcar(item, remainder, remainder, interp))
-      lists.push_back(item);
+    Items lists(in[0]);
+    //The scanners refer into the items, which outlive them
+    vector<Scanner> scanners((*lists).begin(), (*lists).end());
 
-    out[0].clear();
+    vector<wstring> zipped;
+    wstring item;
     bool someListIsNonEmpty;
     do {
       someListIsNonEmpty = false;
 
-      for (unsigned i = 0; i < lists.size(); ++i) {
-        if (lcar(item, lists[i], lists[i], interp))
-          lappend(out[0], item);
-
-        someListIsNonEmpty |= !lists[i].empty();
-      }
+      for (unsigned i = 0; i < scanners.size(); ++i)
+        if (scanners[i].next(item)) {
+          zipped.push_back(item);
+          someListIsNonEmpty = true;
+        }
     } while (someListIsNonEmpty);
 
+    build(out[0], zipped);
     return true;
   }
 
   bool list::flatten(wstring* out, const wstring* in,
                      Interpreter& interp, unsigned) {
-    wstring list, lists(in[0]);
+    Items lists(in[0]);
     out[0].clear();
-    while (lcar(list, lists, lists, interp)) {
+    for (unsigned i = 0; i < lists.size(); ++i) {
       if (out[0].empty())
-        out[0] = list;
+        out[0] = lists[i];
       else {
         out[0] += L' ';
-        out[0] += list;
+        out[0] += lists[i];
       }
     }
 
@@ -283,7 +581,6 @@ namespace tglng {
   bool list::unzip(wstring* out, const wstring* in,
                    Interpreter& interp, unsigned) {
     signed stride = 2;
-    wstring item, list(in[0]);
     if (!in[1].empty()) {
       if (!parseInteger(stride, in[1]) || stride <= 1) {
         wcerr << L"tglng: error: Invalid integer for list-unzip stride: "
@@ -292,22 +589,330 @@ namespace tglng {
       }
     }
 
+    Items items(in[0]);
     vector<wstring> lists(stride);
-    while (!list.empty()) {
-      for (unsigned i = 0; i < lists.size() && !list.empty(); ++i) {
-        if (lcar(item, list, list, interp))
-          lappend(lists[i], item);
+    for (unsigned i = 0; i < items.size(); ++i)
+      lappend(lists[i % stride], items[i]);
+
+    build(out[0], lists);
+
+    return true;
+  }
+
+  /**
+   * Computes the sort/grouping keys of the given items. If funname is empty,
+   * the items are their own keys.
+   */
+  static bool computeKeys(vector<wstring>& keys, const wstring& funname,
+                          const vector<wstring>& items, Interpreter& interp) {
+    if (funname.empty()) {
+      keys = items;
+      return true;
+    }
+
+    Function fun;
+    if (!Function::get(fun, interp, funname, 1, 1))
+      return false;
+
+    return applyBatch(keys, fun, items, interp);
+  }
+
+  namespace {
+    /**
+     * Orders indices into a key array, either lexicographically by key or by
+     * a user-supplied (less? <- a b) function.
+     *
+     * The standard algorithms offer no way to abort, so once the function
+     * fails, every further comparison just returns false; the caller must
+     * check failed afterwards.
+     */
+    class KeyOrder {
+      const vector<wstring>& keys;
+      const Function* less;
+      Interpreter* interp;
+      bool* failed;
+
+    public:
+      KeyOrder(const vector<wstring>& keys_, const Function* less_,
+               Interpreter& interp_, bool& failed_)
+      : keys(keys_), less(less_), interp(&interp_), failed(&failed_) {}
+
+      bool operator()(unsigned a, unsigned b) const {
+        if (!less)
+          return keys[a] < keys[b];
+        if (*failed)
+          return false;
+
+        Slice in[2] = { Slice(keys[a]), Slice(keys[b]) };
+        wstring out;
+        if (!less->call(&out, in, *interp)) {
+          *failed = true;
+          return false;
+        }
+
+        return parseBool(out);
       }
+    };
+  }
+
+  bool list::sort(wstring* out, const wstring* in,
+                  Interpreter& interp, unsigned) {
+    Function less;
+    if (!in[2].empty() &&
+        !Function::get(less, interp, in[2], 1, 2))
+      return false;
+
+    vector<wstring> items, keys;
+    split(items, in[0]);
+    if (!computeKeys(keys, in[1], items, interp))
+      return false;
+
+    vector<unsigned> order(items.size());
+    for (unsigned i = 0; i < order.size(); ++i)
+      order[i] = i;
+
+    bool failed = false;
+    std::stable_sort(order.begin(), order.end(),
+                     KeyOrder(keys, in[2].empty()? NULL : &less,
+                              interp, failed));
+    if (failed)
+      return false;
+
+    vector<wstring> sorted(items.size());
+    for (unsigned i = 0; i < order.size(); ++i)
+      sorted[i].swap(items[order[i]]);
+
+    build(out[0], sorted);
+    return true;
+  }
+
+  bool list::unique(wstring* out, const wstring* in,
+                    Interpreter& interp, unsigned) {
+    Items items(in[0]);
+    vector<wstring> keys, result;
+    if (!computeKeys(keys, in[1], *items, interp))
+      return false;
+
+    hash_set<wstring>::type seen;
+    for (unsigned i = 0; i < items.size(); ++i)
+      if (seen.insert(keys[i]).second)
+        result.push_back(items[i]);
+
+    build(out[0], result);
+    return true;
+  }
+
+  bool list::groupBy(wstring* out, const wstring* in,
+                     Interpreter& interp, unsigned) {
+    Items items(in[0]);
+    vector<wstring> keys, groups, groupKeys;
+    if (!computeKeys(keys, in[1], *items, interp))
+      return false;
+
+    //Maps each key to its index in groups
+    hash_map<wstring,unsigned>::type index;
+    for (unsigned i = 0; i < items.size(); ++i) {
+      unsigned group = groups.size();
+      pair<hash_map<wstring,unsigned>::type::iterator,bool> ins =
+        index.insert(make_pair(keys[i], group));
+      if (ins.second) {
+        groups.push_back(wstring());
+        groupKeys.push_back(keys[i]);
+      } else {
+        group = ins.first->second;
+      }
+
+      lappend(groups[group], items[i]);
     }
 
-    out[0].clear();
-    for (unsigned i = 0; i < lists.size(); ++i)
-      lappend(out[0], lists[i]);
+    build(out[0], groups);
+    build(out[1], groupKeys);
+    return true;
+  }
+
+  bool list::contains(wstring* out, const wstring* in,
+                      Interpreter&, unsigned) {
+    bool found = false;
+    if (const CachedList* cached = recall(in[0])) {
+      found = std::find(cached->items.begin(), cached->items.end(), in[1]) !=
+        cached->items.end();
+    } else {
+      Scanner scanner(in[0]);
+      wstring item;
+      while (!found && scanner.next(item))
+        found = (item == in[1]);
+    }
+
+    out[0] = found? L"1" : L"0";
+    return true;
+  }
+
+  /**
+   * Splits a and b, and returns (in result) the distinct items of a, in order
+   * of first occurrence, which are in b if keepIfInB is true or not in b
+   * otherwise. b is hashed once, so this takes linear time.
+   */
+  static void filterBySet(vector<wstring>& result,
+                          const wstring& a, const wstring& b,
+                          bool keepIfInB) {
+    list::Items aitems(a), bitems(b);
+
+    hash_set<wstring>::type inB((*bitems).begin(), (*bitems).end()), seen;
+    for (unsigned i = 0; i < aitems.size(); ++i)
+      if ((inB.count(aitems[i]) != 0) == keepIfInB &&
+          seen.insert(aitems[i]).second)
+        result.push_back(aitems[i]);
+  }
+
+  bool list::setUnion(wstring* out, const wstring* in,
+                      Interpreter&, unsigned) {
+    Items a(in[0]), b(in[1]);
+    vector<wstring> result;
+
+    hash_set<wstring>::type seen;
+    for (unsigned i = 0; i < a.size(); ++i)
+      if (seen.insert(a[i]).second)
+        result.push_back(a[i]);
+    for (unsigned i = 0; i < b.size(); ++i)
+      if (seen.insert(b[i]).second)
+        result.push_back(b[i]);
+
+    build(out[0], result);
+    return true;
+  }
+
+  bool list::intersect(wstring* out, const wstring* in,
+                       Interpreter&, unsigned) {
+    vector<wstring> result;
+    filterBySet(result, in[0], in[1], true);
+    build(out[0], result);
+    return true;
+  }
+
+  bool list::difference(wstring* out, const wstring* in,
+                        Interpreter&, unsigned) {
+    vector<wstring> result;
+    filterBySet(result, in[0], in[1], false);
+    build(out[0], result);
+    return true;
+  }
+
+  /**
+   * Parses every item in the given list as an integer. On failure, prints a
+   * diagnostic mentioning the given function name and returns false.
+   */
+  static bool parseIntegers(vector<signed>& dst, const wstring& list,
+                            const wchar_t* who) {
+    list::Items items(list);
+
+    dst.resize(items.size());
+    for (unsigned i = 0; i < items.size(); ++i) {
+      if (!parseInteger(dst[i], items[i])) {
+        wcerr << L"tglng: error: " << who << L": Invalid integer: "
+              << items[i] << endl;
+        return false;
+      }
+    }
 
     return true;
   }
 
-  static GlobalBinding<TFunctionParser<2,1,list::car> >
+  bool list::range(wstring* out, const wstring* in,
+                   Interpreter&, unsigned) {
+    signed start = 0, end, step = 1;
+    //A single bound is the end; two are the start and the end
+    const wstring& endText(in[1].empty()? in[0] : in[1]);
+    if ((!in[1].empty() && !parseInteger(start, in[0])) ||
+        !parseInteger(end, endText) ||
+        (!in[2].empty() && !parseInteger(step, in[2]))) {
+      wcerr << L"tglng: error: list-range: Invalid integer: "
+            << in[0] << L", " << in[1] << L", " << in[2] << endl;
+      return false;
+    }
+
+    if (!step) {
+      wcerr << L"tglng: error: list-range: Step is zero" << endl;
+      return false;
+    }
+
+    vector<wstring> items;
+    //Widen to avoid overflow when stepping past the end
+    for (long long i = start; step > 0? i < end : i > end; i += step)
+      items.push_back(intToStr((signed)i));
+
+    build(out[0], items);
+    return true;
+  }
+
+  bool list::sum(wstring* out, const wstring* in,
+                 Interpreter&, unsigned) {
+    vector<signed> values;
+    if (!parseIntegers(values, in[0], L"list-sum"))
+      return false;
+
+    //Arithmetic wraps the same way as num-add
+    unsigned total = 0;
+    for (unsigned i = 0; i < values.size(); ++i)
+      total += (unsigned)values[i];
+
+    out[0] = intToStr((signed)total);
+    return true;
+  }
+
+  /**
+   * Implements list-min and list-max.
+   */
+  template<bool Max>
+  static bool extremum(wstring* out, const wstring* in, const wchar_t* who) {
+    vector<signed> values;
+    if (!parseIntegers(values, in[0], who))
+      return false;
+
+    if (values.empty()) {
+      wcerr << L"tglng: error: " << who << L": empty list" << endl;
+      return false;
+    }
+
+    signed result = values[0];
+    for (unsigned i = 1; i < values.size(); ++i)
+      if (Max? values[i] > result : values[i] < result)
+        result = values[i];
+
+    out[0] = intToStr(result);
+    return true;
+  }
+
+  bool list::min(wstring* out, const wstring* in,
+                 Interpreter&, unsigned) {
+    return extremum<false>(out, in, L"list-min");
+  }
+
+  bool list::max(wstring* out, const wstring* in,
+                 Interpreter&, unsigned) {
+    return extremum<true>(out, in, L"list-max");
+  }
+
+  bool list::count(wstring* out, const wstring* in,
+                   Interpreter& interp, unsigned) {
+    Function fun;
+    if (!Function::get(fun, interp,
+                       in[0], 1, 1))
+      return false;
+
+    Items items(in[1]);
+    vector<wstring> results;
+    if (!applyBatch(results, fun, *items, interp))
+      return false;
+
+    signed n = 0;
+    for (unsigned i = 0; i < results.size(); ++i)
+      n += parseBool(results[i]);
+
+    out[0] = intToStr(n);
+    return true;
+  }
+
+  static GlobalBinding<TViewFunctionParser<2,1,list::car> >
   _listCar(L"list-car");
   static GlobalBinding<TFunctionParser<1,1,list::escape> >
   _listEscape(L"list-escape");
@@ -315,6 +920,8 @@ namespace tglng {
   _listAppend(L"list-append");
   static GlobalBinding<TFunctionParser<1,2,list::map> >
   _listMap(L"list-map");
+  static GlobalBinding<TFunctionParser<1,3,list::pmap> >
+  _listPmap(L"list-pmap");
   static GlobalBinding<TFunctionParser<1,3,list::fold> >
   _listFold(L"list-fold");
   static GlobalBinding<TFunctionParser<2,2,list::filter> >
@@ -329,6 +936,30 @@ namespace tglng {
   _listFlatten(L"list-flatten");
   static GlobalBinding<TFunctionParser<1,2,list::unzip> >
   _listUnzip(L"list-unzip");
+  static GlobalBinding<TFunctionParser<1,3,list::sort> >
+  _listSort(L"list-sort");
+  static GlobalBinding<TFunctionParser<1,2,list::unique> >
+  _listUnique(L"list-unique");
+  static GlobalBinding<TFunctionParser<2,2,list::groupBy> >
+  _listGroupBy(L"list-group-by");
+  static GlobalBinding<TFunctionParser<1,2,list::contains> >
+  _listContains(L"list-contains");
+  static GlobalBinding<TFunctionParser<1,2,list::setUnion> >
+  _listUnion(L"list-union");
+  static GlobalBinding<TFunctionParser<1,2,list::intersect> >
+  _listIntersect(L"list-intersect");
+  static GlobalBinding<TFunctionParser<1,2,list::difference> >
+  _listDifference(L"list-difference");
+  static GlobalBinding<TFunctionParser<1,3,list::range> >
+  _listRange(L"list-range");
+  static GlobalBinding<TFunctionParser<1,1,list::sum> >
+  _listSum(L"list-sum");
+  static GlobalBinding<TFunctionParser<1,1,list::min> >
+  _listMin(L"list-min");
+  static GlobalBinding<TFunctionParser<1,1,list::max> >
+  _listMax(L"list-max");
+  static GlobalBinding<TFunctionParser<1,2,list::count> >
+  _listCount(L"list-count");
 
   class ListAssign: public Command {
     wstring registers;
@@ -346,11 +977,12 @@ namespace tglng {
       if (!sub.exec(list, interp))
         return false;
 
-      for (unsigned i = 0; i < registers.size() &&
-             list::lcar(item, list, list, interp); ++i)
-        interp.registers[registers[i]] = item;
+      list::Scanner scanner(list);
+      interp.bindRegisters();
+      for (unsigned i = 0; i < registers.size() && scanner.next(item); ++i)
+        interp.writeRegister(registers[i]) = item;
 
-      dst = list;
+      scanner.remainder().assignTo(dst);
       return true;
     }
   };
@@ -389,12 +1021,13 @@ namespace tglng {
       if (!sub.exec(list, interp))
         return false;
 
-      tokeniser.reset(list);
+      Tokeniser tokeniser(this->tokeniser, interp, list);
 
-      dst.clear();
+      vector<wstring> items;
       while (tokeniser.next(item))
-        list::lappend(dst, item);
+        items.push_back(item);
 
+      list::build(dst, items);
       return !tokeniser.error();
     }
   };
@@ -408,11 +1041,11 @@ namespace tglng {
         options;
       unsigned initOff(0), nextOff(0);
       AutoSection sub;
-      bool prependPlus(false), prependMinus(false);
+      bool hasInit(false), prependPlus(false), prependMinus(false);
 
       ArgumentParser a(interp, text, offset, out);
       if (!a[a.h(),
-             -(a.x(L'%'), a.to(sinit, L'%') >> initOff),
+             -(a.x(hasInit, L'%'), a.to(sinit, L'%') >> initOff),
              -(a.x(L'#'), a.to(snext, L'#') >> nextOff),
              -((a.x(prependPlus, L'+') | a.x(prependMinus, L'-')),
                a.ns(options)),
@@ -422,9 +1055,17 @@ namespace tglng {
       if (!Function::get(init, interp, sinit, 2, 2,
                          text, initOff, &Function::compatible))
         return ParseError;
-      if (!Function::get(next, interp, snext, 2, 2,
-                         text, nextOff, &Function::matches))
+      if (!Function::get(next, interp, snext, 2, 3,
+                         text, nextOff, &Function::compatible))
         return ParseError;
+      if (!Tokeniser::isNext(next, true)) {
+        interp.error(wstring(L"Does not match (2 <- 2) or (2 <- 3): ") +
+                     snext, text, nextOff);
+        return ParseError;
+      }
+
+      if (!hasInit)
+        dataTokeniserPre(init, next);
 
       if      (prependPlus)  options.insert(0,1,L'+');
       else if (prependMinus) options.insert(0,1,L'-');
@@ -453,15 +1094,12 @@ namespace tglng {
     }
 
     virtual bool exec(wstring& dst, Interpreter& interp) {
-      dst.clear();
-
-      wstring elt;
-      for (unsigned i = 0; i < elts.size(); ++i) {
-        if (!interp.exec(elt, elts[i]))
+      vector<wstring> items(elts.size());
+      for (unsigned i = 0; i < elts.size(); ++i)
+        if (!interp.exec(items[i], elts[i]))
           return false;
-        list::lappend(dst, elt);
-      }
 
+      list::build(dst, items);
       return true;
     }
   };
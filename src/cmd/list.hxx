@@ -2,6 +2,9 @@
 #define CMD_LIST_HXX_
 
 #include <string>
+#include <vector>
+
+#include "../slice.hxx"
 
 namespace tglng {
   class Interpreter;
@@ -26,6 +29,84 @@ namespace tglng {
      */
     bool append(std::wstring*, const std::wstring*, Interpreter&, unsigned);
 
+    /**
+     * Walks over the items of a list in a single pass, keeping only an offset
+     * into the list text rather than copying the remainder for each item.
+     *
+     * The Scanner refers to the text of the list, which must outlive it and
+     * remain unmodified.
+     */
+    class Scanner {
+      Slice text;
+      unsigned offset;
+
+    public:
+      explicit Scanner(const Slice& text_) : text(text_), offset(0) {}
+
+      /**
+       * Extracts the next item into item. Returns false, leaving item
+       * unmodified, if the list has no more items.
+       */
+      bool next(std::wstring& item);
+
+      /**
+       * Returns the part of the list which has not been scanned yet.
+       */
+      Slice remainder() const { return text.sub(offset); }
+    };
+
+    /**
+     * Splits the given list into its items, appending them to dst.
+     *
+     * If the list was recently produced by build() or read through Items, its
+     * items are moved out of the list cache instead of tokenising the text
+     * again; the list is then no longer cached. Builtins which only need to
+     * read the items should use Items instead.
+     */
+    void split(std::vector<std::wstring>& dst, const Slice& list);
+
+    //An entry in the list cache; see list.cxx
+    struct CachedList;
+
+    /**
+     * Provides read-only access to the items of a list.
+     *
+     * If the list is in the list cache, the cached items are used in place,
+     * and the entry is not replaced for as long as this object exists.
+     * Otherwise, the list is tokenised, and the items are remembered in the
+     * cache if there is room. Either way, no item is copied.
+     *
+     * The object must be destroyed on the thread which created it.
+     */
+    class Items {
+      std::vector<std::wstring> own;
+      const std::vector<std::wstring>* items;
+      CachedList* pinned;
+
+      //Not defined
+      Items(const Items&);
+
+    public:
+      explicit Items(const Slice& list);
+      ~Items();
+
+      const std::vector<std::wstring>& operator*() const { return *items; }
+      unsigned size() const { return items->size(); }
+      const std::wstring& operator[](unsigned ix) const {
+        return (*items)[ix];
+      }
+    };
+
+    /**
+     * Serialises the given (unescaped) items into dst as a list, replacing
+     * its contents.
+     *
+     * The items are remembered alongside the resulting text in the list
+     * cache, so that a builtin consuming the list does not need to tokenise
+     * it again. items is left in an unspecified state.
+     */
+    void build(std::wstring& dst, std::vector<std::wstring>& items);
+
     /**
      * Returns the first item in the list, as well as the remainder.
      *
@@ -34,7 +115,7 @@ namespace tglng {
      *
      * (car cdr <- list)
      */
-    bool car(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+    bool car(std::wstring*, const Slice*, Interpreter&, unsigned);
 
     /**
      * Splits the given list into the first element and the tail. Returns
@@ -44,6 +125,12 @@ namespace tglng {
      */
     bool lcar(std::wstring& car, std::wstring& cdr,
               const std::wstring& list, Interpreter&);
+    /**
+     * Like lcar(), but reads the list through a Slice. The Slice may refer to
+     * car or cdr.
+     */
+    bool lcar(std::wstring& car, std::wstring& cdr,
+              const Slice& list, Interpreter&);
 
     /**
      * Returns the length of the given list.
@@ -72,6 +159,16 @@ namespace tglng {
      */
     bool map(std::wstring*, const std::wstring*, Interpreter&, unsigned);
 
+    /**
+     * Like map(), but evaluates the items in parallel on up to the given
+     * number of threads (default: one per processor). Each thread runs in
+     * its own clone of the Interpreter, with a copy of the caller's
+     * registers.
+     *
+     * (list <- (output <- input) list [threads])
+     */
+    bool pmap(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
     /**
      * Applies the given function to each item in the list with an
      * accumulator.
@@ -114,6 +211,103 @@ namespace tglng {
      * (list-of-lists <- list [stride=2])
      */
     bool unzip(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Sorts the given list stably. Items are ordered by the results of key
+     * (or themselves if key is empty), which are compared with less (or
+     * lexicographically if less is empty).
+     *
+     * (list <- list [key:(key <- item)] [less:(less? <- a b)])
+     */
+    bool sort(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Removes all but the first of each item in the list whose key (or the
+     * item itself if key is empty) equals that of an earlier item.
+     *
+     * (list <- list [key:(key <- item)])
+     */
+    bool unique(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Partitions the items in the list into groups of items with equal
+     * keys. The groups, as well as the items within each group, retain the
+     * order in which they first occur in the input.
+     *
+     * (list-of-lists keys <- list fun:(key <- item))
+     */
+    bool groupBy(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Returns whether the given list contains the given item.
+     *
+     * (has <- list item)
+     */
+    bool contains(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Returns every distinct item in either list, in order of first
+     * occurrence.
+     *
+     * (list <- list list)
+     */
+    bool setUnion(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Returns every distinct item of the first list which also occurs in the
+     * second, in order of first occurrence.
+     *
+     * (list <- list list)
+     */
+    bool intersect(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Returns every distinct item of the first list which does not occur in
+     * the second, in order of first occurrence.
+     *
+     * (list <- list list)
+     */
+    bool difference(std::wstring*, const std::wstring*,
+                    Interpreter&, unsigned);
+
+    /**
+     * Returns the integers from start (inclusive) to end (exclusive) in
+     * increments of step (default 1). If end is empty, the range is from 0
+     * to start instead.
+     *
+     * (list <- start [end] [step])
+     */
+    bool range(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Returns the sum of the integers in the given list.
+     *
+     * (sum <- list)
+     */
+    bool sum(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Returns the least integer in the given list, which must be non-empty.
+     *
+     * (min <- list)
+     */
+    bool min(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Returns the greatest integer in the given list, which must be
+     * non-empty.
+     *
+     * (max <- list)
+     */
+    bool max(std::wstring*, const std::wstring*, Interpreter&, unsigned);
+
+    /**
+     * Counts the items in the list for which the given function returns
+     * true.
+     *
+     * (count <- (accept? <- input) list)
+     */
+    bool count(std::wstring*, const std::wstring*, Interpreter&, unsigned);
   }
 }
 
@@ -8,6 +8,8 @@
 #include "../interp.hxx"
 #include "../command.hxx"
 #include "../argument.hxx"
+#include "../function.hxx"
+#include "../slice.hxx"
 #include "basic_parsers.hxx"
 
 using namespace std;
@@ -151,9 +153,17 @@ namespace tglng {
       wstring in;
       if (!interp.exec(in, sub.get())) return false;
 
+      convert(dst, in);
+      return true;
+    }
+
+    /**
+     * Converts the string in into dst.
+     */
+    static void convert(wstring& dst, const Slice& in) {
       //Determine hints
       unsigned hint = 0;
-      for (unsigned i = 0; i < in.size(); ++i) {
+      for (unsigned i = 0; i < in.size; ++i) {
         if (iswlower(in[i])) hint |= HINT_LC;
         if (iswupper(in[i])) hint |= HINT_UC;
         if (isseparator(in[i])) hint |= HINT_SEP;
@@ -163,83 +173,95 @@ namespace tglng {
 
       //Convert
       dst.clear();
+      dst.reserve(in.size);
       Converter conv;
       conv.f = InitF;
       wstring ch;
-      for (unsigned i = 0; i < in.size(); ++i) {
+      for (unsigned i = 0; i < in.size; ++i) {
         ch.assign(1, in[i]);
         conv.f(ch, hint, conv);
         dst += ch;
       }
+    }
 
-      //OK
+    /**
+     * Native (1 <- 1) batch implementation, used when the converter is
+     * invoked as a Function.
+     */
+    static bool batch(wstring* out, const Slice* in, unsigned count,
+                      Interpreter&, unsigned) {
+      for (unsigned i = 0; i < count; ++i)
+        convert(out[i], in[i]);
+      return true;
+    }
+  };
+
+  /**
+   * Parses a magic case converter as a UnaryCommand, but provides the
+   * converter's native implementation when used as a Function.
+   */
+  template<Converter::f_t InitF>
+  class MagicCaseParser:
+  public UnaryCommandParser<MagicCaseConverter<InitF> > {
+  public:
+    virtual bool function(Function& fun) const {
+      fun = batchFunction<1,1,&MagicCaseConverter<InitF>::batch>();
       return true;
     }
   };
 
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        simpleConverter<
-          towlower> > > > _strtolower(L"str-tolower");
+    MagicCaseParser<
+      simpleConverter<
+        towlower> > > _strtolower(L"str-tolower");
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        simpleConverter<
-          towupper> > > > _strtoupper(L"str-toupper");
+    MagicCaseParser<
+      simpleConverter<
+        towupper> > > _strtoupper(L"str-toupper");
 
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        delimitedConverter<L' ', false,
-                           towupper, towupper, towlower>::f> > >
+    MagicCaseParser<
+      delimitedConverter<L' ', false,
+                         towupper, towupper, towlower>::f> >
   _strtotitle(L"str-totitle");
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        delimitedConverter<L' ', false,
-                           towupper, towlower, towlower>::f> > >
+    MagicCaseParser<
+      delimitedConverter<L' ', false,
+                         towupper, towlower, towlower>::f> >
   _strtosent(L"str-tosent");
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        delimitedConverter<0, true,
-                           towlower, towupper, towlower>::f> > >
+    MagicCaseParser<
+      delimitedConverter<0, true,
+                         towlower, towupper, towlower>::f> >
   _strtocamel(L"str-tocamel");
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        delimitedConverter<0, true,
-                           towupper, towupper, towlower>::f> > >
+    MagicCaseParser<
+      delimitedConverter<0, true,
+                         towupper, towupper, towlower>::f> >
   _strtopascal(L"str-topascal");
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        delimitedConverter<L'_', true,
-                           towupper, towupper, towupper>::f> > >
+    MagicCaseParser<
+      delimitedConverter<L'_', true,
+                         towupper, towupper, towupper>::f> >
   _strtoscream(L"str-toscream");
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        delimitedConverter<L'_', true,
-                           towlower, towlower, towlower>::f> > >
+    MagicCaseParser<
+      delimitedConverter<L'_', true,
+                         towlower, towlower, towlower>::f> >
   _strtocstyle(L"str-tocstyle");
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        delimitedConverter<L'_', true,
-                           towupper, towupper, towlower>::f> > >
+    MagicCaseParser<
+      delimitedConverter<L'_', true,
+                         towupper, towupper, towlower>::f> >
   _strtocaspal(L"str-tocaspal");
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        delimitedConverter<L'-', true,
-                           towlower, towlower, towlower>::f> > >
+    MagicCaseParser<
+      delimitedConverter<L'-', true,
+                         towlower, towlower, towlower>::f> >
   _strtolisp(L"str-tolisp");
   static GlobalBinding<
-    UnaryCommandParser<
-      MagicCaseConverter<
-        delimitedConverter<L'-', true,
-                           towupper, towupper, towupper>::f> > >
+    MagicCaseParser<
+      delimitedConverter<L'-', true,
+                         towupper, towupper, towupper>::f> >
   _strtocobol(L"str-tocobol");
 }
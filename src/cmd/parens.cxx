@@ -7,6 +7,7 @@
 #include "../command.hxx"
 #include "../interp.hxx"
 #include "../argument.hxx"
+#include "../common.hxx"
 
 using namespace std;
 
@@ -26,11 +27,11 @@ namespace tglng {
       wstring tmp;
       if (section.left) {
         if (!interp.exec(tmp, section.left)) return false;
-        out += tmp;
+        appendMove(out, tmp);
       }
       if (section.right) {
         if (!interp.exec(tmp, section.right)) return false;
-        out += tmp;
+        appendMove(out, tmp);
       }
       return true;
     }
@@ -14,6 +14,7 @@
 #include "../regex.hxx"
 #include "list.hxx"
 #include "../common.hxx"
+#include "../thread.hxx"
 
 using namespace std;
 
@@ -26,14 +27,22 @@ namespace tglng {
   static GlobalBinding<TFunctionParser<1,0,rxSupport> >
   _rxSupport(L"rx-support");
 
-  bool rxMatch(wstring* out, const wstring* in,
+  bool rxJit(wstring* out, const wstring*, Interpreter&, unsigned) {
+    *out = regexJit()? L"1" : L"0";
+    return true;
+  }
+
+  static GlobalBinding<TFunctionParser<1,0,rxJit> > _rxJit(L"rx-jit");
+
+  bool rxMatch(wstring* out, const Slice* in,
                Interpreter& interp, unsigned) {
-    Regex rx(in[0], in[2]);
+    CachedRegex crx(in[0].str(), in[2].str());
+    Regex& rx(*crx);
     if (!rx) {
       wcerr << "tglng: error: compiling ";
       rx.showWhy();
       interp.error(L"Regular expression error here (maybe).",
-                   in[1], rx.where());
+                   in[0].str(), rx.where());
       return false;
     }
 
@@ -68,27 +77,130 @@ namespace tglng {
     return true;
   }
 
-  static GlobalBinding<TFunctionParser<4,3,rxMatch> >
+  static GlobalBinding<TViewFunctionParser<4,3,rxMatch> >
   _rxMatch(L"rx-match");
 
+  /**
+   * Provides the Regex an inline regex command should use for one execution.
+   *
+   * A Regex holds the state of the match in progress, so the one compiled at
+   * parse time can only be used by one execution at a time. Recursive or
+   * concurrent (see list-pmap) executions use a CachedRegex instead.
+   */
+  class InlineRegex {
+    TryMutexLock lock;
+    auto_ptr<CachedRegex> local;
+    Regex* rx;
+
+  public:
+    InlineRegex(Regex& shared, Mutex& busy,
+                const wstring& pattern, const wstring& options)
+    : lock(busy), rx(&shared)
+    {
+      if (!lock.acquired()) {
+        local.reset(new CachedRegex(pattern, options));
+        rx = &**local;
+      }
+    }
+
+    Regex* operator->() const { return rx; }
+    Regex& operator*() const { return *rx; }
+  };
+
+  /**
+   * Supplies registers 0 through 9 (the groups), < (the head) and > (the
+   * tail) for the last match of an inline regex command, without copying
+   * anything out of the input until a register is actually read. The
+   * registers are bound for real when this object is destroyed, or earlier if
+   * something needs the registers as a whole.
+   *
+   * The Regex must not be given new input while this exists.
+   */
+  class MatchRegisters: public Interpreter::LazyRegisters {
+    Interpreter& interp;
+    const Regex& rx;
+    unsigned groupBegin[10], groupEnd[10];
+    bool groupMatched[10];
+    unsigned headBegin, headEnd, tailBegin;
+
+  public:
+    MatchRegisters(Interpreter& interp_, const Regex& rx_)
+    : interp(interp_), rx(rx_)
+    { }
+
+    virtual ~MatchRegisters() {
+      if (interp.lazyRegisters == this)
+        interp.bindRegisters();
+    }
+
+    /**
+     * Makes the registers reflect the last successful match of the Regex.
+     */
+    void update() {
+      unsigned numGroups = rx.groupCount();
+      for (unsigned i = 0; i < 10; ++i)
+        groupMatched[i] = i < numGroups &&
+          rx.groupSpan(groupBegin[i], groupEnd[i], i);
+      rx.headSpan(headBegin, headEnd);
+      tailBegin = rx.tailOffset();
+
+      if (interp.lazyRegisters != this) {
+        interp.bindRegisters();
+        interp.lazyRegisters = this;
+      }
+    }
+
+    virtual bool get(wstring& dst, wchar_t reg) const {
+      if (reg >= L'0' && reg <= L'9') {
+        unsigned i = reg - L'0';
+        if (groupMatched[i])
+          dst.assign(rx.subject(), groupBegin[i], groupEnd[i] - groupBegin[i]);
+        else
+          dst.clear();
+      } else if (reg == L'<') {
+        dst.assign(rx.subject(), headBegin, headEnd - headBegin);
+      } else if (reg == L'>') {
+        dst.assign(rx.subject(), tailBegin, wstring::npos);
+      } else {
+        return false;
+      }
+
+      return true;
+    }
+
+    virtual void bind(Interpreter& interp) const {
+      static const wchar_t names[] = L"0123456789<>";
+      wstring value;
+      for (unsigned i = 0; names[i]; ++i) {
+        get(value, names[i]);
+        interp.writeRegister(names[i]).take(value);
+      }
+    }
+  };
+
   class RegexMatchInline: public Command {
-    auto_ptr<Regex> rx;
+    auto_ptr<Regex> compiled;
+    Mutex busy;
+    wstring pattern, options;
     auto_ptr<Command> sub;
 
   public:
     RegexMatchInline(Command* left,
                      auto_ptr<Regex>& rx_,
+                     const wstring& pattern_,
+                     const wstring& options_,
                      auto_ptr<Command>& sub_)
-    : Command(left), rx(rx_), sub(sub_)
+    : Command(left), compiled(rx_),
+      pattern(pattern_), options(options_), sub(sub_)
     { }
 
     virtual bool exec(wstring& dst, Interpreter& interp) {
-      if (!*rx) return false; //Can't do anything with a broken regex
-
       wstring str;
       if (!interp.exec(str, sub.get()))
         return false;
 
+      InlineRegex rx(*compiled, busy, pattern, options);
+
       rx->input(str);
       if (!rx->match()) {
         if (!*rx) {
@@ -102,16 +214,10 @@ namespace tglng {
         return true;
       }
 
-      //Match successful
+      //Match successful; the registers are bound on return
       dst = L"1";
-      unsigned numGroups = rx->groupCount();
-      for (unsigned i = 0; i < 10; ++i)
-        if (i < numGroups)
-          rx->group(interp.registers[i + L'0'], i);
-        else
-          interp.registers[i + L'0'] = L"";
-      rx->head(interp.registers[L'<']);
-      rx->tail(interp.registers[L'>']);
+      MatchRegisters registers(interp, *rx);
+      registers.update();
       return true;
     }
   };
@@ -143,7 +249,8 @@ namespace tglng {
         return ParseError;
       }
 
-      out = new RegexMatchInline(out, rx, sub);
+      rx->optimise();
+      out = new RegexMatchInline(out, rx, pattern, options, sub);
       return ContinueParsing;
     }
   };
@@ -160,7 +267,8 @@ namespace tglng {
       return false;
     }
 
-    Regex rx(in[0], in[4]);
+    CachedRegex crx(in[0], in[4]);
+    Regex& rx(*crx);
     if (!rx) {
       wcerr << L"tglng: error: compiling ";
       rx.showWhy();
@@ -170,13 +278,12 @@ namespace tglng {
     }
 
     rx.input(in[2]);
-    wstring tail(in[2]);
+    const wstring& subject(rx.subject());
+    unsigned headBegin, headEnd;
     while (limit-- && rx.match()) {
-      wstring head;
-      rx.head(head);
-      *out += head;
+      rx.headSpan(headBegin, headEnd);
+      out->append(subject, headBegin, headEnd - headBegin);
       *out += in[1];
-      rx.tail(tail);
     }
 
     if (!rx) {
@@ -185,7 +292,7 @@ namespace tglng {
       return false;
     }
 
-    *out += tail;
+    out->append(subject, rx.tailOffset(), wstring::npos);
     return true;
   }
 
@@ -204,7 +311,8 @@ namespace tglng {
     if (!Function::get(fun, interp, in[1], 1, 2))
       return false;
 
-    Regex rx(in[0], in[4]);
+    CachedRegex crx(in[0], in[4]);
+    Regex& rx(*crx);
     if (!rx) {
       wcerr << L"tglng: error: compiling ";
       rx.showWhy();
@@ -215,7 +323,8 @@ namespace tglng {
 
     out->clear();
     rx.input(in[2]);
-    wstring tail(in[2]);
+    const wstring& subject(rx.subject());
+    unsigned headBegin, headEnd;
     while (limit-- && rx.match()) {
       wstring parms[2], replacement;
       rx.group(parms[0], 0);
@@ -229,11 +338,9 @@ namespace tglng {
       if (!fun.exec(&replacement, parms, interp, fun.parm))
         return false;
 
-      wstring head;
-      rx.head(head);
-      *out += head;
+      rx.headSpan(headBegin, headEnd);
+      out->append(subject, headBegin, headEnd - headBegin);
       *out += replacement;
-      rx.tail(tail);
     }
 
     //Check for error
@@ -243,7 +350,7 @@ namespace tglng {
       return false;
     }
 
-    *out += tail;
+    out->append(subject, rx.tailOffset(), wstring::npos);
     return true;
   }
 
@@ -251,18 +358,23 @@ namespace tglng {
   _rxReplaceEach(L"rx-repl-each");
 
   class RxReplaceInline: public Command {
-    auto_ptr<Regex> rx;
+    auto_ptr<Regex> compiled;
+    Mutex busy;
+    wstring pattern, options;
     auto_ptr<Command> limit;
     AutoSection str, replacement;
 
   public:
     RxReplaceInline(Command* left,
                     auto_ptr<Regex>& rx_,
+                    const wstring& pattern_,
+                    const wstring& options_,
                     auto_ptr<Command>& limit_,
                     const Section& str_,
                     const Section& replacement_)
     : Command(left),
-      rx(rx_),
+      compiled(rx_),
+      pattern(pattern_), options(options_),
       limit(limit_),
       str(str_),
       replacement(replacement_)
@@ -285,30 +397,22 @@ namespace tglng {
       if (!this->str.exec(str, interp))
         return false;
 
+      InlineRegex rx(*compiled, busy, pattern, options);
       rx->input(str);
-      wstring tail(str);
+      MatchRegisters registers(interp, *rx);
+      const wstring& subject(rx->subject());
+      unsigned headBegin, headEnd;
       dst.clear();
       while (limit-- && rx->match()) {
-        //Bind registers
-        unsigned ngroups = rx->groupCount();
-        for (unsigned i = 0; i < 10; ++i)
-          if (i < ngroups)
-            rx->group(interp.registers[L'0' + i], i);
-          else
-            interp.registers[L'0' + i].clear();
-
-        wstring head;
-        rx->head(head);
-        rx->tail(tail);
-        interp.registers[L'<'] = head;
-        interp.registers[L'>'] = tail;
+        registers.update();
+        rx->headSpan(headBegin, headEnd);
 
         //Run the section to get the replacement
         wstring replacement;
         if (!this->replacement.exec(replacement, interp))
           return false;
 
-        dst += head;
+        dst.append(subject, headBegin, headEnd - headBegin);
         dst += replacement;
       }
 
@@ -319,7 +423,7 @@ namespace tglng {
         return false;
       }
 
-      dst += tail;
+      dst.append(subject, rx->tailOffset(), wstring::npos);
       return true;
     }
   };
@@ -351,7 +455,9 @@ namespace tglng {
         return ParseError;
       }
 
-      out = new RxReplaceInline(out, rx, limit, str, replacement);
+      rx->optimise();
+      out = new RxReplaceInline(out, rx, pattern, options,
+                                limit, str, replacement);
       str.clear();
       replacement.clear();
       return ContinueParsing;
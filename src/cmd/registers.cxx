@@ -21,15 +21,16 @@ namespace tglng {
   { }
 
   bool ReadRegister::exec(wstring& dst, Interpreter& interp) {
-    map<wchar_t,wstring>::const_iterator it = interp.registers.find(reg);
-    if (it == interp.registers.end()) {
-      wcerr << L"tgl: error: Attempt to read from unset register: "
-            << reg << endl;
-      return false;
-    }
+    if (interp.readRegister(dst, reg))
+      return true;
 
-    dst = it->second;
-    return true;
+    wcerr << L"tgl: error: Attempt to read from unset register: "
+          << reg << endl;
+    return false;
+  }
+
+  bool ReadRegister::view(Slice& dst, Interpreter& interp) const {
+    return !left && interp.viewRegister(dst, reg);
   }
 
   class WriteRegister: public Command {
@@ -45,7 +46,8 @@ namespace tglng {
       wstring res;
       if (!interp.exec(res, sub.get())) return false;
 
-      interp.registers[reg] = res;
+      interp.bindRegister(reg);
+      interp.writeRegister(reg).take(res);
       dst = L"";
       return true;
     }
@@ -60,7 +62,8 @@ namespace tglng {
     { }
 
     virtual bool exec(wstring& dst, Interpreter& interp) {
-      interp.registers.erase(reg);
+      interp.bindRegister(reg);
+      interp.unsetRegister(reg);
       dst = L"";
       return true;
     }
@@ -96,7 +99,8 @@ namespace tglng {
 
   bool resetRegisters(wstring* out, const wstring* in,
                       Interpreter& interp, unsigned parm) {
-    interp.registers = initialRegisters;
+    interp.bindRegisters();
+    interp.setRegisters(initialRegisters);
     *out = L"";
     return true;
   }
@@ -4,6 +4,7 @@
 #include <string>
 
 #include "../command.hxx"
+#include "../slice.hxx"
 
 namespace tglng {
   /**
@@ -15,6 +16,14 @@ namespace tglng {
   public:
     ReadRegister(Command*, wchar_t);
     virtual bool exec(std::wstring&, Interpreter&);
+
+    /**
+     * If this command reads only the register (ie, it has nothing to its
+     * left), and the register can be viewed without copying it (see
+     * Interpreter::viewRegister()), sets dst to refer to its value and returns
+     * true. Otherwise, returns false; exec() must then be used instead.
+     */
+    bool view(Slice& dst, Interpreter& interp) const;
   };
 }
 
@@ -12,6 +12,7 @@
 #include "../argument.hxx"
 #include "../common.hxx"
 #include "basic_parsers.hxx"
+#include "registers.hxx"
 
 using namespace std;
 
@@ -109,18 +110,28 @@ namespace tglng {
     { }
 
     virtual bool exec(wstring& out, Interpreter& interp) {
-      wstring sb, se, str, strr;
+      wstring sb, se, owned, strr;
       signed ib, ie;
 
       //Get the parms
-      if ((string.left && !interp.exec(str, string.left)) ||
+      if ((string.left && !interp.exec(owned, string.left)) ||
           !interp.exec(sb, begin.get()) ||
-          (end.get() && !interp.exec(se, end.get())) ||
-          (string.right && !interp.exec(strr, string.right)))
+          (end.get() && !interp.exec(se, end.get())))
         return false;
 
-      //Concat section parts
-      str += strr;
+      //A lone register (as in "str-ix $o $t") is read in place if possible,
+      //since usually only a small part of it is wanted
+      Slice str;
+      ReadRegister* reg = string.left? NULL :
+        dynamic_cast<ReadRegister*>(string.right);
+      if (!reg || !reg->view(str, interp)) {
+        if (string.right && !interp.exec(strr, string.right))
+          return false;
+
+        //Concat section parts
+        owned += strr;
+        str = Slice(owned);
+      }
 
       //Convert integers
       if (!parseInteger(ib, sb)) {
@@ -136,24 +147,24 @@ namespace tglng {
       }
 
       //Negative indices are relative to the end (plus one for end)
-      if (ib < 0) ib += str.size();
+      if (ib < 0) ib += str.size;
       if (se.empty())
         //Implicitly one character
         ie = ib+1;
       else if (treatEndAsLength)
         ie = ie+ib;
       else if (ie < 0)
-        ie += str.size()+1;
+        ie += str.size+1;
 
       //Clamp indices
       if (ib < 0) ib = 0;
-      if (ib > (signed)str.size()) ib = str.size();
+      if (ib > (signed)str.size) ib = str.size;
       if (ie < ib) ie = ib;
-      if (ie > (signed)str.size()) ie = str.size();
+      if (ie > (signed)str.size) ie = str.size;
 
       //OK
-      if (ib < (signed)str.size())
-        out = str.substr(ib, ie-ib);
+      if (ib < (signed)str.size)
+        str.sub(ib, ie-ib).assignTo(out);
       else
         out.clear();
       return true;
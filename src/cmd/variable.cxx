@@ -4,6 +4,8 @@
 
 #include <string>
 #include <memory>
+#include <map>
+#include <utility>
 
 #include "../interp.hxx"
 #include "../command.hxx"
@@ -54,8 +56,20 @@ namespace tglng {
         delete value;
     }
 
-    wstring& get() {
-      return value->value;
+    /**
+     * Returns the value of this variable as seen by the given Interpreter.
+     * Workers keep their own values, so that parallel invocations of the
+     * same code do not share the variable.
+     */
+    wstring& get(Interpreter& interp) {
+      if (!interp.isWorker)
+        return value->value;
+
+      map<const void*,wstring>::iterator it = interp.variables.find(value);
+      if (it == interp.variables.end())
+        it = interp.variables.insert(
+          make_pair((const void*)value, value->value)).first;
+      return it->second;
     }
   };
 
@@ -77,7 +91,7 @@ namespace tglng {
       dst.clear();
       wstring val;
       if (interp.exec(val, value.get())) {
-        var.get() = val;
+        var.get(interp) = val;
         return true;
       } else return false;
     }
@@ -95,12 +109,12 @@ namespace tglng {
     { }
 
     virtual bool exec(wstring& dst, Interpreter& interp) {
-      wstring old(var.get());
+      wstring old(var.get(interp));
       if (!VariableSet::exec(dst, interp))
         return false;
 
       bool result = interp.exec(dst, body.get());
-      var.get() = old;
+      var.get(interp) = old;
       return result;
     }
   };
@@ -113,7 +127,7 @@ namespace tglng {
     : Command(left), var(var_) {}
 
     virtual bool exec(wstring& dst, Interpreter& interp) {
-      dst = var.get();
+      dst = var.get(interp);
       return true;
     }
   };
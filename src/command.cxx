@@ -6,7 +6,7 @@
 
 namespace tglng {
   Command::Command(Command* left_)
-  : left(left_)
+  : left(left_), sourceOffset(0)
   { }
 
   Command::~Command() {
@@ -74,6 +74,12 @@ namespace tglng {
      */
     Command*const left;
 
+    /**
+     * The offset within the text this Command was parsed from of its command
+     * character. Set by Interpreter::parse().
+     */
+    unsigned sourceOffset;
+
   protected:
     /**
      * Constructs the Command with the given left-hand tree.
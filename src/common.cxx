@@ -174,6 +174,47 @@ namespace tglng {
     return true;
   }
 
+  void CompactString::assign(const Slice& src) {
+    unsigned i;
+    for (i = 0; i < src.size && (unsigned)src[i] <= 0xFF; ++i);
+
+    if (i == src.size) {
+      isWide = false;
+      wide.clear();
+      narrow.resize(src.size);
+      for (i = 0; i < src.size; ++i)
+        narrow[i] = (char)src[i];
+    } else {
+      isWide = true;
+      narrow.clear();
+      src.assignTo(wide);
+    }
+  }
+
+  void CompactString::take(wstring& src) {
+    unsigned i;
+    for (i = 0; i < src.size() && (unsigned)src[i] <= 0xFF; ++i);
+
+    if (i == src.size()) {
+      assign(src);
+    } else {
+      isWide = true;
+      narrow.clear();
+      wide.swap(src);
+    }
+  }
+
+  void CompactString::appendTo(wstring& dst) const {
+    if (isWide) {
+      dst += wide;
+    } else {
+      unsigned base = dst.size();
+      dst.resize(base + narrow.size());
+      for (unsigned i = 0; i < narrow.size(); ++i)
+        dst[base+i] = (unsigned char)narrow[i];
+    }
+  }
+
   bool strtowstr(wstring& dst, const string& src) {
     return ntbstowstr(dst, src.data(), src.data() + src.size());
   }
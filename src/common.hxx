@@ -3,12 +3,16 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
+
+#include "slice.hxx"
 
 //Exit codes (other than EXIT_SUCCESS)
 #define EXIT_PARSE_ERROR_IN_USER_LIBRARY 1
 #define EXIT_PARSE_ERROR_IN_INPUT 2
 #define EXIT_EXEC_ERROR_IN_USER_LIBRARY 3
 #define EXIT_EXEC_ERROR_IN_INPUT 4
+#define EXIT_RESOURCE_LIMIT 5
 #define EXIT_PLATFORM_ERROR 71
 #define EXIT_IO_ERROR 74
 #define EXIT_INCORRECT_USAGE 64
@@ -81,6 +85,110 @@ namespace tglng {
    * Returns whether conversion succeeded.
    */
   bool strtowstr(std::wstring&, const std::string&);
+
+  /**
+   * Appends src to dst, leaving the contents of src unspecified.
+   *
+   * If dst is empty, it takes over the storage of src instead of copying it.
+   * Results are passed up through every level of nesting this way, so this
+   * avoids copying the same text again at each level in the common case
+   * where a level contributes only one piece.
+   */
+  inline void appendMove(std::wstring& dst, std::wstring& src) {
+    if (dst.empty())
+      dst.swap(src);
+    else
+      dst += src;
+  }
+
+  /**
+   * Empties the given container and frees its storage, which clearing it or
+   * assigning an empty value would keep.
+   */
+  template<typename T>
+  inline void releaseStorage(T& container) {
+    T().swap(container);
+  }
+
+  /**
+   * Holds a string in as little memory as its contents permit.
+   *
+   * If every character is within Latin-1 (which is nearly always the case),
+   * one byte is stored per character; otherwise, the string is stored as
+   * wide characters. The representation is chosen anew on every assignment.
+   *
+   * This is used for long-lived values, such as registers, which are copied
+   * wholesale far more often than they are read.
+   */
+  class CompactString {
+    std::string narrow;
+    std::wstring wide;
+    bool isWide;
+
+  public:
+    CompactString() : isWide(false) {}
+    CompactString(const std::wstring& str) : isWide(false) { assign(str); }
+
+    CompactString& operator=(const std::wstring& str) {
+      assign(str);
+      return *this;
+    }
+
+    /**
+     * Replaces the contents of this string with those of the given Slice.
+     */
+    void assign(const Slice&);
+    /**
+     * Replaces the contents of this string with those of src. The contents
+     * of src are unspecified on return, which allows wide strings to be
+     * stored without copying.
+     */
+    void take(std::wstring& src);
+
+    /**
+     * Returns the number of characters in this string.
+     */
+    unsigned size() const { return isWide? wide.size() : narrow.size(); }
+    bool empty() const { return !size(); }
+    /**
+     * Returns the number of bytes used to store the characters of this string.
+     */
+    unsigned long bytes() const {
+      return isWide? wide.size() * sizeof(wchar_t) : narrow.size();
+    }
+
+    void clear() {
+      narrow.clear();
+      wide.clear();
+      isWide = false;
+    }
+
+    /**
+     * Replaces the contents of dst with this string.
+     */
+    void get(std::wstring& dst) const {
+      dst.clear();
+      appendTo(dst);
+    }
+    /**
+     * Appends this string to dst.
+     */
+    void appendTo(std::wstring& dst) const;
+    /**
+     * Returns this string as a wstring.
+     */
+    std::wstring str() const {
+      std::wstring ret;
+      appendTo(ret);
+      return ret;
+    }
+
+    void swap(CompactString& that) {
+      narrow.swap(that.narrow);
+      wide.swap(that.wide);
+      std::swap(isWide, that.isWide);
+    }
+  };
 }
 
 #endif /* COMMON_HXX_ */
@@ -65,10 +65,41 @@ namespace tglng {
     return true;
   }
 
+  bool Function::call(wstring* out, const Slice* in,
+                      Interpreter& interp) const {
+    if (execView)
+      return execView(out, in, interp, parm);
+
+    if (inputArity <= FUNCTION_STACK_FRAME_SIZE) {
+      wstring owned[FUNCTION_STACK_FRAME_SIZE];
+      for (unsigned i = 0; i < inputArity; ++i)
+        in[i].assignTo(owned[i]);
+      return exec(out, owned, interp, parm);
+    } else {
+      vector<wstring> owned(inputArity);
+      for (unsigned i = 0; i < inputArity; ++i)
+        in[i].assignTo(owned[i]);
+      return exec(out, &owned[0], interp, parm);
+    }
+  }
+
+  bool Function::callBatch(wstring* out, const Slice* in, unsigned count,
+                           unsigned outputStride, unsigned inputStride,
+                           Interpreter& interp) const {
+    if (execBatch && outputStride == outputArity && inputStride == inputArity)
+      return execBatch(out, in, count, interp, parm);
+
+    for (unsigned i = 0; i < count; ++i)
+      if (!call(out + i*outputStride, in + i*inputStride, interp))
+        return false;
+
+    return true;
+  }
+
   FunctionInvocation::FunctionInvocation(Command* left,
                                          Function fun,
                                          const wstring& outregs_,
-                                         const vector<Command*> args)
+                                         const vector<Command*>& args)
   : Command(left),
     function(fun),
     outregs(outregs_),
@@ -81,24 +112,53 @@ namespace tglng {
   }
 
   bool FunctionInvocation::exec(wstring& dst, Interpreter& interp) {
-    vector<wstring> out(function.outputArity);
-    vector<wstring> in (function.inputArity );
+    if (function.outputArity <= FUNCTION_STACK_FRAME_SIZE &&
+        function.inputArity  <= FUNCTION_STACK_FRAME_SIZE) {
+      wstring out[FUNCTION_STACK_FRAME_SIZE], in[FUNCTION_STACK_FRAME_SIZE];
+      return invoke(dst, interp, out, in);
+    } else {
+      //Always allocate at least one so that &x[0] is valid
+      vector<wstring> out(function.outputArity + 1);
+      vector<wstring> in (function.inputArity  + 1);
+      return invoke(dst, interp, &out[0], &in[0]);
+    }
+  }
+
+  bool FunctionInvocation::invoke(wstring& dst, Interpreter& interp,
+                                  wstring* out, wstring* in) {
     wstring discard;
     //Evaluate the arguments
     for (unsigned i = 0; i < arguments.size(); ++i)
-      if (!interp.exec(i < in.size()? in[i] : discard, arguments[i]))
+      if (!interp.exec(i < function.inputArity? in[i] : discard,
+                       arguments[i]))
         return false;
 
-    //Call the function
-    if (!function.exec(&out[0], &in[0], interp, function.parm))
-      return false;
+    //Call the function, directly on the Slice implementation if there is one
+    if (function.execView) {
+      if (function.inputArity <= FUNCTION_STACK_FRAME_SIZE) {
+        Slice slices[FUNCTION_STACK_FRAME_SIZE];
+        for (unsigned i = 0; i < function.inputArity; ++i)
+          slices[i] = Slice(in[i]);
+        if (!function.execView(out, slices, interp, function.parm))
+          return false;
+      } else {
+        vector<Slice> slices(in, in + function.inputArity);
+        if (!function.execView(out, &slices[0], interp, function.parm))
+          return false;
+      }
+    } else {
+      if (!function.exec(out, in, interp, function.parm))
+        return false;
+    }
 
     //Set outregs
-    for (unsigned i = 1; i < out.size() && i-1 < outregs.size(); ++i)
-      interp.registers[outregs[i-1]] = out[i];
+    for (unsigned i = 1; i < function.outputArity && i-1 < outregs.size(); ++i) {
+      interp.bindRegister(outregs[i-1]);
+      interp.writeRegister(outregs[i-1]).take(out[i]);
+    }
 
     //Result in primary output
-    dst = out[0];
+    dst.swap(out[0]);
     return true;
   }
 
@@ -110,6 +170,12 @@ namespace tglng {
     return true;
   }
 
+  FunctionInvocation* FunctionParser::invocation(
+    Command* left, const wstring& outregs, const vector<Command*>& args
+  ) const {
+    return new FunctionInvocation(left, fun, outregs, args);
+  }
+
   ParseResult FunctionParser::parse(Interpreter& interp,
                                     Command*& out,
                                     const wstring& text,
@@ -133,8 +199,7 @@ namespace tglng {
     }
 
     //OK
-    out = new FunctionInvocation(out, fun,
-                                 outregs, arguments);
+    out = invocation(out, outregs, arguments);
     //The FunctionInvocation now has control of the contents of arguments, so
     //don't free them.
     return ContinueParsing;
@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "command.hxx"
+#include "slice.hxx"
 
 namespace tglng {
   class Interpreter;
@@ -47,6 +48,42 @@ namespace tglng {
     typedef bool (*exec_t)(std::wstring* out, const std::wstring* in,
                            Interpreter&, unsigned parm);
 
+    /**
+     * The alternate function pointer type for native Functions which can
+     * operate on their inputs without owning them.
+     *
+     * This is identical to exec_t, except that each input is a Slice, which
+     * may refer into a larger buffer (such as the remainder of a list), so
+     * the caller need not materialise its arguments. The outputs are written
+     * in place; since callers often reuse the same output strings across
+     * calls, the callee should assign or clear-and-append to them, which
+     * reuses their storage.
+     *
+     * @see Function::exec_t
+     */
+    typedef bool (*execv_t)(std::wstring* out, const Slice* in,
+                            Interpreter&, unsigned parm);
+
+    /**
+     * The function pointer type for native Functions which can perform many
+     * independent invocations in one call, such as when mapping over a list.
+     *
+     * The inputs and outputs of successive invocations are laid out
+     * contiguously; ie, the inputs of the nth invocation begin at
+     * in[n*inputArity] and its outputs at out[n*outputArity]. Outputs are
+     * written as with execv_t.
+     *
+     * @param out An array of count*outputArity output strings.
+     * @param in An array of count*inputArity input Slices.
+     * @param count The number of invocations to perform.
+     * @param interp The Interpreter in which the Function is being run.
+     * @param parm An arbitrary integer for use by the function.
+     * @return Whether every invocation succeeded. On failure, the contents of
+     * the outputs are undefined.
+     */
+    typedef bool (*execb_t)(std::wstring* out, const Slice* in, unsigned count,
+                            Interpreter&, unsigned parm);
+
     /**
      * The number of output arguments this Function takes.
      */
@@ -64,6 +101,23 @@ namespace tglng {
      */
     exec_t exec;
 
+    /**
+     * If non-NULL, an implementation of this Function which takes Slices
+     * instead of owned strings. exec is always valid as well, usually as an
+     * adapter to this one.
+     *
+     * @see Function::call()
+     */
+    execv_t execView;
+
+    /**
+     * If non-NULL, an implementation of this Function which performs a batch
+     * of invocations at once.
+     *
+     * @see Function::callBatch()
+     */
+    execb_t execBatch;
+
     /**
      * Paramater to pass to exec.
      */
@@ -73,7 +127,8 @@ namespace tglng {
      * Constructs an invalid Function.
      */
     Function()
-    : outputArity(0), inputArity(0), exec(NULL)
+    : outputArity(0), inputArity(0),
+      exec(NULL), execView(NULL), execBatch(NULL), parm(0)
     { }
 
     /**
@@ -88,9 +143,69 @@ namespace tglng {
     Function(unsigned outputArity_, unsigned inputArity_, exec_t exec_,
              unsigned parm_ = 0)
     : outputArity(outputArity_), inputArity(inputArity_),
-      exec(exec_), parm(parm_)
+      exec(exec_), execView(NULL), execBatch(NULL), parm(parm_)
+    { }
+
+    /**
+     * Constructs a Function with both the owned-string and the Slice
+     * implementations given.
+     *
+     * @see TViewFunctionParser
+     */
+    Function(unsigned outputArity_, unsigned inputArity_, exec_t exec_,
+             execv_t execView_, unsigned parm_ = 0)
+    : outputArity(outputArity_), inputArity(inputArity_),
+      exec(exec_), execView(execView_), execBatch(NULL), parm(parm_)
+    { }
+
+    /**
+     * Constructs a Function with all three implementations given. execView
+     * may be NULL.
+     *
+     * @see batchFunction()
+     */
+    Function(unsigned outputArity_, unsigned inputArity_, exec_t exec_,
+             execv_t execView_, execb_t execBatch_, unsigned parm_ = 0)
+    : outputArity(outputArity_), inputArity(inputArity_),
+      exec(exec_), execView(execView_), execBatch(execBatch_), parm(parm_)
     { }
 
+    /**
+     * Invokes this Function on the given Slices.
+     *
+     * If the Function has a native Slice implementation, it is called
+     * directly; otherwise, the inputs are copied into owned strings and exec is
+     * used.
+     *
+     * @param out An array of outputArity strings, as with exec_t.
+     * @param in An array of inputArity Slices.
+     * @param interp The Interpreter in which to run.
+     * @return Whether the Function succeeded.
+     */
+    bool call(std::wstring* out, const Slice* in, Interpreter& interp) const;
+
+    /**
+     * Performs count independent invocations of this Function.
+     *
+     * The caller lays out its frames according to the arity it expects
+     * (outputStride <- inputStride), which may be larger than that of this
+     * Function if it was obtained with Function::compatible. If the strides
+     * equal the actual arity and the Function has a native batch
+     * implementation, it is called once for the whole batch; otherwise, each
+     * invocation is performed in turn with call().
+     *
+     * @param out An array of count*outputStride strings.
+     * @param in An array of count*inputStride Slices.
+     * @param count The number of invocations to perform.
+     * @param outputStride The number of outputs per invocation in out.
+     * @param inputStride The number of inputs per invocation in in.
+     * @param interp The Interpreter in which to run.
+     * @return Whether every invocation succeeded.
+     */
+    bool callBatch(std::wstring* out, const Slice* in, unsigned count,
+                   unsigned outputStride, unsigned inputStride,
+                   Interpreter& interp) const;
+
     /**
      * Checks whether this Function matches the given arity, in output,input
      * order.
@@ -134,7 +249,8 @@ namespace tglng {
      * @param validate Member function to call to verify that the function is
      * usable; defaults to &Function::compatible, but matches may be used as
      * well.
-     * @return Whether a compatible function was obtained.
+     * @return Whether a compatible function was obtained. If the function has
+     * a native Slice implementation, it is carried in dst.execView.
      */
     static bool get(Function& dst,
                     const Interpreter& interp,
@@ -146,6 +262,112 @@ namespace tglng {
                     &tglng::Function::compatible);
   };
 
+  /**
+   * The largest arity (in either direction) for which a FunctionInvocation of
+   * unknown arity keeps its argument frame on the machine stack. Functions
+   * with more arguments than this fall back to a heap-allocated frame.
+   */
+#define FUNCTION_STACK_FRAME_SIZE 8
+
+  /**
+   * Adapts a Function::execv_t to the Function::exec_t ABI by wrapping each
+   * input in a Slice.
+   */
+  template<unsigned InputArity, Function::execv_t ExecView>
+  bool sliceAdapter(std::wstring* out, const std::wstring* in,
+                    Interpreter& interp, unsigned parm) {
+    Slice slices[InputArity? InputArity : 1];
+    for (unsigned i = 0; i < InputArity; ++i)
+      slices[i] = Slice(in[i]);
+    return ExecView(out, slices, interp, parm);
+  }
+
+  /**
+   * Adapts a Function::execb_t to the Function::execv_t ABI by performing a
+   * batch of one.
+   */
+  template<Function::execb_t ExecBatch>
+  bool batchAdapter(std::wstring* out, const Slice* in,
+                    Interpreter& interp, unsigned parm) {
+    return ExecBatch(out, in, 1, interp, parm);
+  }
+
+  /**
+   * Returns a Function implemented natively by the given batch
+   * implementation, with exec and execView adapted from it.
+   */
+  template<unsigned OutputArity, unsigned InputArity,
+           Function::execb_t ExecBatch>
+  Function batchFunction(unsigned parm = 0) {
+    return Function(OutputArity, InputArity,
+                    sliceAdapter<InputArity, batchAdapter<ExecBatch> >,
+                    batchAdapter<ExecBatch>, ExecBatch, parm);
+  }
+
+  /**
+   * Represents an arbitrary function invocation.
+   * This class should be considered sealed except to
+   * DynamicFunctionInvocation and TFunctionInvocation.
+   */
+  class FunctionInvocation: public Command {
+    friend class DynamicFunctionInvocation;
+    Function function;
+    std::wstring outregs;
+    //Can't use auto_ptrs in a vector
+    std::vector<Command*> arguments;
+
+  public:
+    /**
+     * Creates a FunctionInvocation with the given parms.
+     *
+     * @param fun The function to execute
+     * @param outregs The registers to write secondary outputs to
+     * @param args A list of Commands to execute for each input.
+     */
+    FunctionInvocation(Command*, Function fun,
+                       const std::wstring& outregs,
+                       const std::vector<Command*>& args);
+
+    virtual ~FunctionInvocation();
+    virtual bool exec(std::wstring&, Interpreter&);
+
+  protected:
+    /**
+     * Performs the invocation using the given frame.
+     *
+     * The primary output and any captured secondary outputs are moved out of
+     * the frame rather than copied.
+     *
+     * @param dst The destination for the primary output.
+     * @param interp The Interpreter in which to run.
+     * @param out Array of at least function.outputArity strings.
+     * @param in Array of at least function.inputArity strings.
+     * @return Whether the invocation succeeded.
+     */
+    bool invoke(std::wstring& dst, Interpreter& interp,
+                std::wstring* out, std::wstring* in);
+  };
+
+  /**
+   * A FunctionInvocation whose arity is known at compile time, allowing the
+   * argument frame to be sized exactly and live on the machine stack.
+   */
+  template<unsigned OutputArity, unsigned InputArity>
+  class TFunctionInvocation: public FunctionInvocation {
+  public:
+    TFunctionInvocation(Command* left, Function fun,
+                        const std::wstring& outregs,
+                        const std::vector<Command*>& args)
+    : FunctionInvocation(left, fun, outregs, args) {}
+
+    virtual bool exec(std::wstring& dst, Interpreter& interp) {
+      //Zero-length arrays are not permitted, so always have at least one
+      std::wstring out[OutputArity? OutputArity : 1];
+      std::wstring in [InputArity?  InputArity  : 1];
+      return invoke(dst, interp, out, in);
+    }
+  };
+
   /**
    * This class encapsulates the parsing of standard function syntax.
    */
@@ -161,6 +383,18 @@ namespace tglng {
     virtual ParseResult parse(Interpreter&, Command*&,
                               const std::wstring&, unsigned&);
     virtual bool function(Function&) const;
+
+  protected:
+    /**
+     * Creates the FunctionInvocation for a parsed call.
+     *
+     * The default creates a FunctionInvocation of dynamic arity; subclasses
+     * which know their arity at compile time may return a specialised one.
+     */
+    virtual FunctionInvocation* invocation(Command* left,
+                                           const std::wstring& outregs,
+                                           const std::vector<Command*>& args)
+    const;
   };
 
   /**
@@ -172,34 +406,63 @@ namespace tglng {
   public:
     TFunctionParser()
     : FunctionParser(Function(OutputArity, InputArity, Exec)) {}
+
+  protected:
+    virtual FunctionInvocation* invocation(Command* left,
+                                           const std::wstring& outregs,
+                                           const std::vector<Command*>& args)
+    const {
+      return new TFunctionInvocation<OutputArity,InputArity>(
+        left, Function(OutputArity, InputArity, Exec), outregs, args);
+    }
   };
 
   /**
-   * Represents an arbitrary function invocation.
-   * This class should be considered sealed except to
-   * DynamicFunctionInvocation.
+   * Like TFunctionParser, but for Functions implemented natively on Slices.
+   * The resulting Function has both exec and execView set.
    */
-  class FunctionInvocation: public Command {
-    friend class DynamicFunctionInvocation;
-    Function function;
-    std::wstring outregs;
-    //Can't use auto_ptrs in a vector
-    std::vector<Command*> arguments;
+  template<unsigned OutputArity, unsigned InputArity,
+           Function::execv_t ExecView>
+  class TViewFunctionParser: public FunctionParser {
+  public:
+    TViewFunctionParser()
+    : FunctionParser(Function(OutputArity, InputArity,
+                              sliceAdapter<InputArity, ExecView>,
+                              ExecView)) {}
+
+  protected:
+    virtual FunctionInvocation* invocation(Command* left,
+                                           const std::wstring& outregs,
+                                           const std::vector<Command*>& args)
+    const {
+      return new TFunctionInvocation<OutputArity,InputArity>(
+        left, Function(OutputArity, InputArity,
+                       sliceAdapter<InputArity, ExecView>, ExecView),
+        outregs, args);
+    }
+  };
 
+  /**
+   * Like TFunctionParser, but for Functions implemented natively as batches.
+   *
+   * @see batchFunction()
+   */
+  template<unsigned OutputArity, unsigned InputArity,
+           Function::execb_t ExecBatch>
+  class TBatchFunctionParser: public FunctionParser {
   public:
-    /**
-     * Creates a FunctionInvocation with the given parms.
-     *
-     * @param fun The function to execute
-     * @param outregs The registers to write secondary outputs to
-     * @param args A list of Commands to execute for each input.
-     */
-    FunctionInvocation(Command*, Function fun,
-                       const std::wstring& outregs,
-                       const std::vector<Command*> args);
+    TBatchFunctionParser()
+    : FunctionParser(batchFunction<OutputArity, InputArity, ExecBatch>()) {}
 
-    virtual ~FunctionInvocation();
-    virtual bool exec(std::wstring&, Interpreter&);
+  protected:
+    virtual FunctionInvocation* invocation(Command* left,
+                                           const std::wstring& outregs,
+                                           const std::vector<Command*>& args)
+    const {
+      return new TFunctionInvocation<OutputArity,InputArity>(
+        left, batchFunction<OutputArity, InputArity, ExecBatch>(),
+        outregs, args);
+    }
   };
 }
 
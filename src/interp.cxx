@@ -11,6 +11,7 @@
 #include <cerrno>
 #include <iostream>
 #include <iomanip>
+#include <sys/time.h>
 
 #include "interp.hxx"
 #include "command.hxx"
@@ -26,6 +27,8 @@ namespace tglng {
   // compilation unit's initialisers run.
   static map<wstring,CommandParser*>* globalDefaultBindings = NULL;
 
+  AtomicCounter Interpreter::cachedMemory;
+
   // Proxies to another CommandParser which it does not own.
   class ProxyCommandParser: public CommandParser {
     CommandParser*const delegate;
@@ -64,19 +67,27 @@ namespace tglng {
 
   Interpreter::Interpreter()
   : nextExternalEntity(0),
+    usage(&ownUsage), commandsExecuted(0), memoryAccounted(0),
+    aborted(false),
     commandsL(cloneProxyBindings(globalDefaultBindings)),
     commandsS(makeDefaultCommandsS(commandsL)),
-    escape(L'`'), longMode(false)
+    registerLog(NULL), lazyRegisters(NULL),
+    escape(L'`'), longMode(false), isWorker(false)
   {
+    gettimeofday(&startTime, NULL);
   }
 
   Interpreter::Interpreter(const Interpreter* that)
   : externalEntities(that->externalEntities),
     nextExternalEntity(that->nextExternalEntity),
+    usage(that->usage), commandsExecuted(0), memoryAccounted(0),
+    startTime(that->startTime), aborted(false),
     commandsL(cloneProxyBindings(&that->commandsL)),
     //Since commandsS doesn't own anything anyway, a direct copy will suffice.
     commandsS(that->commandsS),
-    escape(that->escape), longMode(that->longMode)
+    registerLog(NULL), lazyRegisters(NULL),
+    escape(that->escape), longMode(that->longMode),
+    isWorker(that->isWorker), variables(that->variables)
   {
     //Clear the free fields of the externals since we don't own the objects
     for (map<unsigned,ExtrernalEntity>::iterator it = externalEntities.begin();
@@ -85,6 +96,9 @@ namespace tglng {
   }
 
   Interpreter::~Interpreter() {
+    //Whatever this held is gone now
+    usage->memory.add(-memoryAccounted);
+
     //Free the externals
     for (map<unsigned,ExtrernalEntity>::const_iterator it =
            externalEntities.begin();
@@ -158,7 +172,12 @@ namespace tglng {
           }
         }
 
-        return parser->parse(*this, out, text, offset);
+        Command* prev = out;
+        unsigned start = offset;
+        ParseResult result = parser->parse(*this, out, text, offset);
+        if (out != prev && out)
+          out->sourceOffset = start;
+        return result;
       }
     }
 
@@ -182,6 +201,8 @@ namespace tglng {
   }
 
   bool Interpreter::exec(wstring& out, Command* cmd) {
+    if (aborted) return false;
+
     //Reverse Command::left linked list so we don't need to recurse
     list<Command*> lhs;
     for (Command* curr = cmd; curr; curr = curr->left)
@@ -189,16 +210,134 @@ namespace tglng {
     //Accumulate result
     out.clear();
     wstring result;
+    liveOutputs.push_back(&out);
+    liveOutputs.push_back(&result);
+    bool ok = true;
     for (list<Command*>::const_iterator it = lhs.begin();
-         it != lhs.end(); ++it) {
-      if (!(*it)->exec(result, *this))
+         ok && it != lhs.end(); ++it) {
+      ok = checkLimits() && (*it)->exec(result, *this);
+      if (ok)
+        appendMove(out, result);
+      else if (aborted)
+        abortTrace.push_back((*it)->sourceOffset);
+    }
+
+    liveOutputs.pop_back();
+    liveOutputs.pop_back();
+    return ok;
+  }
+
+  /* Wall time and memory are only checked after this many commands, since
+   * both are fairly expensive to determine.
+   */
+#define LIMIT_CHECK_INTERVAL 64
+
+  bool Interpreter::checkLimits() {
+    ++commandsExecuted;
+    if (commandLimit && usage->commands.add(1) > commandLimit) {
+      if (abortForLimit())
+        wcerr << L"tglng: error: Command limit of " << commandLimit
+              << L" exceeded." << endl;
+      return false;
+    }
+
+    if (commandsExecuted % LIMIT_CHECK_INTERVAL)
+      return true;
+
+    if (memoryLimit) {
+      unsigned long chars = 0;
+      for (unsigned i = 0; i < liveOutputs.size(); ++i)
+        chars += liveOutputs[i]->size();
+      unsigned long bytes = chars * sizeof(wchar_t);
+      for (registers_t::const_iterator it = registers.begin();
+           it != registers.end(); ++it)
+        bytes += it->second.bytes();
+
+      //Replace what was last accounted for this Interpreter in the total
+      unsigned long total = usage->memory.add(bytes - memoryAccounted);
+      memoryAccounted = bytes;
+      if (total + cachedMemory.get() > memoryLimit) {
+        if (abortForLimit())
+          wcerr << L"tglng: error: Memory limit of " << memoryLimit
+                << L" bytes exceeded." << endl;
         return false;
-      out += result;
+      }
+    }
+
+    if (timeLimit) {
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      //Compare in milliseconds
+      unsigned long elapsed =
+        (now.tv_sec - startTime.tv_sec) * 1000 +
+        (now.tv_usec - startTime.tv_usec) / 1000;
+      if (elapsed > timeLimit * 1000) {
+        if (abortForLimit())
+          wcerr << L"tglng: error: Time limit of " << timeLimit
+                << L" seconds exceeded." << endl;
+        return false;
+      }
     }
 
     return true;
   }
 
+  bool Interpreter::abortForLimit() {
+    aborted = true;
+    return usage->aborts.add(1) == 1;
+  }
+
+  bool Interpreter::readRegister(wstring& dst, wchar_t reg) const {
+    if (lazyRegisters && lazyRegisters->get(dst, reg))
+      return true;
+
+    registers_t::const_iterator it = registers.find(reg);
+    if (it == registers.end())
+      return false;
+
+    it->second.get(dst);
+    return true;
+  }
+
+  void Interpreter::RegisterLog::note(const registers_t& registers,
+                                      wchar_t reg) {
+    if (saved.count(reg)) return;
+
+    pair<bool,CompactString>& entry(saved[reg]);
+    registers_t::const_iterator it = registers.find(reg);
+    entry.first = it != registers.end();
+    if (entry.first)
+      entry.second = it->second;
+  }
+
+  void Interpreter::RegisterLog::undo(registers_t& registers) const {
+    for (map<wchar_t,pair<bool,CompactString> >::const_iterator it =
+           saved.begin(); it != saved.end(); ++it) {
+      if (it->second.first)
+        registers[it->first] = it->second.second;
+      else
+        registers.erase(it->first);
+    }
+  }
+
+  void Interpreter::setRegisters(const registers_t& that) {
+    if (registerLog) {
+      for (registers_t::const_iterator it = registers.begin();
+           it != registers.end(); ++it)
+        registerLog->note(registers, it->first);
+      for (registers_t::const_iterator it = that.begin();
+           it != that.end(); ++it)
+        registerLog->note(registers, it->first);
+    }
+
+    registers = that;
+  }
+
+  void Interpreter::joinWorker(const Interpreter& worker) {
+    if (worker.aborted)
+      aborted = true;
+  }
+
   bool Interpreter::exec(wstring& out, const wstring& text, ParseMode mode) {
     Command* root = NULL;
     unsigned offset = 0;
@@ -3,9 +3,13 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <iostream>
+#include <sys/time.h>
 
 #include "parse_result.hxx"
+#include "common.hxx"
+#include "thread.hxx"
 
 namespace tglng {
   class CommandParser;
@@ -29,6 +33,29 @@ namespace tglng {
     std::map<unsigned,ExtrernalEntity> externalEntities;
     unsigned nextExternalEntity;
 
+    //Resource accounting; see options.hxx for the limits. The totals are
+    //kept by the Interpreter at the root of the clones (see list-pmap), and
+    //shared by all of them, so that the limits apply to everything run at
+    //once rather than to each thread separately.
+    struct ResourceUsage {
+      AtomicCounter commands;
+      //The sum of what each Interpreter last measured of its own memory
+      AtomicCounter memory;
+      //The number of Interpreters which have hit a limit; only the first
+      //reports it
+      AtomicCounter aborts;
+    };
+    ResourceUsage ownUsage;
+    ResourceUsage* usage;
+    //The commands run by this Interpreter itself, and the memory it last
+    //added to usage->memory
+    unsigned long commandsExecuted, memoryAccounted;
+    //The output strings of all in-progress calls to exec(), including those
+    //commands are currently writing to
+    std::vector<const std::wstring*> liveOutputs;
+    struct timeval startTime;
+    bool aborted;
+
   public:
     /**
      * Maps wstrings to CommandParser*s used to interperet the commands. These
@@ -46,10 +73,144 @@ namespace tglng {
     /**
      * Maps wchar_ts to register values. If an entry is not present, that
      * register does not exist.
+     *
+     * Values are stored compactly since all registers are copied on every
+     * user function call.
      */
-    typedef std::map<wchar_t,std::wstring> registers_t;
+    typedef std::map<wchar_t,CompactString> registers_t;
     registers_t registers;
 
+    /**
+     * Remembers the original value of every register changed while it is
+     * installed as registerLog, so that the changes can be undone without
+     * having copied all the registers beforehand.
+     */
+    class RegisterLog {
+      //The value each changed register had when first changed; the bool is
+      //false if the register did not exist.
+      std::map<wchar_t,std::pair<bool,CompactString> > saved;
+
+    public:
+      /**
+       * Records the current value of the given register in the given map,
+       * unless it has already been recorded.
+       */
+      void note(const registers_t&, wchar_t);
+      /**
+       * Returns the registers recorded so far to their original values. The
+       * log remains valid, so this may be repeated after further changes.
+       */
+      void undo(registers_t&) const;
+    };
+
+    /**
+     * If non-NULL, every change to registers made through writeRegister(),
+     * unsetRegister() or setRegisters() is recorded in this log.
+     */
+    RegisterLog* registerLog;
+
+    /**
+     * Returns the given register for writing, creating it if necessary.
+     */
+    CompactString& writeRegister(wchar_t reg) {
+      if (registerLog) registerLog->note(registers, reg);
+      return registers[reg];
+    }
+
+    /**
+     * Sets dst to the value of the given register, including one supplied by
+     * lazyRegisters, and returns true. Returns false without modifying dst if
+     * the register does not exist.
+     */
+    bool readRegister(std::wstring& dst, wchar_t reg) const;
+
+    /**
+     * Sets dst to refer to the value of the given register without copying
+     * it and returns true, if that is possible; currently, it only is for
+     * some registers supplied by lazyRegisters. Otherwise, returns false, and
+     * readRegister() must be used instead. The Slice is only valid until the
+     * registers are next changed.
+     */
+    bool viewRegister(Slice& dst, wchar_t reg) const {
+      return lazyRegisters && lazyRegisters->view(dst, reg);
+    }
+
+    /**
+     * Deletes the given register, if it exists.
+     */
+    void unsetRegister(wchar_t reg) {
+      if (registerLog) registerLog->note(registers, reg);
+      registers.erase(reg);
+    }
+
+    /**
+     * Replaces all registers with the given ones.
+     */
+    void setRegisters(const registers_t&);
+
+    /**
+     * Supplies the values of some registers without their having been written
+     * into registers. This allows commands which bind many registers over and
+     * over (such as rx-repl-inline) to only produce the values that are
+     * actually read.
+     */
+    class LazyRegisters {
+    public:
+      virtual ~LazyRegisters() {}
+      /**
+       * If the given register is one of those supplied, sets dst to its value
+       * and returns true. Otherwise, returns false.
+       */
+      virtual bool get(std::wstring& dst, wchar_t reg) const = 0;
+      /**
+       * If the given register is one of those supplied and its value already
+       * exists as a contiguous string, sets dst to refer to it and returns
+       * true. Otherwise, returns false.
+       *
+       * Default returns false.
+       */
+      virtual bool view(Slice& dst, wchar_t reg) const { return false; }
+      /**
+       * Returns whether the given register is one of those supplied.
+       *
+       * Default returns true, which is always safe.
+       */
+      virtual bool supplies(wchar_t reg) const { return true; }
+      /**
+       * Writes every register supplied into the given Interpreter's
+       * registers, via writeRegister().
+       */
+      virtual void bind(Interpreter&) const = 0;
+    };
+
+    /**
+     * If non-NULL, the registers supplied by this object are to be treated as
+     * if they were in registers. Reading a single register may consult it
+     * directly; anything else which accesses registers must call
+     * bindRegisters() first.
+     */
+    const LazyRegisters* lazyRegisters;
+
+    /**
+     * Writes any lazyRegisters into registers and clears lazyRegisters.
+     */
+    void bindRegisters() {
+      if (lazyRegisters) {
+        const LazyRegisters* lazy = lazyRegisters;
+        lazyRegisters = NULL;
+        lazy->bind(*this);
+      }
+    }
+
+    /**
+     * Calls bindRegisters() if the given register is one supplied by
+     * lazyRegisters. This is enough before changing only that register.
+     */
+    void bindRegister(wchar_t reg) {
+      if (lazyRegisters && lazyRegisters->supplies(reg))
+        bindRegisters();
+    }
+
     /**
      * The current escape character.
      */
@@ -60,6 +221,21 @@ namespace tglng {
      */
     bool longMode;
 
+    /**
+     * Whether this Interpreter is a worker running on a thread of its own
+     * (see list-pmap). Commands which would change state shared by the whole
+     * process refuse to run in workers.
+     */
+    bool isWorker;
+
+    /**
+     * The values of let variables as seen by a worker, keyed by the storage
+     * shared by the commands accessing the variable. Only used if isWorker
+     * is true; a variable absent from the map still has the value it had in
+     * the Interpreter the worker was cloned from.
+     */
+    std::map<const void*,std::wstring> variables;
+
     /**
      * Creates a new Interpreter with only the builtin commands defined, no
      * registers, and the only short name '#' bound to "long-command".
@@ -154,6 +330,35 @@ namespace tglng {
      */
     bool exec(std::wstring& out, std::wistream& in, ParseMode);
 
+    /**
+     * Returns whether execution was aborted because one of the resource
+     * limits was exceeded. Once this happens, every further call to exec()
+     * fails immediately.
+     */
+    bool limitExceeded() const { return aborted; }
+
+    /**
+     * If execution was aborted due to a resource limit, holds the
+     * sourceOffset of the Command each active call to exec() was executing,
+     * innermost first. The last element thus refers to the top-level text
+     * being executed.
+     */
+    std::vector<unsigned> abortTrace;
+
+    /**
+     * Called once the given worker, a clone of this Interpreter which ran on
+     * another thread (see list-pmap), has finished. If the worker hit a
+     * resource limit, this Interpreter is aborted as well.
+     */
+    void joinWorker(const Interpreter& worker);
+
+    /**
+     * Memory held outside of any Interpreter, such as by caches of parsed
+     * values, in bytes. This counts toward the memory limit; whatever adds to
+     * it must subtract the same amount once the memory is freed.
+     */
+    static AtomicCounter cachedMemory;
+
     /**
      * Binds the given object to this interpreter.
      *
@@ -207,6 +412,19 @@ namespace tglng {
     }
 
     unsigned bindExternal(const ExtrernalEntity&);
+
+    /**
+     * Accounts for the execution of one more command, and checks the
+     * resource limits. Returns false (having printed a diagnostic) if
+     * execution must stop.
+     */
+    bool checkLimits();
+    /**
+     * Marks this Interpreter as aborted due to a resource limit. Returns
+     * whether it is the first of those sharing its resource usage to be, and
+     * so is to report the limit.
+     */
+    bool abortForLimit();
   };
 
   /**
@@ -0,0 +1,1344 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <utility>
+#include <cwctype>
+#include <iostream>
+
+#include "native_regex.hxx"
+#include "common.hxx"
+
+using namespace std;
+
+namespace tglng {
+  namespace {
+    ///Limits on patterns, so that compiling one takes bounded time and memory
+    const unsigned MAX_PROGRAM_SIZE = 65536;
+    const unsigned MAX_REPEAT = 1000;
+    const unsigned MAX_NESTING = 256;
+    ///The number of groups reported, including the whole match, as with the
+    ///other backends
+    const unsigned MAX_MATCHES = 10;
+    ///The number of DFA states kept before the DFA is discarded and rebuilt
+    const unsigned MAX_DFA_STATES = 256;
+    ///The number of transitions on characters beyond Latin-1 cached per DFA
+    ///state
+    const unsigned MAX_DFA_WIDE_TRANSITIONS = 256;
+
+    const unsigned UNSET = ~0u;
+    const unsigned INFINITE = ~0u;
+
+    enum Opcode {
+      OpChar,     //Consumes ch
+      OpCharFold, //Consumes any character whose lowercase form is ch
+      OpAny,      //Consumes any character
+      OpAnyNotNl, //Consumes any character but a line break
+      OpClass,    //Consumes a character in classes[x]
+      OpMatch,    //Success
+      OpJmp,      //Continues at x
+      OpSplit,    //Continues at x, and with lower priority at y
+      OpSave,     //Records the current position in capture slot x
+      OpAssert,   //Continues only if assertion x holds at the current position
+      OpLoopEnd   //Continues at y if nothing was consumed since slot x was set
+    };
+
+    enum Assertion {
+      AssertBeginText,
+      AssertEndText,
+      AssertBeginLine,
+      AssertEndLine,
+      AssertWordBoundary,
+      AssertNotWordBoundary
+    };
+
+    struct Inst {
+      Opcode op;
+      unsigned x, y;
+      wchar_t ch;
+    };
+
+    //Named classes of characters, used as bits in CharClass
+    enum {
+      NcDigit  = 1 << 0,
+      NcWord   = 1 << 1,
+      NcSpace  = 1 << 2,
+      NcAlpha  = 1 << 3,
+      NcAlnum  = 1 << 4,
+      NcUpper  = 1 << 5,
+      NcLower  = 1 << 6,
+      NcPunct  = 1 << 7,
+      NcXdigit = 1 << 8,
+      NcCntrl  = 1 << 9,
+      NcPrint  = 1 << 10,
+      NcGraph  = 1 << 11,
+      NcBlank  = 1 << 12,
+      NcLast   = NcBlank
+    };
+
+    static bool isWordChar(wchar_t ch) {
+      return ch == L'_' || iswalnum(ch);
+    }
+
+    static bool inNamedClass(unsigned nc, wchar_t ch) {
+      switch (nc) {
+      case NcDigit:  return iswdigit(ch);
+      case NcWord:   return isWordChar(ch);
+      case NcSpace:  return iswspace(ch);
+      case NcAlpha:  return iswalpha(ch);
+      case NcAlnum:  return iswalnum(ch);
+      case NcUpper:  return iswupper(ch);
+      case NcLower:  return iswlower(ch);
+      case NcPunct:  return iswpunct(ch);
+      case NcXdigit: return iswxdigit(ch);
+      case NcCntrl:  return iswcntrl(ch);
+      case NcPrint:  return iswprint(ch);
+      case NcGraph:  return iswgraph(ch);
+      case NcBlank:  return ch == L' ' || ch == L'\t';
+      }
+      return false;
+    }
+
+    static unsigned posixClass(const wstring& name) {
+      static const struct { const wchar_t* name; unsigned nc; } names[] = {
+        { L"alpha", NcAlpha }, { L"digit", NcDigit }, { L"alnum", NcAlnum },
+        { L"upper", NcUpper }, { L"lower", NcLower }, { L"space", NcSpace },
+        { L"punct", NcPunct }, { L"xdigit", NcXdigit }, { L"cntrl", NcCntrl },
+        { L"print", NcPrint }, { L"graph", NcGraph }, { L"blank", NcBlank },
+        { L"word", NcWord },
+      };
+      for (unsigned i = 0; i < sizeof(names)/sizeof(names[0]); ++i)
+        if (name == names[i].name)
+          return names[i].nc;
+      return 0;
+    }
+
+    struct CharClass {
+      vector<pair<wchar_t,wchar_t> > ranges;
+      //Characters in any of the named classes in named, or outside any of
+      //those in notNamed, are also members
+      unsigned named, notNamed;
+      bool negated;
+
+      CharClass() : named(0), notNamed(0), negated(false) {}
+
+      bool containsRaw(wchar_t ch) const {
+        for (unsigned i = 0; i < ranges.size(); ++i)
+          if (ch >= ranges[i].first && ch <= ranges[i].second)
+            return true;
+        for (unsigned nc = 1; nc <= NcLast; nc <<= 1) {
+          if ((named & nc) && inNamedClass(nc, ch)) return true;
+          if ((notNamed & nc) && !inNamedClass(nc, ch)) return true;
+        }
+        return false;
+      }
+
+      bool contains(wchar_t ch, bool fold) const {
+        bool in = containsRaw(ch) ||
+          (fold && (containsRaw(towlower(ch)) || containsRaw(towupper(ch))));
+        return in != negated;
+      }
+    };
+
+    struct Node {
+      enum Type {
+        Literal, AnyChar, Class, Assert, Group, Concat, Alternate, Repeat
+      } type;
+      wchar_t ch;
+      //Class index, assertion, or capture group number (UNSET if the group
+      //does not capture)
+      unsigned arg;
+      unsigned min, max;
+      bool greedy;
+      vector<unsigned> kids;
+    };
+
+    /**
+     * Parses a pattern into a tree of Nodes.
+     */
+    class Parser {
+      const wstring& pattern;
+      unsigned pos, depth;
+      bool multiline;
+
+    public:
+      vector<Node> nodes;
+      vector<CharClass> classes;
+      //The number of groups, including the implicit group 0
+      unsigned groups;
+      wstring error;
+      unsigned errorOffset;
+
+      Parser(const wstring& pattern_, bool multiline_)
+      : pattern(pattern_), pos(0), depth(0), multiline(multiline_),
+        groups(1), errorOffset(0)
+      { }
+
+      bool parse(unsigned& root) {
+        if (!alternation(root)) return false;
+        if (more())
+          return fail(L"Unmatched )");
+        return true;
+      }
+
+    private:
+      bool fail(const wchar_t* why) {
+        error = why;
+        errorOffset = pos;
+        return false;
+      }
+
+      bool more() const { return pos < pattern.size(); }
+      wchar_t peek() const { return pattern[pos]; }
+
+      unsigned add(Node::Type type) {
+        nodes.push_back(Node());
+        Node& node(nodes.back());
+        node.type = type;
+        node.ch = 0;
+        node.arg = 0;
+        node.min = node.max = 0;
+        node.greedy = true;
+        return nodes.size() - 1;
+      }
+
+      unsigned literal(wchar_t ch) {
+        unsigned n = add(Node::Literal);
+        nodes[n].ch = ch;
+        return n;
+      }
+
+      unsigned assertion(Assertion which) {
+        unsigned n = add(Node::Assert);
+        nodes[n].arg = which;
+        return n;
+      }
+
+      unsigned charClass(const CharClass& cls) {
+        classes.push_back(cls);
+        unsigned n = add(Node::Class);
+        nodes[n].arg = classes.size() - 1;
+        return n;
+      }
+
+      bool alternation(unsigned& out) {
+        unsigned first;
+        if (!concatenation(first)) return false;
+        if (!more() || peek() != L'|') {
+          out = first;
+          return true;
+        }
+
+        out = add(Node::Alternate);
+        nodes[out].kids.push_back(first);
+        while (more() && peek() == L'|') {
+          ++pos;
+          unsigned next;
+          if (!concatenation(next)) return false;
+          nodes[out].kids.push_back(next);
+        }
+        return true;
+      }
+
+      bool concatenation(unsigned& out) {
+        out = add(Node::Concat);
+        while (more() && peek() != L'|' && peek() != L')') {
+          unsigned item;
+          if (!repetition(item)) return false;
+          nodes[out].kids.push_back(item);
+        }
+        return true;
+      }
+
+      bool repetition(unsigned& out) {
+        if (!atom(out)) return false;
+
+        while (more()) {
+          unsigned min, max;
+          wchar_t ch = peek();
+          if (ch == L'*') {
+            min = 0, max = INFINITE;
+            ++pos;
+          } else if (ch == L'+') {
+            min = 1, max = INFINITE;
+            ++pos;
+          } else if (ch == L'?') {
+            min = 0, max = 1;
+            ++pos;
+          } else if (ch == L'{') {
+            int status = counted(min, max);
+            if (status < 0) return false;
+            if (!status) break;
+          } else {
+            break;
+          }
+
+          bool greedy = true;
+          if (more() && peek() == L'?') {
+            greedy = false;
+            ++pos;
+          } else if (more() && peek() == L'+') {
+            return fail(L"Possessive quantifiers are not supported");
+          }
+
+          unsigned rep = add(Node::Repeat);
+          nodes[rep].min = min;
+          nodes[rep].max = max;
+          nodes[rep].greedy = greedy;
+          nodes[rep].kids.push_back(out);
+          out = rep;
+        }
+
+        return true;
+      }
+
+      bool readNumber(unsigned& p, unsigned& n) const {
+        unsigned begin = p;
+        n = 0;
+        while (p < pattern.size() && pattern[p] >= L'0' && pattern[p] <= L'9') {
+          if (n <= MAX_REPEAT)
+            n = n*10 + (pattern[p] - L'0');
+          ++p;
+        }
+        return p != begin;
+      }
+
+      /**
+       * Parses a {n}, {n,} or {n,m} quantifier at pos. Returns 0, without
+       * moving, if there is none (the brace is then literal), or -1 on error.
+       */
+      int counted(unsigned& min, unsigned& max) {
+        unsigned p = pos+1;
+        if (!readNumber(p, min)) return 0;
+        if (p < pattern.size() && pattern[p] == L',') {
+          ++p;
+          if (p < pattern.size() && pattern[p] == L'}')
+            max = INFINITE;
+          else if (!readNumber(p, max))
+            return 0;
+        } else {
+          max = min;
+        }
+        if (p >= pattern.size() || pattern[p] != L'}') return 0;
+
+        if (min > MAX_REPEAT || (max != INFINITE && max > MAX_REPEAT)) {
+          fail(L"Repetition count too large");
+          return -1;
+        }
+        if (max < min) {
+          fail(L"Repetition counts out of order");
+          return -1;
+        }
+
+        pos = p+1;
+        return 1;
+      }
+
+      bool atom(unsigned& out) {
+        switch (peek()) {
+        case L'(':
+          return group(out);
+
+        case L'[':
+          return bracket(out);
+
+        case L'.':
+          ++pos;
+          out = add(Node::AnyChar);
+          return true;
+
+        case L'^':
+          ++pos;
+          out = assertion(multiline? AssertBeginLine : AssertBeginText);
+          return true;
+
+        case L'$':
+          ++pos;
+          out = assertion(multiline? AssertEndLine : AssertEndText);
+          return true;
+
+        case L'\\':
+          return escape(out);
+
+        case L'*':
+        case L'+':
+        case L'?':
+          return fail(L"Nothing to repeat");
+
+        default:
+          out = literal(pattern[pos++]);
+          return true;
+        }
+      }
+
+      bool group(unsigned& out) {
+        unsigned begin = pos++;
+        unsigned number = UNSET;
+        if (more() && peek() == L'?') {
+          ++pos;
+          if (!more())
+            return fail(L"Unterminated group");
+
+          wchar_t kind = peek();
+          if (kind == L':') {
+            ++pos;
+          } else if (kind == L'=' || kind == L'!' ||
+                     (kind == L'<' && pos+1 < pattern.size() &&
+                      (pattern[pos+1] == L'=' || pattern[pos+1] == L'!'))) {
+            return fail(L"Lookaround assertions are not supported");
+          } else if (kind == L'<' || kind == L'\'' || kind == L'P') {
+            //Named group; the name is not used
+            if (kind == L'P') ++pos;
+            wchar_t close = (more() && peek() == L'\''? L'\'' : L'>');
+            size_t end = pattern.find(close, pos+1);
+            if (end == wstring::npos)
+              return fail(L"Unterminated group name");
+            pos = end+1;
+            number = groups++;
+          } else {
+            return fail(L"Unsupported group syntax");
+          }
+        } else {
+          number = groups++;
+        }
+
+        if (++depth > MAX_NESTING)
+          return fail(L"Groups nested too deeply");
+
+        unsigned kid;
+        if (!alternation(kid)) return false;
+        if (!more() || peek() != L')') {
+          pos = begin;
+          return fail(L"Missing )");
+        }
+        ++pos;
+        --depth;
+
+        out = add(Node::Group);
+        nodes[out].arg = number;
+        nodes[out].kids.push_back(kid);
+        return true;
+      }
+
+      static unsigned hexValue(wchar_t ch) {
+        if (ch >= L'0' && ch <= L'9') return ch - L'0';
+        if (ch >= L'a' && ch <= L'f') return ch - L'a' + 10;
+        if (ch >= L'A' && ch <= L'F') return ch - L'A' + 10;
+        return UNSET;
+      }
+
+      /**
+       * Decodes the escape sequence whose letter (already consumed) is ch and
+       * which stands for a single character.
+       */
+      bool escapedChar(wchar_t ch, wchar_t& out) {
+        switch (ch) {
+        case L'n': out = L'\n'; return true;
+        case L't': out = L'\t'; return true;
+        case L'r': out = L'\r'; return true;
+        case L'f': out = L'\f'; return true;
+        case L'v': out = L'\v'; return true;
+        case L'a': out = L'\a'; return true;
+        case L'e': out = 0x1B;  return true;
+
+        case L'0': {
+          unsigned value = 0;
+          for (unsigned i = 0; i < 2 && more() &&
+                 peek() >= L'0' && peek() <= L'7'; ++i)
+            value = value*8 + (pattern[pos++] - L'0');
+          out = value;
+        } return true;
+
+        case L'x': {
+          unsigned value = 0;
+          if (more() && peek() == L'{') {
+            unsigned p = pos+1;
+            while (p < pattern.size() && hexValue(pattern[p]) != UNSET &&
+                   value <= 0x10FFFF)
+              value = value*16 + hexValue(pattern[p++]);
+            if (p >= pattern.size() || pattern[p] != L'}' || p == pos+1)
+              return fail(L"Invalid \\x{} escape");
+            if (value > 0x10FFFF)
+              return fail(L"Character code too large");
+            pos = p+1;
+          } else {
+            for (unsigned i = 0; i < 2 && more() &&
+                   hexValue(peek()) != UNSET; ++i)
+              value = value*16 + hexValue(pattern[pos++]);
+          }
+          out = value;
+        } return true;
+        }
+
+        if (ch >= L'1' && ch <= L'9')
+          return fail(L"Backreferences are not supported");
+        if (iswalnum(ch))
+          return fail(L"Unsupported escape sequence");
+
+        out = ch;
+        return true;
+      }
+
+      /**
+       * If ch (already consumed after a backslash) names one of the
+       * shorthand classes, adds it to cls and returns true.
+       */
+      static bool shorthandClass(CharClass& cls, wchar_t ch) {
+        switch (ch) {
+        case L'd': cls.named    |= NcDigit; return true;
+        case L'D': cls.notNamed |= NcDigit; return true;
+        case L'w': cls.named    |= NcWord;  return true;
+        case L'W': cls.notNamed |= NcWord;  return true;
+        case L's': cls.named    |= NcSpace; return true;
+        case L'S': cls.notNamed |= NcSpace; return true;
+        }
+        return false;
+      }
+
+      bool escape(unsigned& out) {
+        ++pos;
+        if (!more())
+          return fail(L"Pattern ends with \\");
+
+        wchar_t ch = pattern[pos++];
+        CharClass cls;
+        if (shorthandClass(cls, ch)) {
+          out = charClass(cls);
+          return true;
+        }
+
+        switch (ch) {
+        case L'b': out = assertion(AssertWordBoundary);    return true;
+        case L'B': out = assertion(AssertNotWordBoundary); return true;
+        case L'A': out = assertion(AssertBeginText);       return true;
+        case L'z': out = assertion(AssertEndText);         return true;
+        case L'g':
+        case L'k':
+          return fail(L"Backreferences are not supported");
+        }
+
+        wchar_t lit;
+        if (!escapedChar(ch, lit)) return false;
+        out = literal(lit);
+        return true;
+      }
+
+      /**
+       * Reads one member of a bracket expression which may be the end of a
+       * range.
+       */
+      bool bracketChar(wchar_t& out) {
+        if (peek() != L'\\') {
+          out = pattern[pos++];
+          return true;
+        }
+
+        ++pos;
+        if (!more())
+          return fail(L"Pattern ends with \\");
+        wchar_t ch = pattern[pos++];
+        //\b is backspace within brackets
+        if (ch == L'b') {
+          out = L'\b';
+          return true;
+        }
+        return escapedChar(ch, out);
+      }
+
+      bool bracket(unsigned& out) {
+        unsigned begin = pos++;
+        CharClass cls;
+        if (more() && peek() == L'^') {
+          cls.negated = true;
+          ++pos;
+        }
+
+        for (bool first = true; ; first = false) {
+          if (!more()) {
+            pos = begin;
+            return fail(L"Missing ]");
+          }
+
+          //A ] at the very beginning is literal
+          if (peek() == L']' && !first) {
+            ++pos;
+            break;
+          }
+
+          //POSIX classes, eg [:alpha:]
+          if (peek() == L'[' && pos+1 < pattern.size() &&
+              pattern[pos+1] == L':') {
+            size_t end = pattern.find(L":]", pos+2);
+            if (end != wstring::npos) {
+              bool negate = pattern[pos+2] == L'^';
+              unsigned nc = posixClass(
+                pattern.substr(pos+2 + negate, end - pos-2 - negate));
+              if (!nc)
+                return fail(L"Unknown POSIX class name");
+              (negate? cls.notNamed : cls.named) |= nc;
+              pos = end+2;
+              continue;
+            }
+          }
+
+          if (peek() == L'\\' && pos+1 < pattern.size() &&
+              shorthandClass(cls, pattern[pos+1])) {
+            pos += 2;
+            continue;
+          }
+
+          wchar_t lo, hi;
+          if (!bracketChar(lo)) return false;
+          hi = lo;
+          if (pos+1 < pattern.size() && peek() == L'-' &&
+              pattern[pos+1] != L']') {
+            ++pos;
+            if (!bracketChar(hi)) return false;
+            if (hi < lo)
+              return fail(L"Range out of order in character class");
+          }
+          cls.ranges.push_back(make_pair(lo, hi));
+        }
+
+        //With the l option, negated classes do not match line breaks
+        if (cls.negated && multiline) {
+          cls.ranges.push_back(make_pair(L'\n', L'\n'));
+          cls.ranges.push_back(make_pair(L'\r', L'\r'));
+        }
+
+        out = charClass(cls);
+        return true;
+      }
+    };
+
+    /**
+     * Compiles a tree of Nodes into a program.
+     */
+    class Compiler {
+      const vector<Node>& nodes;
+      bool fold, multiline;
+
+    public:
+      vector<Inst> prog;
+      //The number of capture slots used, including the hidden ones which
+      //record where the current iteration of each loop began
+      unsigned slots;
+      bool tooLarge;
+
+      Compiler(const vector<Node>& nodes_, unsigned groups,
+               bool fold_, bool multiline_)
+      : nodes(nodes_), fold(fold_), multiline(multiline_),
+        slots(groups*2), tooLarge(false)
+      { }
+
+      /**
+       * Returns whether the given node can match the empty string.
+       */
+      bool nullable(unsigned n) const {
+        const Node& node(nodes[n]);
+        switch (node.type) {
+        case Node::Literal:
+        case Node::AnyChar:
+        case Node::Class:
+          return false;
+
+        case Node::Assert:
+          return true;
+
+        case Node::Group:
+          return nullable(node.kids[0]);
+
+        case Node::Concat:
+          for (unsigned i = 0; i < node.kids.size(); ++i)
+            if (!nullable(node.kids[i]))
+              return false;
+          return true;
+
+        case Node::Alternate:
+          for (unsigned i = 0; i < node.kids.size(); ++i)
+            if (nullable(node.kids[i]))
+              return true;
+          return false;
+
+        case Node::Repeat:
+          return !node.min || nullable(node.kids[0]);
+        }
+
+        return true;
+      }
+
+      unsigned emit(Opcode op, unsigned x = 0, wchar_t ch = 0) {
+        if (prog.size() >= MAX_PROGRAM_SIZE)
+          tooLarge = true;
+
+        Inst inst;
+        inst.op = op;
+        inst.x = x;
+        inst.y = 0;
+        inst.ch = ch;
+        prog.push_back(inst);
+        return prog.size() - 1;
+      }
+
+      void setSplit(unsigned split, unsigned body, unsigned out, bool greedy) {
+        prog[split].x = greedy? body : out;
+        prog[split].y = greedy? out : body;
+      }
+
+      void compile(unsigned n) {
+        if (tooLarge) return;
+
+        const Node& node(nodes[n]);
+        switch (node.type) {
+        case Node::Literal:
+          if (fold && towlower(node.ch) != towupper(node.ch))
+            emit(OpCharFold, 0, towlower(node.ch));
+          else
+            emit(OpChar, 0, node.ch);
+          break;
+
+        case Node::AnyChar:
+          emit(multiline? OpAnyNotNl : OpAny);
+          break;
+
+        case Node::Class:
+          emit(OpClass, node.arg);
+          break;
+
+        case Node::Assert:
+          emit(OpAssert, node.arg);
+          break;
+
+        case Node::Concat:
+          for (unsigned i = 0; i < node.kids.size(); ++i)
+            compile(node.kids[i]);
+          break;
+
+        case Node::Group:
+          if (node.arg != UNSET) emit(OpSave, node.arg*2);
+          compile(node.kids[0]);
+          if (node.arg != UNSET) emit(OpSave, node.arg*2+1);
+          break;
+
+        case Node::Alternate: {
+          vector<unsigned> jumps;
+          for (unsigned i = 0; i+1 < node.kids.size(); ++i) {
+            unsigned split = emit(OpSplit);
+            compile(node.kids[i]);
+            jumps.push_back(emit(OpJmp));
+            setSplit(split, split+1, prog.size(), true);
+          }
+          compile(node.kids.back());
+          for (unsigned i = 0; i < jumps.size(); ++i)
+            prog[jumps[i]].x = prog.size();
+        } break;
+
+        case Node::Repeat:
+          repeat(node);
+          break;
+        }
+      }
+
+      /**
+       * Compiles an unbounded repeat whose body can match the empty string.
+       *
+       * As with PCRE, an iteration which matches the empty string ends the
+       * loop; OpLoopEnd checks this against a hidden slot set at the start of
+       * each iteration. The body is compiled twice, with iterations alternating
+       * between the copies: otherwise, an iteration beginning where the
+       * previous one ended would revisit the instructions that one just
+       * passed through, and so be dropped by addThread().
+       */
+      void nullableLoop(const Node& node) {
+        unsigned kid = node.kids[0];
+        unsigned slot = slots++;
+        unsigned split[2], loopEnd[2], body[2];
+
+        for (unsigned copy = 0; copy < 2; ++copy) {
+          split[copy] = node.min? UNSET : emit(OpSplit);
+          body[copy] = emit(OpSave, slot);
+          compile(kid);
+          loopEnd[copy] = emit(OpLoopEnd, slot);
+          if (node.min)
+            split[copy] = emit(OpSplit);
+          else if (copy)
+            emit(OpJmp, split[0]);
+        }
+
+        unsigned exit = prog.size();
+        for (unsigned copy = 0; copy < 2; ++copy) {
+          prog[loopEnd[copy]].y = exit;
+          setSplit(split[copy], node.min? body[!copy] : body[copy],
+                   exit, node.greedy);
+        }
+      }
+
+      void repeat(const Node& node) {
+        unsigned kid = node.kids[0];
+        //x+ is compiled as x followed by a loop back to it, so one of the
+        //required copies doubles as the loop
+        unsigned required = node.min;
+        if (node.max == INFINITE && required) --required;
+        for (unsigned i = 0; i < required; ++i)
+          compile(kid);
+
+        if (node.max == INFINITE && !nullable(kid)) {
+          if (node.min) {
+            unsigned loop = prog.size();
+            compile(kid);
+            unsigned split = emit(OpSplit);
+            setSplit(split, loop, split+1, node.greedy);
+          } else {
+            unsigned split = emit(OpSplit);
+            compile(kid);
+            emit(OpJmp, split);
+            setSplit(split, split+1, prog.size(), node.greedy);
+          }
+        } else if (node.max == INFINITE) {
+          nullableLoop(node);
+        } else {
+          vector<unsigned> splits;
+          for (unsigned i = node.min; i < node.max && !tooLarge; ++i) {
+            splits.push_back(emit(OpSplit));
+            compile(kid);
+          }
+          for (unsigned i = 0; i < splits.size(); ++i)
+            setSplit(splits[i], splits[i]+1, prog.size(), node.greedy);
+        }
+      }
+    };
+
+    /**
+     * The threads of the Pike VM at one position of the input, in priority
+     * order.
+     */
+    struct ThreadList {
+      //Sparse set of every instruction visited while building the list, so
+      //that each is only followed once
+      vector<unsigned> sparse, dense;
+      unsigned visited;
+      //Instructions of the threads which consume or match, and the capture
+      //slots of each
+      vector<unsigned> threads, caps;
+
+      void init(unsigned size) {
+        sparse.resize(size);
+        dense.resize(size);
+        clear();
+      }
+
+      void clear() {
+        visited = 0;
+        threads.clear();
+        caps.clear();
+      }
+
+      bool visit(unsigned pc) {
+        unsigned i = sparse[pc];
+        if (i < visited && dense[i] == pc)
+          return false;
+
+        sparse[pc] = visited;
+        dense[visited++] = pc;
+        return true;
+      }
+    };
+
+    /**
+     * An entry of the explicit stack used to follow the non-consuming
+     * instructions. Either continues at pc, or restores a capture slot.
+     */
+    struct FollowEntry {
+      bool restore;
+      unsigned pc, slot, value;
+    };
+
+    /**
+     * A state of the lazily-built DFA, which is the set of instructions the
+     * NFA could be at, assuming every assertion holds. It is only used to find
+     * out quickly that there is no match.
+     */
+    struct DfaState {
+      //Sorted consuming and matching instructions
+      vector<unsigned> pcs;
+      bool accepting;
+      unsigned next[256];
+      map<wchar_t,unsigned> wideNext;
+    };
+  }
+
+  struct NativeRegexData {
+    vector<Inst> prog;
+    vector<CharClass> classes;
+    //Number of capture groups, including group 0, and of capture slots (two
+    //per group, followed by those used by the loops)
+    unsigned groups, ncap;
+    bool fold, multiline;
+
+    bool valid;
+    wstring error;
+    unsigned errorOffset;
+
+    wstring input;
+    unsigned inputOffset, headBegin, headEnd;
+    bool matched;
+    vector<unsigned> caps;
+
+    //Scratch space for the Pike VM
+    ThreadList lists[2];
+    vector<FollowEntry> stack;
+    vector<unsigned> threadCaps;
+
+    //The lazily-built DFA; dfaStart is UNSET until the first use
+    vector<DfaState*> dfaStates;
+    map<vector<unsigned>,unsigned> dfaIndex;
+    unsigned dfaStart;
+    //Whether the DFA is of no use since the pattern can match the empty string
+    bool dfaUseless;
+    vector<unsigned> dfaMark, dfaStack;
+    unsigned dfaGeneration;
+
+    ~NativeRegexData() {
+      clearDfa();
+    }
+
+    void clearDfa() {
+      for (unsigned i = 0; i < dfaStates.size(); ++i)
+        delete dfaStates[i];
+      dfaStates.clear();
+      dfaIndex.clear();
+      dfaStart = UNSET;
+    }
+  };
+
+  NativeRegex::NativeRegex(const wstring& pattern, const wstring& options)
+  : data(*new NativeRegexData)
+  {
+    data.fold = data.multiline = false;
+    for (unsigned i = 0; i < options.size(); ++i)
+      switch (options[i]) {
+      case L'i':
+        data.fold = true;
+        break;
+
+      case L'l':
+        data.multiline = true;
+        break;
+      }
+
+    data.valid = false;
+    data.errorOffset = 0;
+    data.groups = data.ncap = 0;
+    data.inputOffset = data.headBegin = data.headEnd = 0;
+    data.matched = false;
+    data.dfaStart = UNSET;
+    data.dfaUseless = false;
+    data.dfaGeneration = 0;
+
+    Parser parser(pattern, data.multiline);
+    unsigned root;
+    if (!parser.parse(root)) {
+      data.error = parser.error;
+      data.errorOffset = parser.errorOffset;
+      return;
+    }
+
+    Compiler compiler(parser.nodes, parser.groups,
+                      data.fold, data.multiline);
+    compiler.emit(OpSave, 0);
+    compiler.compile(root);
+    compiler.emit(OpSave, 1);
+    compiler.emit(OpMatch);
+    if (compiler.tooLarge) {
+      data.error = L"Pattern too large";
+      return;
+    }
+
+    data.prog.swap(compiler.prog);
+    data.classes.swap(parser.classes);
+    data.groups = parser.groups;
+    data.ncap = compiler.slots;
+    data.caps.assign(data.ncap, UNSET);
+    data.threadCaps.resize(data.ncap);
+    data.lists[0].init(data.prog.size());
+    data.lists[1].init(data.prog.size());
+    data.dfaMark.assign(data.prog.size(), 0);
+    data.valid = true;
+  }
+
+  NativeRegex::~NativeRegex() {
+    delete &data;
+  }
+
+  NativeRegex::operator bool() const {
+    return data.valid;
+  }
+
+  void NativeRegex::showWhy() const {
+    wcerr << L"Native regular expression: " << data.error << endl;
+  }
+
+  unsigned NativeRegex::where() const {
+    return data.errorOffset;
+  }
+
+  void NativeRegex::input(const Slice& str) {
+    str.assignTo(data.input);
+    data.inputOffset = data.headBegin = data.headEnd = 0;
+    data.matched = false;
+  }
+
+  void NativeRegex::releaseInput() {
+    input(Slice());
+    releaseStorage(data.input);
+  }
+
+  static bool instMatches(const NativeRegexData& data, const Inst& inst,
+                          wchar_t ch) {
+    switch (inst.op) {
+    case OpChar:     return ch == inst.ch;
+    case OpCharFold: return (wchar_t)towlower(ch) == inst.ch;
+    case OpAny:      return true;
+    case OpAnyNotNl: return ch != L'\n' && ch != L'\r';
+    case OpClass:    return data.classes[inst.x].contains(ch, data.fold);
+    default:         return false;
+    }
+  }
+
+  static bool assertionHolds(const NativeRegexData& data, unsigned assertion,
+                             unsigned pos) {
+    const wstring& s(data.input);
+    switch (assertion) {
+    case AssertBeginText:
+      return pos == 0;
+
+    case AssertEndText:
+      return pos == s.size();
+
+    case AssertBeginLine:
+      //Not between the CR and LF of a CRLF
+      return pos == 0 || s[pos-1] == L'\n' ||
+        (s[pos-1] == L'\r' && (pos == s.size() || s[pos] != L'\n'));
+
+    case AssertEndLine:
+      return pos == s.size() || s[pos] == L'\r' ||
+        (s[pos] == L'\n' && (pos == 0 || s[pos-1] != L'\r'));
+
+    case AssertWordBoundary:
+    case AssertNotWordBoundary: {
+      bool before = pos > 0 && isWordChar(s[pos-1]);
+      bool after = pos < s.size() && isWordChar(s[pos]);
+      return (before != after) == (assertion == AssertWordBoundary);
+    }
+    }
+
+    return false;
+  }
+
+  /**
+   * Follows the non-consuming instructions from pc at position pos, adding a
+   * thread to list for each consuming or matching instruction reached, in
+   * priority order. cap holds the capture slots on entry, and is restored
+   * before returning.
+   */
+  static void addThread(NativeRegexData& data, ThreadList& list, unsigned pc,
+                        unsigned* cap, unsigned pos) {
+    vector<FollowEntry>& stack(data.stack);
+    FollowEntry entry;
+    entry.restore = false;
+    entry.pc = pc;
+    stack.push_back(entry);
+
+    while (!stack.empty()) {
+      entry = stack.back();
+      stack.pop_back();
+      if (entry.restore) {
+        cap[entry.slot] = entry.value;
+        continue;
+      }
+
+      //OpLoopEnd may be reached more than once, with different positions in
+      //its slot; each arrival leads to a single instruction which is subject
+      //to the visited set, so this remains linear.
+      for (pc = entry.pc;
+           data.prog[pc].op == OpLoopEnd || list.visit(pc); ) {
+        const Inst& inst(data.prog[pc]);
+        if (inst.op == OpJmp) {
+          pc = inst.x;
+        } else if (inst.op == OpSplit) {
+          FollowEntry alt;
+          alt.restore = false;
+          alt.pc = inst.y;
+          stack.push_back(alt);
+          pc = inst.x;
+        } else if (inst.op == OpSave) {
+          FollowEntry restore;
+          restore.restore = true;
+          restore.slot = inst.x;
+          restore.value = cap[inst.x];
+          stack.push_back(restore);
+          cap[inst.x] = pos;
+          ++pc;
+        } else if (inst.op == OpAssert) {
+          if (!assertionHolds(data, inst.x, pos)) break;
+          ++pc;
+        } else if (inst.op == OpLoopEnd) {
+          pc = (cap[inst.x] == pos? inst.y : pc+1);
+        } else {
+          list.threads.push_back(pc);
+          list.caps.insert(list.caps.end(), cap, cap + data.ncap);
+          break;
+        }
+      }
+    }
+  }
+
+  /**
+   * Adds to out every consuming or matching instruction reachable from pc,
+   * treating all assertions as true. Instructions already marked with the
+   * current generation are skipped.
+   */
+  static void dfaFollow(NativeRegexData& data, vector<unsigned>& out,
+                        unsigned pc) {
+    vector<unsigned>& stack(data.dfaStack);
+    stack.push_back(pc);
+    while (!stack.empty()) {
+      pc = stack.back();
+      stack.pop_back();
+      if (data.dfaMark[pc] == data.dfaGeneration) continue;
+      data.dfaMark[pc] = data.dfaGeneration;
+
+      const Inst& inst(data.prog[pc]);
+      switch (inst.op) {
+      case OpJmp:
+        stack.push_back(inst.x);
+        break;
+
+      case OpSplit:
+        stack.push_back(inst.y);
+        stack.push_back(inst.x);
+        break;
+
+      case OpSave:
+      case OpAssert:
+        stack.push_back(pc+1);
+        break;
+
+      case OpLoopEnd:
+        stack.push_back(inst.y);
+        stack.push_back(pc+1);
+        break;
+
+      default:
+        out.push_back(pc);
+        break;
+      }
+    }
+  }
+
+  static void dfaNewGeneration(NativeRegexData& data) {
+    if (!++data.dfaGeneration) {
+      fill(data.dfaMark.begin(), data.dfaMark.end(), 0);
+      data.dfaGeneration = 1;
+    }
+  }
+
+  /**
+   * Returns the index of the DFA state with the given instructions, creating
+   * it if necessary. If the DFA is full, it is discarded first, in which case
+   * flushed is set to true.
+   */
+  static unsigned dfaState(NativeRegexData& data, vector<unsigned>& pcs,
+                           bool& flushed) {
+    sort(pcs.begin(), pcs.end());
+    map<vector<unsigned>,unsigned>::const_iterator it = data.dfaIndex.find(pcs);
+    if (it != data.dfaIndex.end())
+      return it->second;
+
+    if (data.dfaStates.size() >= MAX_DFA_STATES) {
+      data.clearDfa();
+      flushed = true;
+    }
+
+    DfaState* state = new DfaState;
+    state->pcs = pcs;
+    state->accepting = false;
+    for (unsigned i = 0; i < pcs.size(); ++i)
+      if (data.prog[pcs[i]].op == OpMatch)
+        state->accepting = true;
+    fill(state->next, state->next + 256, UNSET);
+
+    data.dfaStates.push_back(state);
+    data.dfaIndex[pcs] = data.dfaStates.size() - 1;
+    return data.dfaStates.size() - 1;
+  }
+
+  /**
+   * Computes the DFA state following the given one on ch. Since the search is
+   * unanchored, a match may also begin anew after ch.
+   */
+  static unsigned dfaTransition(NativeRegexData& data, unsigned from,
+                                wchar_t ch) {
+    vector<unsigned> pcs;
+    dfaNewGeneration(data);
+    const vector<unsigned>& fromPcs(data.dfaStates[from]->pcs);
+    for (unsigned i = 0; i < fromPcs.size(); ++i)
+      if (instMatches(data, data.prog[fromPcs[i]], ch))
+        dfaFollow(data, pcs, fromPcs[i]+1);
+    dfaFollow(data, pcs, 0);
+
+    bool flushed = false;
+    unsigned to = dfaState(data, pcs, flushed);
+    if (!flushed) {
+      DfaState* state = data.dfaStates[from];
+      if ((unsigned)ch < 256)
+        state->next[ch] = to;
+      else if (state->wideNext.size() < MAX_DFA_WIDE_TRANSITIONS)
+        state->wideNext[ch] = to;
+    }
+    return to;
+  }
+
+  /**
+   * Runs the DFA over the input from the given offset. Returns false only if
+   * no match can begin at or after it.
+   */
+  static bool dfaMayMatch(NativeRegexData& data, unsigned from) {
+    if (data.dfaUseless) return true;
+
+    if (data.dfaStart == UNSET) {
+      vector<unsigned> pcs;
+      bool flushed = false;
+      dfaNewGeneration(data);
+      dfaFollow(data, pcs, 0);
+      data.dfaStart = dfaState(data, pcs, flushed);
+      if (data.dfaStates[data.dfaStart]->accepting) {
+        data.dfaUseless = true;
+        data.clearDfa();
+        return true;
+      }
+    }
+
+    unsigned state = data.dfaStart;
+    for (unsigned pos = from; pos < data.input.size(); ++pos) {
+      wchar_t ch = data.input[pos];
+      unsigned next;
+      if ((unsigned)ch < 256) {
+        next = data.dfaStates[state]->next[ch];
+      } else {
+        map<wchar_t,unsigned>::const_iterator it =
+          data.dfaStates[state]->wideNext.find(ch);
+        next = (it == data.dfaStates[state]->wideNext.end()?
+                UNSET : it->second);
+      }
+
+      if (next == UNSET)
+        next = dfaTransition(data, state, ch);
+      state = next;
+      if (data.dfaStates[state]->accepting)
+        return true;
+    }
+
+    return false;
+  }
+
+  bool NativeRegex::match(unsigned from) {
+    if (!data.valid) return false;
+    data.matched = false;
+    if (from < data.inputOffset) from = data.inputOffset;
+    if (!dfaMayMatch(data, from))
+      return false;
+
+    const wstring& s(data.input);
+    const unsigned ncap = data.ncap;
+    ThreadList* curr = &data.lists[0], * next = &data.lists[1];
+    curr->clear();
+    next->clear();
+
+    for (unsigned pos = from; ; ++pos) {
+      //Threads started earlier have priority over a new one here
+      if (!data.matched) {
+        fill(data.threadCaps.begin(), data.threadCaps.end(), UNSET);
+        addThread(data, *curr, 0, &data.threadCaps[0], pos);
+      }
+
+      if (curr->threads.empty()) {
+        if (data.matched || pos >= s.size()) break;
+        curr->clear();
+        continue;
+      }
+
+      bool atEnd = pos >= s.size();
+      wchar_t ch = atEnd? 0 : s[pos];
+      for (unsigned t = 0; t < curr->threads.size(); ++t) {
+        const Inst& inst(data.prog[curr->threads[t]]);
+        unsigned* cap = &curr->caps[t*ncap];
+        if (inst.op == OpMatch) {
+          //Empty matches are never reported, since repeated matching would
+          //not advance
+          if (cap[0] == pos) continue;
+
+          data.caps.assign(cap, cap + ncap);
+          data.matched = true;
+          //Threads of lower priority can no longer win
+          break;
+        }
+
+        if (!atEnd && instMatches(data, inst, ch))
+          addThread(data, *next, curr->threads[t]+1, cap, pos+1);
+      }
+
+      if (atEnd) break;
+      swap(curr, next);
+      next->clear();
+    }
+
+    if (!data.matched) return false;
+
+    data.headBegin = data.inputOffset;
+    data.headEnd = data.caps[0];
+    data.inputOffset = data.caps[1];
+    return true;
+  }
+
+  unsigned NativeRegex::groupCount() const {
+    if (!data.matched) return 0;
+
+    //Groups are numbered by position within the pattern, so some might not
+    //have matched; find the last one which did.
+    unsigned last = 0;
+    for (unsigned i = 0; i < MAX_MATCHES && i < data.groups; ++i)
+      if (data.caps[i*2] != UNSET)
+        last = i;
+
+    return last+1;
+  }
+
+  const wstring& NativeRegex::subject() const {
+    return data.input;
+  }
+
+  bool NativeRegex::groupSpan(unsigned& begin, unsigned& end,
+                              unsigned ix) const {
+    if (!data.matched || ix >= data.groups ||
+        data.caps[ix*2] == UNSET || data.caps[ix*2+1] == UNSET)
+      return false;
+
+    begin = data.caps[ix*2];
+    end = data.caps[ix*2+1];
+    return true;
+  }
+
+  void NativeRegex::headSpan(unsigned& begin, unsigned& end) const {
+    begin = data.headBegin;
+    end = data.headEnd;
+  }
+
+  unsigned NativeRegex::tailOffset() const {
+    return data.inputOffset;
+  }
+}
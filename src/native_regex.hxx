@@ -0,0 +1,59 @@
+#ifndef NATIVE_REGEX_HXX_
+#define NATIVE_REGEX_HXX_
+
+#include <string>
+
+#include "slice.hxx"
+
+namespace tglng {
+  ///Internally used by NativeRegex
+  struct NativeRegexData;
+
+  /**
+   * A regular expression engine built into TglNG, which works directly on
+   * wide strings and never backtracks: patterns are compiled to an NFA, which
+   * is simulated for all possible paths at once (a "Pike VM"), so matching
+   * takes time linear in the length of the input for any pattern. A DFA built
+   * lazily from the same NFA quickly rejects inputs which cannot match.
+   *
+   * The syntax is a subset of that of PCRE, with the same leftmost-first
+   * semantics: literals and escapes, ., character classes (including POSIX
+   * [:name:] classes), \d \w \s and their negations, ^ $ \A \z \b \B,
+   * capturing, non-capturing and named groups, alternation, and the greedy
+   * and lazy forms of * + ? and {n,m}. Backreferences and lookaround, which
+   * cannot be matched in linear time, are rejected when compiling.
+   *
+   * The interface is that of Regex, which uses this class either as its
+   * backend or for patterns with the `n' option.
+   */
+  class NativeRegex {
+    NativeRegexData& data;
+
+    NativeRegex(const NativeRegex&);
+
+  public:
+    NativeRegex(const std::wstring& pattern, const std::wstring& options);
+    ~NativeRegex();
+
+    operator bool() const;
+    void showWhy() const;
+    unsigned where() const;
+
+    void input(const Slice&);
+    void releaseInput();
+    /**
+     * Like Regex::match(), but begins searching at the given offset, which
+     * must not be before tailOffset(). The text before it is still visible to
+     * assertions, and is still reported by headSpan().
+     */
+    bool match(unsigned from);
+
+    unsigned groupCount() const;
+    const std::wstring& subject() const;
+    bool groupSpan(unsigned& begin, unsigned& end, unsigned ix) const;
+    void headSpan(unsigned& begin, unsigned& end) const;
+    unsigned tailOffset() const;
+  };
+}
+
+#endif /* NATIVE_REGEX_HXX_ */
@@ -10,7 +10,10 @@ namespace tglng {
   std::list<std::string> userConfigs;
   bool enableSystemConfig = true;
   std::list<std::string> scriptInputs;
-  std::map<wchar_t,std::wstring> initialRegisters;
+  std::map<wchar_t,CompactString> initialRegisters;
   bool dryRun = false;
   bool locateParseError = false;
+  unsigned long commandLimit = 0;
+  unsigned long memoryLimit = 0;
+  unsigned long timeLimit = 0;
 }
@@ -5,15 +5,31 @@
 #include <list>
 #include <map>
 
+#include "common.hxx"
+
 namespace tglng {
   extern std::string operationalFile;
   extern bool implicitChdir;
   extern std::list<std::string> userConfigs;
   extern bool enableSystemConfig;
   extern std::list<std::string> scriptInputs;
-  extern std::map<wchar_t,std::wstring> initialRegisters;
+  extern std::map<wchar_t,CompactString> initialRegisters;
   extern bool dryRun;
   extern bool locateParseError;
+  /**
+   * The maximum number of commands which may be executed in one run, or zero
+   * for no limit.
+   */
+  extern unsigned long commandLimit;
+  /**
+   * The maximum number of bytes of string data which may be live in
+   * registers and command outputs at once, or zero for no limit.
+   */
+  extern unsigned long memoryLimit;
+  /**
+   * The maximum wall time, in seconds, a run may take, or zero for no limit.
+   */
+  extern unsigned long timeLimit;
 }
 
 #endif /* OPTIONS_HXX_ */
@@ -7,20 +7,38 @@
 #include <iostream>
 #include <sstream>
 #include <vector>
+#include <map>
+#include <clocale>
+#include <cwchar>
 
 //Include available regex headers
 #ifdef HAVE_PCRE_H
 #include <pcre.h>
 #endif
+#ifdef HAVE_PCRE2_H
+#define PCRE2_CODE_UNIT_WIDTH 32
+#include <pcre2.h>
+#endif
 #ifdef HAVE_REGEX_H
 #include <regex.h>
 #endif
 
 #include "regex.hxx"
+#include "native_regex.hxx"
+#include "thread.hxx"
+#include "common.hxx"
 
 //Determine support level.
 //First check for specific requests from the configuration.
-#if defined(FORCE_REGEX_PCRE16)
+#if defined(FORCE_REGEX_PCRE32)
+#  if defined(HAVE_PCRE2_H) && defined(HAVE_PCRE2_32) && WCHAR_MAX > 0xFFFF
+#    define TGLNG_REGEX_LEVEL TGLNG_REGEX_PCRE32
+#  elif !defined(HAVE_PCRE2_H) || !defined(HAVE_PCRE2_32)
+#    error Configuration forces REGEX_PCRE32, but you do not have 32-bit PCRE2
+#  else
+#    error Configuration forces REGEX_PCRE32, but wchar_t is not 32 bits
+#  endif
+#elif defined(FORCE_REGEX_PCRE16)
 #  if defined(HAVE_PCRE_H) && defined(PCRE_SUPPORTS_16_BIT)
 #    define TGLNG_REGEX_LEVEL TGLNG_REGEX_PCRE16
 #  elif !defined(HAVE_PCRE_H)
@@ -40,9 +58,13 @@
 #  else
 #    error Configuration forces REGEX_POSIX, but your system does not have it
 #  endif
+#elif defined(FORCE_REGEX_NATIVE)
+#  define TGLNG_REGEX_LEVEL TGLNG_REGEX_NATIVE
 #elif defined(FORCE_REGEX_NONE)
 #  define TGLNG_REGEX_LEVEL TGLNG_REGEX_NONE
 //Not forced, determine automatically
+#elif defined(HAVE_PCRE2_H) && defined(HAVE_PCRE2_32) && WCHAR_MAX > 0xFFFF
+#  define TGLNG_REGEX_LEVEL TGLNG_REGEX_PCRE32
 #elif defined(HAVE_PCRE_H) && defined(PCRE_SUPPORTS_16_BIT)
 #  define TGLNG_REGEX_LEVEL TGLNG_REGEX_PCRE16
 #elif defined(HAVE_PCRE_H)
@@ -50,7 +72,7 @@
 #elif defined(HAVE_REGEX_H)
 #  define TGLNG_REGEX_LEVEL TGLNG_REGEX_POSIX
 #else
-#  define TGLNG_REGEX_LEVEL TGLNG_REGEX_NONE
+#  define TGLNG_REGEX_LEVEL TGLNG_REGEX_NATIVE
 #endif
 
 using namespace std;
@@ -65,52 +87,131 @@ namespace tglng {
   const wstring regexLevelName(L"PCRE8");
 #elif TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE16
   const wstring regexLevelName(L"PCRE16");
+#elif TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE32
+  const wstring regexLevelName(L"PCRE32");
+#elif TGLNG_REGEX_LEVEL == TGLNG_REGEX_NATIVE
+  const wstring regexLevelName(L"NATIVE");
 #endif
 
   //Functions to convert natvie wstrings to the type needed by the backend.
+  //PCRE32 matches wstrings directly.
 #if TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE16
   typedef vector<PCRE_UCHAR16> rstring;
-  static void convertString(rstring& dst, const wstring& src) {
-    dst.resize(src.size()+1);
-    for (unsigned i = 0; i < src.size(); ++i)
+  static void convertString(rstring& dst, const Slice& src) {
+    dst.resize(src.size+1);
+    for (unsigned i = 0; i < src.size; ++i)
       if (src[i] <= 0xFFFF)
         dst[i] = src[i];
       else
         dst[i] = 0x001A;
 
-    dst[src.size()] = 0;
+    dst[src.size] = 0;
   }
 #elif TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE8 || \
       TGLNG_REGEX_LEVEL == TGLNG_REGEX_POSIX
   typedef vector<char> rstring;
-  static void convertString(rstring& dst, const wstring& src) {
-    dst.resize(src.size()+1);
-    for (unsigned i = 0; i < src.size(); ++i)
+  static void convertString(rstring& dst, const Slice& src) {
+    dst.resize(src.size+1);
+    for (unsigned i = 0; i < src.size; ++i)
       if (src[i] <= 0xFF)
         dst[i] = (src[i] & 0xFF);
       else
         dst[i] = 0x1A;
-    dst[src.size()] = 0;
+    dst[src.size] = 0;
   }
 #endif
 
-#if TGLNG_REGEX_LEVEL == TGLNG_REGEX_NONE
-  //Null implementation; always fails at everything
-  Regex::Regex(const wstring&, const wstring&)
-  : data(*(RegexData*)NULL) {}
-  Regex::~Regex() {}
-  Regex::operator bool() const { return false; }
-  void Regex::showWhy() const {
+  /**
+   * Incremented by regexLocaleChanged(). Cached regexes and character tables
+   * belong to the generation they were created in.
+   */
+  static AtomicCounter localeGeneration;
+
+  void regexLocaleChanged() {
+    localeGeneration.add(1);
+  }
+
+  static unsigned currentLocaleGeneration() {
+    return localeGeneration.get();
+  }
+
+#if TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE8 ||  \
+    TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE16 || \
+    TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE32
+  /* By default, PCRE only classifies characters based on ASCII (some builds
+   * may instead automatically rebuild the tables according to the "C" locale
+   * (why not the system locale?), but we can't count on that.
+   *
+   * A table is generated for each C locale (by setlocale(LC_ALL,NULL)) the
+   * first time a regex is compiled under it, and kept for the life of the
+   * process, since compiled regexes refer to it. The current locale is only
+   * looked at again once regexLocaleChanged() has been called.
+   */
+  static map<string,const unsigned char*> pcreTables;
+  static const unsigned char* localPcreTable(NULL);
+  static unsigned localPcreTableGeneration(~0u);
+  //Guards the above
+  static Mutex pcreTableMutex;
+
+  /**
+   * Returns the character table for the current locale, generating it with
+   * maketables if this is the first time the locale has been used.
+   */
+  static const unsigned char* currentPcreTable(
+    const unsigned char* (*maketables)()
+  ) {
+    unsigned generation = currentLocaleGeneration();
+    MutexLock lock(pcreTableMutex);
+    if (localPcreTableGeneration != generation) {
+      const unsigned char*& entry(pcreTables[setlocale(LC_ALL, NULL)]);
+      if (!entry)
+        entry = maketables();
+      localPcreTable = entry;
+      localPcreTableGeneration = generation;
+    }
+    return localPcreTable;
+  }
+#endif
+
+#if TGLNG_REGEX_LEVEL == TGLNG_REGEX_NONE || \
+    TGLNG_REGEX_LEVEL == TGLNG_REGEX_NATIVE
+  /* Null backend; always fails at everything. With the native level, it is
+   * never actually used.
+   */
+  struct RegexData {};
+
+  static RegexData* backendCompile(const wstring&, const wstring&) {
+    return new RegexData;
+  }
+  static void backendFree(RegexData& data) { delete &data; }
+  static bool backendValid(const RegexData&) { return false; }
+  static void backendShowWhy(const RegexData&) {
     wcerr << L"regular expressions not supported in this build." << endl;
   }
-  void Regex::input(const wstring&) {}
-  bool Regex::match() { return false; }
-  unsigned Regex::groupCount() const { return 0; }
-  void Regex::group(wstring&, unsigned) const {}
-  void Regex::tail(wstring&) const {}
-  void Regex::head(wstring&) const {}
-  unsigned Regex::where() const { return 0; }
-#endif /* NONE */
+  static void backendInput(RegexData&, const Slice&) {}
+  static void backendReleaseInput(RegexData&) {}
+  static bool backendMatch(RegexData&, unsigned) { return false; }
+  static unsigned backendGroupCount(const RegexData&) { return 0; }
+  static const wstring& backendSubject(const RegexData&) {
+    static const wstring empty;
+    return empty;
+  }
+  static bool backendGroupSpan(const RegexData&,
+                               unsigned&, unsigned&, unsigned) {
+    return false;
+  }
+  static void backendHeadSpan(const RegexData&,
+                              unsigned& begin, unsigned& end) {
+    begin = end = 0;
+  }
+  static unsigned backendTailOffset(const RegexData&) { return 0; }
+  static unsigned backendWhere(const RegexData&) { return 0; }
+  static void backendOptimise(RegexData&) {}
+  bool regexJit() { return false; }
+
+  static const unsigned long backendMaxChar = WCHAR_MAX;
+  static const bool backendKeepsContext = true;
+#endif /* NONE, NATIVE */
 
 #if TGLNG_REGEX_LEVEL == TGLNG_REGEX_POSIX
   //POSIX.1-2001 implementation
@@ -125,9 +226,9 @@ namespace tglng {
     regmatch_t matches[MAX_MATCHES];
   };
 
-  Regex::Regex(const wstring& pattern, const wstring& options)
-  : data(*new RegexData)
-  {
+  static RegexData* backendCompile(const wstring& pattern,
+                                   const wstring& options) {
+    RegexData& data(*new RegexData);
     rstring rpattern;
     convertString(rpattern, pattern);
 
@@ -150,38 +251,46 @@ namespace tglng {
       data.why.resize(regerror(data.status, &data.rx, NULL, 0));
       regerror(data.status, &data.rx, &data.why[0], data.why.size());
     }
+
+    return &data;
   }
 
-  Regex::~Regex() {
+  static void backendFree(RegexData& data) {
     if (data.status == 0)
       regfree(&data.rx);
     delete &data;
   }
 
-  Regex::operator bool() const {
+  static bool backendValid(const RegexData& data) {
     return !data.status;
   }
 
-  void Regex::showWhy() const {
+  static void backendShowWhy(const RegexData& data) {
     wcerr << "POSIX extended regular expression: "
           << &data.why[0] << endl;
   }
 
-  void Regex::input(const std::wstring& str) {
+  static void backendInput(RegexData& data, const Slice& str) {
     convertString(data.input, str);
-    data.inputOffset = 0;
-    data.rawInput = str;
+    data.inputOffset = data.headBegin = data.headEnd = 0;
+    str.assignTo(data.rawInput);
   }
 
-  bool Regex::match() {
+  static void backendReleaseInput(RegexData& data) {
+    backendInput(data, Slice());
+    releaseStorage(data.input);
+    releaseStorage(data.rawInput);
+  }
+
+  static bool backendMatch(RegexData& data, unsigned from) {
     //Manually fail the empty string
-    if (data.inputOffset >= data.input.size()) {
+    if (from >= data.input.size()) {
       data.status = 0;
       memset(data.matches, -1, sizeof(data.matches));
       return false;
     }
 
-    data.status = regexec(&data.rx, &data.input[data.inputOffset],
+    data.status = regexec(&data.rx, &data.input[from],
                           MAX_MATCHES,
                           data.matches, 0);
     if (data.status == REG_NOMATCH) {
@@ -202,8 +311,8 @@ namespace tglng {
     //Add offset to all matches
     for (unsigned i = 0; i < MAX_MATCHES; ++i) {
       if (data.matches[i].rm_so != -1) {
-        data.matches[i].rm_so += data.inputOffset;
-        data.matches[i].rm_eo += data.inputOffset;
+        data.matches[i].rm_so += from;
+        data.matches[i].rm_eo += from;
       }
     }
 
@@ -217,7 +326,7 @@ namespace tglng {
     return -1 != data.matches[0].rm_eo;
   }
 
-  unsigned Regex::groupCount() const {
+  static unsigned backendGroupCount(const RegexData& data) {
     //Elements in the middle may be unmatched if that particular group was
     //excluded, so search for the last group.
     unsigned last = ~0;
@@ -228,28 +337,45 @@ namespace tglng {
     return last+1;
   }
 
-  void Regex::group(wstring& dst, unsigned ix) const {
+  static const wstring& backendSubject(const RegexData& data) {
+    return data.rawInput;
+  }
+
+  static bool backendGroupSpan(const RegexData& data,
+                               unsigned& begin, unsigned& end, unsigned ix) {
     //Indices may be negative if this group didn't match
-    if (data.matches[ix].rm_so == -1)
-      dst.clear();
-    else
-      dst.assign(data.rawInput, data.matches[ix].rm_so,
-                 data.matches[ix].rm_eo - data.matches[ix].rm_so);
+    if (ix >= MAX_MATCHES || data.matches[ix].rm_so == -1)
+      return false;
+
+    begin = data.matches[ix].rm_so;
+    end = data.matches[ix].rm_eo;
+    return true;
   }
 
-  void Regex::tail(wstring& dst) const {
-    dst.assign(data.rawInput, data.inputOffset,
-               data.rawInput.size() - data.inputOffset);
+  static void backendHeadSpan(const RegexData& data,
+                              unsigned& begin, unsigned& end) {
+    begin = data.headBegin;
+    end = data.headEnd;
   }
 
-  void Regex::head(wstring& dst) const {
-    dst.assign(data.rawInput, data.headBegin,
-               data.headEnd - data.headBegin);
+  static unsigned backendTailOffset(const RegexData& data) {
+    return data.inputOffset;
   }
 
-  unsigned Regex::where() const {
+  static unsigned backendWhere(const RegexData&) {
     return 0;
   }
+
+  static void backendOptimise(RegexData&) {}
+
+  bool regexJit() {
+    return false;
+  }
+
+  static const unsigned long backendMaxChar = 0xFF;
+  //regexec() only sees the text from where the search begins, so ^ and the
+  //GNU word operators would match differently if it began any later
+  static const bool backendKeepsContext = false;
 #endif /* POSIX */
 
 #if TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE8 ||   \
@@ -260,26 +386,86 @@ namespace tglng {
 #    define pcreN_exec       pcre_exec
 #    define pcreN_free       pcre_free
 #    define pcreN_maketables pcre_maketables
+#    define pcreN_extra      pcre_extra
+#    define pcreN_study      pcre_study
+#    define pcreN_free_study pcre_free_study
+#    define pcreN_config     pcre_config
+#    define pcreN_jit_stack        pcre_jit_stack
+#    define pcreN_jit_stack_alloc  pcre_jit_stack_alloc
+#    define pcreN_jit_stack_free   pcre_jit_stack_free
+#    define pcreN_assign_jit_stack pcre_assign_jit_stack
 #  else
 #    define pcreN pcre16
 #    define pcreN_compile    pcre16_compile
 #    define pcreN_exec       pcre16_exec
 #    define pcreN_free       pcre16_free
 #    define pcreN_maketables pcre16_maketables
+#    define pcreN_extra      pcre16_extra
+#    define pcreN_study      pcre16_study
+#    define pcreN_free_study pcre16_free_study
+#    define pcreN_config     pcre16_config
+#    define pcreN_jit_stack        pcre16_jit_stack
+#    define pcreN_jit_stack_alloc  pcre16_jit_stack_alloc
+#    define pcreN_jit_stack_free   pcre16_jit_stack_free
+#    define pcreN_assign_jit_stack pcre16_assign_jit_stack
 #  endif
 
-  /* By default, PCRE only classifies characters based on ASCII (some builds
-   * may instead automatically rebuild the tables according to the "C" locale
-   * (why not the system locale?), but we can't count on that.
-   *
-   * Whenever the current C locale (by setlocale(LC_ALL,NULL)) differs from the
-   * lastPcreTableLocale, generate a new table.
+  /* JIT compilation was added in PCRE 8.20, along with pcre_free_study().
+   * Earlier versions can still study patterns, the result of which is freed
+   * like anything else.
    */
-  static string lastPcreTableLocale("C");
-  static const unsigned char* localPcreTable(NULL);
+#  ifdef PCRE_STUDY_JIT_COMPILE
+#    define TGLNG_PCRE_STUDY_FLAGS PCRE_STUDY_JIT_COMPILE
+#  else
+#    define TGLNG_PCRE_STUDY_FLAGS 0
+#    undef pcreN_free_study
+#    define pcreN_free_study pcreN_free
+#  endif
+
+#  ifdef PCRE_STUDY_JIT_COMPILE
+  /* By default, JIT-compiled patterns run on 32K of the machine stack, which
+   * patterns that backtrack a lot soon exhaust. Each thread instead gets a
+   * JIT stack of its own (a JIT stack can only be used by one match at a
+   * time), allocated the first time it is needed. Should even that run out,
+   * backendMatch() falls back to the interpreter.
+   */
+  static const int PCRE_JIT_STACK_MIN = 32*1024;
+  static const int PCRE_JIT_STACK_MAX = 4*1024*1024;
+
+  namespace {
+    struct PcreJitStack {
+      pcreN_jit_stack* stack;
+
+      PcreJitStack() : stack(NULL) {}
+      ~PcreJitStack() {
+        if (stack) pcreN_jit_stack_free(stack);
+      }
+    };
+    ThreadLocal<PcreJitStack> pcreJitStack;
+  }
+
+  /**
+   * Callback for pcre_assign_jit_stack(). Returns the JIT stack of the
+   * current thread, or NULL (meaning the default stack) if it cannot be
+   * allocated.
+   */
+  static pcreN_jit_stack* currentPcreJitStack(void*) {
+    PcreJitStack& jit(pcreJitStack.get());
+    if (!jit.stack)
+      jit.stack = pcreN_jit_stack_alloc(PCRE_JIT_STACK_MIN,
+                                        PCRE_JIT_STACK_MAX);
+    return jit.stack;
+  }
+#  endif
 
   struct RegexData {
     pcreN* rx;
+    //Result of studying rx, possibly NULL even after studying
+    pcreN_extra* extra;
+    bool studied;
+    //Whether the last match failed with an error rather than just not
+    //matching; cleared by new input
+    bool matchFailed;
     unsigned errorOffset;
     /* We want ten matches. Each match takes two entries. Additionally, PCRE
      * requires that we allocate an extra entry at the end for each match.
@@ -292,12 +478,15 @@ namespace tglng {
     string errorMessage;
   };
 
-  Regex::Regex(const wstring& pattern, const wstring& options)
-  : data(*new RegexData)
-  {
+  static RegexData* backendCompile(const wstring& pattern,
+                                   const wstring& options) {
+    RegexData& data(*new RegexData);
     rstring rpattern;
     const char* errorMessage = NULL;
     data.errorOffset = 0;
+    data.extra = NULL;
+    data.studied = false;
+    data.matchFailed = false;
     convertString(rpattern, pattern);
 
     //Parse the options
@@ -319,64 +508,117 @@ namespace tglng {
         break;
       }
 
-    //Generate a table if necessary
-    if (lastPcreTableLocale != setlocale(LC_ALL, NULL)) {
-      lastPcreTableLocale = setlocale(LC_ALL, NULL);
-      if (localPcreTable)
-        pcreN_free(const_cast<void*>(static_cast<const void*>(localPcreTable)));
-      localPcreTable = pcreN_maketables();
-    }
-
     data.rx = pcreN_compile(&rpattern[0], flags, &errorMessage,
-                            (int*)&data.errorOffset, localPcreTable);
+                            (int*)&data.errorOffset,
+                            currentPcreTable(pcreN_maketables));
     if (!data.rx)
       data.errorMessage = errorMessage;
+
+    return &data;
   }
 
-  Regex::~Regex() {
+  /**
+   * Frees the compiled pattern, if any, so that backendValid() returns
+   * false.
+   */
+  static void freePattern(RegexData& data) {
+    if (data.extra)
+      pcreN_free_study(data.extra);
     if (data.rx)
       pcreN_free(data.rx);
+    data.extra = NULL;
+    data.rx = NULL;
+  }
+
+  static void backendFree(RegexData& data) {
+    freePattern(data);
     delete &data;
   }
 
-  Regex::operator bool() const {
-    return !!data.rx;
+  static void backendOptimise(RegexData& data) {
+    if (!data.rx || data.studied) return;
+
+    //Failure only means that matching will be no faster, so any error message
+    //is ignored
+    const char* errorMessage = NULL;
+    data.extra = pcreN_study(data.rx, TGLNG_PCRE_STUDY_FLAGS, &errorMessage);
+    data.studied = true;
+#ifdef PCRE_STUDY_JIT_COMPILE
+    if (data.extra && (data.extra->flags & PCRE_EXTRA_EXECUTABLE_JIT))
+      pcreN_assign_jit_stack(data.extra, currentPcreJitStack, NULL);
+#endif
   }
 
-  void Regex::showWhy() const {
+  bool regexJit() {
+#ifdef PCRE_CONFIG_JIT
+    int jit = 0;
+    return 0 == pcreN_config(PCRE_CONFIG_JIT, &jit) && jit;
+#else
+    return false;
+#endif
+  }
+
+  static bool backendValid(const RegexData& data) {
+    return data.rx && !data.matchFailed;
+  }
+
+  static void backendShowWhy(const RegexData& data) {
     wcerr << L"Perl-Compatible Regular Expression: "
           << data.errorMessage.c_str() << endl;
   }
 
-  void Regex::input(const wstring& str) {
+  static void backendInput(RegexData& data, const Slice& str) {
     convertString(data.input, str);
-    data.rawInput = str;
-    data.inputOffset = 0;
+    str.assignTo(data.rawInput);
+    data.inputOffset = data.headBegin = data.headEnd = 0;
+    data.matchFailed = false;
   }
 
-  bool Regex::match() {
+  static void backendReleaseInput(RegexData& data) {
+    backendInput(data, Slice());
+    releaseStorage(data.input);
+    releaseStorage(data.rawInput);
+  }
+
+  /**
+   * Runs the pattern on the input from the given offset with the given study
+   * data, returning the status from pcre_exec().
+   */
+  static int execPattern(RegexData& data, const pcreN_extra* extra,
+                         unsigned from) {
     //Set all elements to -1
     memset(data.matches, -1, sizeof(data.matches));
-    int status = pcreN_exec(data.rx, NULL,
-                            &data.input[0],
-                            //Subtract one for term NUL
-                            data.input.size() - 1,
-                            data.inputOffset,
-                            PCRE_NOTEMPTY,
-                            data.matches,
-                            sizeof(data.matches)/sizeof(data.matches[0]));
+    return pcreN_exec(data.rx, extra,
+                      &data.input[0],
+                      //Subtract one for term NUL
+                      data.input.size() - 1,
+                      from,
+                      PCRE_NOTEMPTY,
+                      data.matches,
+                      sizeof(data.matches)/sizeof(data.matches[0]));
+  }
+
+  static bool backendMatch(RegexData& data, unsigned from) {
+    int status = execPattern(data, data.extra, from);
+#ifdef PCRE_STUDY_JIT_COMPILE
+    if (status == PCRE_ERROR_JITSTACKLIMIT) {
+      //The interpreter is slower, but not limited by the JIT stack
+      pcreN_extra interpreted(*data.extra);
+      interpreted.flags &= ~PCRE_EXTRA_EXECUTABLE_JIT;
+      status = execPattern(data, &interpreted, from);
+    }
+#endif
     if (status == PCRE_ERROR_NOMATCH) {
       status = 0;
       memset(data.matches, -1, sizeof(data.matches));
     }
     if (status < 0) {
-      //Error (there doesn't seem to be any way to get an error message)
+      //Error (there doesn't seem to be any way to get an error message). The
+      //pattern itself is still fine, so it is kept for the next input.
       ostringstream msg;
-      msg << "Perl-Compatible Regular Expression: error code " << status;
+      msg << "error code " << status;
       data.errorMessage = msg.str();
-      //Free the rx so that operator bool() returns false
-      pcreN_free(data.rx);
-      data.rx = NULL;
+      data.matchFailed = true;
       return false;
     }
 
@@ -395,7 +637,7 @@ namespace tglng {
     }
   }
 
-  unsigned Regex::groupCount() const {
+  static unsigned backendGroupCount(const RegexData& data) {
     //PCRE groups are indexed by occurrance within the pattern, so some groups
     //might not match; find the last matched group.
     unsigned last = 0;
@@ -406,27 +648,833 @@ namespace tglng {
     return last+1;
   }
 
+  static const wstring& backendSubject(const RegexData& data) {
+    return data.rawInput;
+  }
+
+  static bool backendGroupSpan(const RegexData& data,
+                               unsigned& begin, unsigned& end, unsigned ix) {
+    //Some middle groups may be unmatched, indicated by -1
+    if (ix >= MAX_MATCHES || data.matches[ix*2] == -1)
+      return false;
+
+    begin = data.matches[ix*2];
+    end = data.matches[ix*2+1];
+    return true;
+  }
+
+  static void backendHeadSpan(const RegexData& data,
+                              unsigned& begin, unsigned& end) {
+    begin = data.headBegin;
+    end = data.headEnd;
+  }
+
+  static unsigned backendTailOffset(const RegexData& data) {
+    return data.inputOffset;
+  }
+
+  static unsigned backendWhere(const RegexData& data) {
+    return data.errorOffset;
+  }
+
+#if TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE16
+  static const unsigned long backendMaxChar = 0xFFFF;
+#else
+  static const unsigned long backendMaxChar = 0xFF;
+#endif
+  static const bool backendKeepsContext = true;
+#endif /* PCRE* */
+
+#if TGLNG_REGEX_LEVEL == TGLNG_REGEX_PCRE32
+  /* PCRE2 in 32-bit mode works on the wstring itself, so inputs are neither
+   * transcoded nor truncated. Patterns are compiled in UTF mode so that
+   * case-insensitivity and the like work beyond Latin-1.
+   */
+#  ifdef PCRE2_MATCH_INVALID_UTF
+  //Available since 10.34; lets lone surrogates and the like simply not match
+  //instead of failing the whole operation
+#    define TGLNG_PCRE2_UTF (PCRE2_UTF | PCRE2_MATCH_INVALID_UTF)
+#  else
+#    define TGLNG_PCRE2_UTF PCRE2_UTF
+#  endif
+
+  static const unsigned char* makePcre2Tables() {
+    return pcre2_maketables(NULL);
+  }
+
+  static PCRE2_SPTR toPcre2(const wchar_t* str) {
+    return reinterpret_cast<PCRE2_SPTR>(str);
+  }
+
+  /* As with PCRE, JIT-compiled patterns get a JIT stack per thread rather
+   * than the 32K of machine stack they would otherwise run on. PCRE2 takes
+   * the stack through a match context, so each thread has one of those too.
+   */
+  static const size_t PCRE2_JIT_STACK_MIN = 32*1024;
+  static const size_t PCRE2_JIT_STACK_MAX = 4*1024*1024;
+
+  namespace {
+    struct Pcre2MatchContext {
+      pcre2_match_context* context;
+      pcre2_jit_stack* stack;
+
+      Pcre2MatchContext() : context(NULL), stack(NULL) {}
+      ~Pcre2MatchContext() {
+        if (context) pcre2_match_context_free(context);
+        if (stack) pcre2_jit_stack_free(stack);
+      }
+    };
+    ThreadLocal<Pcre2MatchContext> pcre2MatchContext;
+  }
+
+  /**
+   * Returns the match context of the current thread, creating it on first
+   * use. If the JIT stack cannot be allocated, the context leaves JIT
+   * matches on the default stack; if the context itself cannot be, NULL
+   * (the default context) is returned.
+   */
+  static pcre2_match_context* currentPcre2MatchContext() {
+    Pcre2MatchContext& mc(pcre2MatchContext.get());
+    if (!mc.context) {
+      mc.context = pcre2_match_context_create(NULL);
+      if (!mc.context) return NULL;
+
+      mc.stack = pcre2_jit_stack_create(PCRE2_JIT_STACK_MIN,
+                                        PCRE2_JIT_STACK_MAX, NULL);
+      if (mc.stack)
+        pcre2_jit_stack_assign(mc.context, NULL, mc.stack);
+    }
+
+    return mc.context;
+  }
+
+  struct RegexData {
+    pcre2_code* rx;
+    pcre2_match_data* matchData;
+    bool studied;
+    //Whether the last match failed with an error rather than just not
+    //matching; cleared by new input
+    bool matchFailed;
+    unsigned errorOffset;
+#define MAX_MATCHES 10
+    wstring input;
+    unsigned inputOffset, headBegin, headEnd;
+    //The number of groups set by the last call to match(), zero if it failed
+    unsigned groups;
+    wstring errorMessage;
+  };
+
+  /**
+   * Sets the error message of the given RegexData to PCRE2's description of
+   * the given error code.
+   */
+  static void setPcre2Error(RegexData& data, int code) {
+    PCRE2_UCHAR buffer[256];
+    int len = pcre2_get_error_message(code, buffer,
+                                      sizeof(buffer)/sizeof(buffer[0]));
+    data.errorMessage.clear();
+    for (int i = 0; i < len; ++i)
+      data.errorMessage += (wchar_t)buffer[i];
+  }
+
+  static RegexData* backendCompile(const wstring& pattern,
+                                   const wstring& options) {
+    RegexData& data(*new RegexData);
+    data.errorOffset = 0;
+    data.matchData = NULL;
+    data.studied = false;
+    data.matchFailed = false;
+    data.groups = 0;
+    data.inputOffset = data.headBegin = data.headEnd = 0;
+
+    pcre2_compile_context* context = pcre2_compile_context_create(NULL);
+    pcre2_set_character_tables(context, currentPcreTable(makePcre2Tables));
+
+    //Parse the options
+    uint32_t flags = PCRE2_DOTALL | PCRE2_DOLLAR_ENDONLY | TGLNG_PCRE2_UTF;
+    for (unsigned i = 0; i < options.size(); ++i)
+      switch (options[i]) {
+      case L'i':
+        flags |= PCRE2_CASELESS;
+        break;
+
+      case L'l':
+        flags &= ~(PCRE2_DOTALL | PCRE2_DOLLAR_ENDONLY);
+        flags |= PCRE2_MULTILINE;
+        pcre2_set_newline(context, PCRE2_NEWLINE_ANYCRLF);
+        break;
+      }
+
+    int errorCode;
+    PCRE2_SIZE errorOffset = 0;
+    data.rx = pcre2_compile(toPcre2(pattern.data()), pattern.size(), flags,
+                            &errorCode, &errorOffset, context);
+    pcre2_compile_context_free(context);
+    if (data.rx) {
+      data.matchData = pcre2_match_data_create(MAX_MATCHES, NULL);
+    } else {
+      data.errorOffset = errorOffset;
+      setPcre2Error(data, errorCode);
+    }
+
+    return &data;
+  }
+
+  /**
+   * Frees the compiled pattern, if any, so that backendValid() returns
+   * false.
+   */
+  static void freePattern(RegexData& data) {
+    if (data.matchData)
+      pcre2_match_data_free(data.matchData);
+    if (data.rx)
+      pcre2_code_free(data.rx);
+    data.matchData = NULL;
+    data.rx = NULL;
+  }
+
+  static void backendFree(RegexData& data) {
+    freePattern(data);
+    delete &data;
+  }
+
+  static bool backendValid(const RegexData& data) {
+    return data.rx && !data.matchFailed;
+  }
+
+  static void backendShowWhy(const RegexData& data) {
+    wcerr << L"Perl-Compatible Regular Expression: "
+          << data.errorMessage << endl;
+  }
+
+  static void backendOptimise(RegexData& data) {
+    if (!data.rx || data.studied) return;
+
+    //On failure, pcre2_match() just continues to use the interpreter
+    pcre2_jit_compile(data.rx, PCRE2_JIT_COMPLETE);
+    data.studied = true;
+  }
+
+  bool regexJit() {
+    uint32_t jit = 0;
+    return 0 == pcre2_config(PCRE2_CONFIG_JIT, &jit) && jit;
+  }
+
+  static void backendInput(RegexData& data, const Slice& str) {
+    str.assignTo(data.input);
+    data.inputOffset = data.headBegin = data.headEnd = 0;
+    data.groups = 0;
+    data.matchFailed = false;
+  }
+
+  static void backendReleaseInput(RegexData& data) {
+    backendInput(data, Slice());
+    releaseStorage(data.input);
+  }
+
+  /**
+   * Runs the pattern on the input from the given offset with the given
+   * extra options, returning the status from pcre2_match().
+   */
+  static int execPattern(RegexData& data, unsigned from, uint32_t options) {
+    return pcre2_match(data.rx, toPcre2(data.input.data()),
+                       data.input.size(), from,
+                       PCRE2_NOTEMPTY | options, data.matchData,
+                       currentPcre2MatchContext());
+  }
+
+  static bool backendMatch(RegexData& data, unsigned from) {
+    int status = execPattern(data, from, 0);
+#ifdef PCRE2_NO_JIT
+    if (status == PCRE2_ERROR_JIT_STACKLIMIT)
+      //The interpreter is slower, but not limited by the JIT stack
+      status = execPattern(data, from, PCRE2_NO_JIT);
+#endif
+    data.groups = 0;
+    if (status == PCRE2_ERROR_NOMATCH)
+      return false;
+    if (status < 0) {
+      //Eg, invalid UTF in the input where PCRE2_MATCH_INVALID_UTF is not
+      //available. The pattern itself is still fine, so it is kept for the
+      //next input.
+      setPcre2Error(data, status);
+      data.matchFailed = true;
+      return false;
+    }
+
+    //The status is one more than the last group set, or zero if there were
+    //more groups than fit
+    data.groups = status? status : MAX_MATCHES;
+
+    //Advance input
+    PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(data.matchData);
+    data.headBegin = data.inputOffset;
+    data.headEnd = ovector[0];
+    data.inputOffset = ovector[1];
+    return true;
+  }
+
+  static unsigned backendGroupCount(const RegexData& data) {
+    return data.groups;
+  }
+
+  static const wstring& backendSubject(const RegexData& data) {
+    return data.input;
+  }
+
+  static bool backendGroupSpan(const RegexData& data,
+                               unsigned& begin, unsigned& end, unsigned ix) {
+    if (ix >= data.groups)
+      return false;
+
+    //Groups in the middle may be unmatched
+    PCRE2_SIZE* ovector = pcre2_get_ovector_pointer(data.matchData);
+    if (ovector[ix*2] == PCRE2_UNSET)
+      return false;
+
+    begin = ovector[ix*2];
+    end = ovector[ix*2+1];
+    return true;
+  }
+
+  static void backendHeadSpan(const RegexData& data,
+                              unsigned& begin, unsigned& end) {
+    begin = data.headBegin;
+    end = data.headEnd;
+  }
+
+  static unsigned backendTailOffset(const RegexData& data) {
+    return data.inputOffset;
+  }
+
+  static unsigned backendWhere(const RegexData& data) {
+    return data.errorOffset;
+  }
+
+  static const unsigned long backendMaxChar = WCHAR_MAX;
+  static const bool backendKeepsContext = true;
+#endif /* PCRE32 */
+
+  /* Required-literal analysis.
+   *
+   * This only understands the syntax that POSIX extended regular expressions,
+   * PCRE and the native engine have in common. Whenever it meets anything
+   * else, it stops, so that nothing is ever wrongly taken to be required.
+   * Widths are upper bounds on the number of characters an item can match.
+   */
+  static const unsigned UNBOUNDED = ~0u;
+
+  static bool oneOf(wchar_t ch, const wchar_t* set) {
+    return ch && wcschr(set, ch);
+  }
+
+  static unsigned addWidth(unsigned a, unsigned b) {
+    //Anything larger than this is as good as unbounded
+    if (a >= (1u << 24) || b >= (1u << 24))
+      return UNBOUNDED;
+    return a+b;
+  }
+
+  static unsigned mulWidth(unsigned width, unsigned count) {
+    if (!width || !count) return 0;
+    if (width >= (1u << 24) || count >= (1u << 24) / width)
+      return UNBOUNDED;
+    return width*count;
+  }
+
+  /**
+   * Advances i past the bracket expression beginning at pattern[i]. Returns
+   * false if it cannot tell where it ends. Backslashes escape the next
+   * character only with escapes, as POSIX treats them as literal.
+   */
+  static bool skipBrackets(const wstring& pattern, unsigned& i, bool escapes) {
+    ++i;
+    if (i < pattern.size() && pattern[i] == L'^') ++i;
+    if (i < pattern.size() && pattern[i] == L']') ++i;
+    while (i < pattern.size()) {
+      wchar_t ch = pattern[i];
+      if (ch == L']') {
+        ++i;
+        return true;
+      } else if (ch == L'\\') {
+        //Without escapes, a class such as [\]a] ends earlier than it would
+        //seem to, so just give up
+        if (!escapes) return false;
+        i += 2;
+      } else if (ch == L'[' && i+1 < pattern.size() &&
+                 oneOf(pattern[i+1], L":.=")) {
+        //[:name:], [.x.] or [=x=]
+        size_t end = pattern.find(pattern[i+1], i+2);
+        if (end == wstring::npos || end+1 >= pattern.size() ||
+            pattern[end+1] != L']')
+          return false;
+        i = end+2;
+      } else {
+        ++i;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Advances i past the group beginning at pattern[i]. Returns false if it
+   * does not end.
+   */
+  static bool skipGroup(const wstring& pattern, unsigned& i, bool escapes) {
+    unsigned depth = 0;
+    while (i < pattern.size()) {
+      wchar_t ch = pattern[i];
+      if (ch == L'\\') {
+        i += 2;
+      } else if (ch == L'[') {
+        if (!skipBrackets(pattern, i, escapes)) return false;
+      } else {
+        ++i;
+        if (ch == L'(')
+          ++depth;
+        else if (ch == L')' && !--depth)
+          return true;
+      }
+    }
+    return false;
+  }
+
+  static bool readNumber(const wstring& pattern, unsigned& i, unsigned& n) {
+    unsigned begin = i;
+    for (n = 0; i < pattern.size() && pattern[i] >= L'0' && pattern[i] <= L'9';
+         ++i)
+      if (n < (1u << 24))
+        n = n*10 + (pattern[i] - L'0');
+    return i != begin;
+  }
+
+  /**
+   * Reads a {n}, {n,} or {n,m} quantifier at pattern[i].
+   */
+  static bool readBraces(const wstring& pattern, unsigned& i,
+                         unsigned& min, unsigned& max) {
+    unsigned j = i+1;
+    if (!readNumber(pattern, j, min)) return false;
+    max = min;
+    if (j < pattern.size() && pattern[j] == L',') {
+      ++j;
+      if (!readNumber(pattern, j, max))
+        max = UNBOUNDED;
+    }
+    if (j >= pattern.size() || pattern[j] != L'}') return false;
+
+    i = j+1;
+    return true;
+  }
+
+  /**
+   * Finds the longest run of literal characters which every match of the
+   * given pattern contains. prefix is set to the greatest number of characters
+   * a match can have before it, or UNBOUNDED. literal is left empty if
+   * nothing is found. Characters beyond maxChar are not used, since the
+   * backend cannot tell them apart.
+   */
+  static void findRequiredLiteral(wstring& literal, unsigned& prefix,
+                                  const wstring& pattern,
+                                  const wstring& options,
+                                  unsigned long maxChar, bool escapes) {
+    literal.clear();
+    prefix = 0;
+
+    //Searching case-insensitively would need every case of the literal
+    if (options.find(L'i') != wstring::npos) return;
+
+    //Any group other than (?:...) might be lookaround, a comment, or an
+    //inline option (such as case-insensitivity), and \Q quotes the rest
+    for (size_t q = pattern.find(L"(?"); q != wstring::npos;
+         q = pattern.find(L"(?", q+1))
+      if (q+2 >= pattern.size() || pattern[q+2] != L':')
+        return;
+    if (pattern.find(L"\\Q") != wstring::npos) return;
+
+    //With an alternative at the top level, no one literal is required
+    for (unsigned i = 0; i < pattern.size(); ) {
+      wchar_t ch = pattern[i];
+      if (ch == L'|') {
+        return;
+      } else if (ch == L'\\') {
+        i += 2;
+      } else if (ch == L'[') {
+        if (!skipBrackets(pattern, i, escapes)) return;
+      } else if (ch == L'(') {
+        if (!skipGroup(pattern, i, escapes)) return;
+      } else {
+        ++i;
+      }
+    }
+
+    wstring run;
+    unsigned runPrefix = 0, width = 0;
+    for (unsigned i = 0; i < pattern.size(); ) {
+      wchar_t ch = pattern[i];
+      unsigned itemWidth = 1;
+      bool isLiteral = false;
+
+      if (ch == L'(') {
+        if (!skipGroup(pattern, i, escapes)) break;
+        itemWidth = UNBOUNDED;
+      } else if (ch == L'[') {
+        if (!skipBrackets(pattern, i, escapes)) break;
+      } else if (ch == L'^' || ch == L'$') {
+        itemWidth = 0;
+        ++i;
+      } else if (ch == L'\\') {
+        if (i+1 >= pattern.size()) break;
+        ch = pattern[i+1];
+        i += 2;
+        //Classes and assertions; the latter are given a width of 1 since
+        //some are literal in POSIX. Other letters may take arguments, as
+        //with \x41, so end the analysis.
+        if ((ch >= L'a' && ch <= L'z') || (ch >= L'A' && ch <= L'Z') ||
+            (ch >= L'0' && ch <= L'9')) {
+          if (!oneOf(ch, L"dDwWsSbBAzZG")) break;
+        } else if (!oneOf(ch, L"<>`'")) {
+          isLiteral = true;
+        }
+      } else if (oneOf(ch, L"*+?{)")) {
+        break;
+      } else {
+        isLiteral = (ch != L'.');
+        ++i;
+      }
+
+      unsigned min = 1, max = 1;
+      bool quantified = false, valid = true;
+      while (i < pattern.size() && oneOf(pattern[i], L"*+?{")) {
+        unsigned qmin, qmax;
+        if (pattern[i] == L'{') {
+          if (!readBraces(pattern, i, qmin, qmax)) {
+            valid = false;
+            break;
+          }
+        } else {
+          qmin = (pattern[i] == L'+');
+          qmax = (pattern[i] == L'?'? 1 : UNBOUNDED);
+          ++i;
+        }
+
+        //A second quantifier makes the first lazy or possessive in PCRE, but
+        //repeats the repetition in POSIX
+        if (quantified) {
+          min = 0;
+          max = UNBOUNDED;
+        } else {
+          min = qmin;
+          max = qmax;
+        }
+        quantified = true;
+      }
+      if (!valid) break;
+
+      if (isLiteral && min && (unsigned long)ch <= maxChar) {
+        if (run.empty()) runPrefix = width;
+        run += ch;
+        //Characters after a repeated one are not at a fixed distance from it
+        if (max != 1) {
+          if (run.size() > literal.size()) {
+            literal = run;
+            prefix = runPrefix;
+          }
+          run.clear();
+        }
+      } else {
+        if (run.size() > literal.size()) {
+          literal = run;
+          prefix = runPrefix;
+        }
+        run.clear();
+      }
+
+      width = addWidth(width, mulWidth(itemWidth, max));
+    }
+
+    if (run.size() > literal.size()) {
+      literal = run;
+      prefix = runPrefix;
+    }
+  }
+
+  /**
+   * Returns whether matching the given POSIX pattern depends on any text
+   * before where the search begins.
+   */
+  static bool dependsOnContext(const wstring& pattern) {
+    for (unsigned i = 0; i < pattern.size(); ++i) {
+      if (pattern[i] == L'^')
+        return true;
+      if (pattern[i] == L'\\' && i+1 < pattern.size() &&
+          oneOf(pattern[++i], L"bB<>`'"))
+        return true;
+    }
+    return false;
+  }
+
+  /**
+   * Chooses the character of literal to search for first, preferring those
+   * likely to be rare in ordinary text.
+   */
+  static unsigned chooseAnchor(const wstring& literal) {
+    unsigned best = 0, bestRarity = 0;
+    for (unsigned i = 0; i < literal.size(); ++i) {
+      wchar_t ch = literal[i];
+      unsigned rarity =
+        (ch == L' ' || ch == L'\t' || ch == L'\n')? 0 :
+        (ch >= L'a' && ch <= L'z')?                 1 :
+        (ch < 0x80 && iswalnum(ch))?                2 : 3;
+      if (rarity > bestRarity) {
+        best = i;
+        bestRarity = rarity;
+      }
+    }
+    return best;
+  }
+
+  /**
+   * Returns the offset of the first occurrence of literal in text at or after
+   * from, or the size of text if there is none. Candidates are found by
+   * looking for the anchor character alone with wmemchr(), which the C
+   * library implements with vector instructions, and only then compared in
+   * full.
+   */
+  static unsigned findLiteral(const wstring& text, unsigned from,
+                              const wstring& literal, unsigned anchor) {
+    if (literal.size() > text.size() || from > text.size() - literal.size())
+      return text.size();
+
+    const wchar_t* base = text.data();
+    const wchar_t* pos = base + from + anchor;
+    const wchar_t* end = base + text.size() - literal.size() + anchor + 1;
+    while (pos < end && (pos = wmemchr(pos, literal[anchor], end - pos))) {
+      const wchar_t* begin = pos - anchor;
+      if (!wmemcmp(begin, literal.data(), literal.size()))
+        return begin - base;
+      ++pos;
+    }
+
+    return text.size();
+  }
+
+  /**
+   * Returns whether a pattern with the given options is to use the native
+   * engine instead of the backend.
+   */
+  static bool useNative(const wstring& options) {
+    return TGLNG_REGEX_LEVEL == TGLNG_REGEX_NATIVE ||
+      options.find(L'n') != wstring::npos;
+  }
+
+  Regex::Regex(const wstring& pattern, const wstring& options)
+  : data(NULL), native(NULL),
+    literalPrefix(0), literalAnchor(0), literalSkip(false),
+    literalNext(~0u)
+  {
+    if (useNative(options))
+      native = new NativeRegex(pattern, options);
+    else
+      data = backendCompile(pattern, options);
+
+    if (!*this) return;
+
+    if (native)
+      findRequiredLiteral(literal, literalPrefix, pattern, options,
+                          WCHAR_MAX, true);
+    else
+      findRequiredLiteral(literal, literalPrefix, pattern, options,
+                          backendMaxChar, regexLevel != TGLNG_REGEX_POSIX);
+
+    literalAnchor = chooseAnchor(literal);
+    literalSkip = literalPrefix != UNBOUNDED &&
+      (native || backendKeepsContext || !dependsOnContext(pattern));
+  }
+
+  Regex::~Regex() {
+    if (native)
+      delete native;
+    else
+      backendFree(*data);
+  }
+
+  Regex::operator bool() const {
+    return native? (bool)*native : backendValid(*data);
+  }
+
+  void Regex::showWhy() const {
+    if (native) native->showWhy();
+    else        backendShowWhy(*data);
+  }
+
+  unsigned Regex::where() const {
+    return native? native->where() : backendWhere(*data);
+  }
+
+  void Regex::optimise() {
+    //The native engine builds its automaton lazily anyway
+    if (!native) backendOptimise(*data);
+  }
+
+  void Regex::input(const Slice& str) {
+    if (native) native->input(str);
+    else        backendInput(*data, str);
+    literalNext = ~0u;
+  }
+
+  void Regex::releaseInput() {
+    if (native) native->releaseInput();
+    else        backendReleaseInput(*data);
+    literalNext = ~0u;
+  }
+
+  /**
+   * Returns the offset at which the search for the next match is to begin,
+   * given that it would otherwise begin at from. This is the end of the
+   * subject if literal no longer occurs, as nothing can then match.
+   */
+  unsigned Regex::prefilter(unsigned from) {
+    const wstring& text(subject());
+    //Still the first occurrence, since from never moves backwards
+    if (literalNext == ~0u || literalNext < from)
+      literalNext = findLiteral(text, from, literal, literalAnchor);
+
+    if (literalNext >= text.size())
+      return text.size();
+    if (literalSkip && literalNext - from > literalPrefix)
+      return literalNext - literalPrefix;
+    return from;
+  }
+
+  bool Regex::match() {
+    unsigned from = tailOffset();
+    if (!literal.empty())
+      from = prefilter(from);
+
+    return native? native->match(from) : backendMatch(*data, from);
+  }
+
+  unsigned Regex::groupCount() const {
+    return native? native->groupCount() : backendGroupCount(*data);
+  }
+
+  const wstring& Regex::subject() const {
+    return native? native->subject() : backendSubject(*data);
+  }
+
+  bool Regex::groupSpan(unsigned& begin, unsigned& end, unsigned ix) const {
+    return native?
+      native->groupSpan(begin, end, ix) :
+      backendGroupSpan(*data, begin, end, ix);
+  }
+
+  void Regex::headSpan(unsigned& begin, unsigned& end) const {
+    if (native) native->headSpan(begin, end);
+    else        backendHeadSpan(*data, begin, end);
+  }
+
+  unsigned Regex::tailOffset() const {
+    return native? native->tailOffset() : backendTailOffset(*data);
+  }
+
   void Regex::group(wstring& dst, unsigned ix) const {
-    //Some middle groups may be unmatched, so return an empty string if -1
-    if (data.matches[ix*2] == -1)
-      dst.clear();
+    unsigned begin, end;
+    if (groupSpan(begin, end, ix))
+      dst.assign(subject(), begin, end - begin);
     else
-      dst.assign(data.rawInput, data.matches[ix*2],
-                 data.matches[ix*2+1] - data.matches[ix*2]);
+      dst.clear();
   }
 
   void Regex::head(wstring& dst) const {
-    dst.assign(data.rawInput, data.headBegin,
-               data.headEnd - data.headBegin);
+    unsigned begin, end;
+    headSpan(begin, end);
+    dst.assign(subject(), begin, end - begin);
   }
 
   void Regex::tail(wstring& dst) const {
-    dst.assign(data.rawInput, data.inputOffset,
-               data.rawInput.size() - data.inputOffset);
+    dst.assign(subject(), tailOffset(), wstring::npos);
   }
 
-  unsigned Regex::where() const {
-    return data.errorOffset;
+  namespace {
+    struct RegexCacheEntry {
+      wstring pattern, options;
+      unsigned generation;
+      Regex* rx;
+    };
+
+    const unsigned REGEX_CACHE_SIZE = 16;
+    /**
+     * Longer patterns are not cached. The memory a compiled regex needs grows
+     * with its pattern, so this bounds the memory held by the cache, which
+     * does not count toward the memory limit.
+     */
+    const unsigned REGEX_CACHE_MAX_PATTERN = 4096;
+    /**
+     * The most recently used regexes of a thread, least recent first.
+     */
+    struct RegexCache {
+      vector<RegexCacheEntry> entries;
+
+      ~RegexCache() {
+        for (unsigned i = 0; i < entries.size(); ++i)
+          delete entries[i].rx;
+      }
+    };
+    ThreadLocal<RegexCache> regexCache;
+  }
+
+  CachedRegex::CachedRegex(const wstring& pattern_, const wstring& options_)
+  : rx(NULL), pattern(pattern_), options(options_),
+    generation(currentLocaleGeneration())
+  {
+    vector<RegexCacheEntry>& entries(regexCache.get().entries);
+    for (unsigned i = entries.size(); i > 0; --i) {
+      RegexCacheEntry& entry(entries[i-1]);
+      if (entry.generation == generation && entry.pattern == pattern &&
+          entry.options == options) {
+        //Take it out of the cache while in use
+        rx = entry.rx;
+        entries.erase(entries.begin() + (i-1));
+        rx->optimise();
+        return;
+      }
+    }
+
+    rx = new Regex(pattern, options);
+  }
+
+  CachedRegex::~CachedRegex() {
+    //Don't keep the last subject alive along with the regex. This also clears
+    //any error from matching it, which does not affect the pattern.
+    rx->releaseInput();
+
+    if (!*rx || generation != currentLocaleGeneration() ||
+        pattern.size() + options.size() > REGEX_CACHE_MAX_PATTERN) {
+      delete rx;
+      return;
+    }
+
+    vector<RegexCacheEntry>& entries(regexCache.get().entries);
+    //Drop anything compiled under an old locale, as well as the least recently
+    //used entry if the cache is full
+    for (unsigned i = 0; i < entries.size(); )
+      if (entries[i].generation != generation) {
+        delete entries[i].rx;
+        entries.erase(entries.begin() + i);
+      } else {
+        ++i;
+      }
+    if (entries.size() >= REGEX_CACHE_SIZE) {
+      delete entries.front().rx;
+      entries.erase(entries.begin());
+    }
+
+    entries.push_back(RegexCacheEntry());
+    RegexCacheEntry& entry(entries.back());
+    entry.pattern.swap(pattern);
+    entry.options.swap(options);
+    entry.generation = generation;
+    entry.rx = rx;
   }
-#endif /* PCRE* */
 }
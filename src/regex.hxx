@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include "slice.hxx"
+
 namespace tglng {
 ///Indicates that regular expressions are not supported
 #define TGLNG_REGEX_NONE   0
@@ -12,6 +14,10 @@ namespace tglng {
 #define TGLNG_REGEX_PCRE8  2
 ///Indicates that 16-bit PCRE regular expressions are being used
 #define TGLNG_REGEX_PCRE16 3
+///Indicates that 32-bit PCRE2 regular expressions are being used
+#define TGLNG_REGEX_PCRE32 4
+///Indicates that the native engine (see NativeRegex) is being used
+#define TGLNG_REGEX_NATIVE 5
   /**
    * Defined to one of the TGLNG_REGEX_* constants above.
    *
@@ -22,16 +28,45 @@ namespace tglng {
    * Indicates the human-readable name of regexLevel.
    */
   extern const std::wstring regexLevelName;
+  /**
+   * Returns whether Regex::optimise() JIT-compiles patterns in this build and
+   * on this system.
+   */
+  bool regexJit();
 
   ///Internally used by Regex
   struct RegexData;
+  class NativeRegex;
 
   /**
    * Encapsulates the various possible regular expression support levels into
    * one, consistent RAII interface.
+   *
+   * Patterns whose options contain `n' always use the native engine,
+   * regardless of regexLevel.
    */
   class Regex {
-    RegexData& data;
+    //Exactly one of these is non-NULL
+    RegexData* data;
+    NativeRegex* native;
+
+    //A literal which every match contains, found by analysing the pattern, or
+    //empty if there is none; see match()
+    std::wstring literal;
+    //The greatest number of characters a match can have before the literal,
+    //or ~0u if unbounded
+    unsigned literalPrefix;
+    //The index within literal of the character searched for first
+    unsigned literalAnchor;
+    //Whether a search may begin after tailOffset() (up to literalPrefix
+    //characters before the literal) without changing its result
+    bool literalSkip;
+    //The offset of the first occurrence of literal at or after the start of
+    //the last search, the size of the subject if there is none, or ~0u if not
+    //yet searched for
+    unsigned literalNext;
+
+    unsigned prefilter(unsigned from);
 
     Regex();
     Regex(const Regex&);
@@ -50,7 +85,9 @@ namespace tglng {
     /**
      * Returns whether the Regex is currently in a valid state.
      *
-     * This becomes false only in error conditions.
+     * This is false if the pattern could not be compiled, or if the last call
+     * to match() failed with an error (rather than just not matching). In the
+     * latter case, the Regex can still be used on new input.
      */
     operator bool() const;
     inline bool operator!() const { return !(bool)*this; }
@@ -67,14 +104,32 @@ namespace tglng {
     unsigned where() const;
 
     /**
-     * Sets a new input string for this regex.
+     * Prepares the Regex for being matched many times, which takes some time
+     * up-front. With PCRE, this studies the pattern and JIT-compiles it where
+     * supported. Does nothing if not applicable or if already done.
      */
-    void input(const std::wstring&);
+    void optimise();
+
+    /**
+     * Sets a new input string for this regex. The text is copied, so the
+     * Slice need not outlive this call.
+     */
+    void input(const Slice&);
+
+    /**
+     * Equivalent to input() with the empty string, but also frees the memory
+     * held for the previous input.
+     */
+    void releaseInput();
 
     /**
      * Tries to match the current input to the pattern. Successive calls will
      * match against latter parts of the text.
      *
+     * If the pattern has a literal which every match must contain, the text is
+     * first searched for it, so that text which cannot match is skipped
+     * without running the engine over it.
+     *
      * @return Whether the match succeeded
      */
     bool match();
@@ -102,7 +157,65 @@ namespace tglng {
      * This value is undefined after match() has returned false.
      */
     void tail(std::wstring&) const;
+
+    /* The functions below describe the same portions of the input as the
+     * above, but as offsets into subject() rather than copies, so that a
+     * series of matches over a large input costs no more than the portions
+     * actually used.
+     */
+
+    /**
+     * Returns the current input string, as given to input().
+     */
+    const std::wstring& subject() const;
+    /**
+     * Retrieves the offsets of the beginning and end of the group at the
+     * given index. Returns false if that group did not match.
+     */
+    bool groupSpan(unsigned& begin, unsigned& end, unsigned ix) const;
+    /**
+     * Retrieves the offsets of the beginning and end of the portion of the
+     * input which was skipped by the last call to match().
+     */
+    void headSpan(unsigned& begin, unsigned& end) const;
+    /**
+     * Returns the offset of the portion of the input which has not been
+     * matched. After match() returns false without error, this is still the
+     * end of the last successful match (or zero if there was none).
+     */
+    unsigned tailOffset() const;
+  };
+
+  /**
+   * Provides a Regex for the given pattern and options, taken from a
+   * per-thread cache of the most recently used ones so that the pattern is
+   * only compiled if it has not been seen recently. The Regex belongs to this
+   * object alone while it exists, so recursive uses of the same pattern each
+   * get their own. On destruction, it is returned to the cache unless it is in
+   * an error state. A Regex is optimised once it is reused from the cache,
+   * since its pattern then appears to be in repeated use.
+   */
+  class CachedRegex {
+    Regex* rx;
+    std::wstring pattern, options;
+    unsigned generation;
+
+    CachedRegex(const CachedRegex&);
+
+  public:
+    CachedRegex(const std::wstring& pattern, const std::wstring& options);
+    ~CachedRegex();
+
+    Regex* operator->() const { return rx; }
+    Regex& operator*() const { return *rx; }
   };
+
+  /**
+   * Notifies the regex support that the C locale has been changed. Regexes
+   * compiled afterwards classify characters according to the new locale;
+   * cached ones compiled under the old locale are discarded.
+   */
+  void regexLocaleChanged();
 }
 
 #endif /* REGEX_HXX_ */
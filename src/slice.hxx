@@ -0,0 +1,70 @@
+#ifndef SLICE_HXX_
+#define SLICE_HXX_
+
+#include <string>
+
+namespace tglng {
+  /**
+   * A read-only reference to a contiguous range of characters owned by some
+   * other object, usually a substring of a larger std::wstring.
+   *
+   * A Slice does not keep its referent alive; it becomes invalid as soon as
+   * the string it refers to is modified or destroyed.
+   */
+  struct Slice {
+    /**
+     * The first character in the range. Never NULL, but not necessarily
+     * NUL-terminated.
+     */
+    const wchar_t* data;
+    /**
+     * The number of characters in the range.
+     */
+    unsigned size;
+
+    ///Constructs an empty Slice.
+    Slice() : data(L""), size(0) {}
+    ///Constructs a Slice covering the whole of the given string.
+    Slice(const std::wstring& str)
+    : data(str.data()), size(str.size()) {}
+    ///Constructs a Slice covering part of the given string. The range is
+    ///clamped to the bounds of the string.
+    Slice(const std::wstring& str, unsigned off, unsigned len = ~0u)
+    : data(str.data() + (off < str.size()? off : str.size())),
+      size(off < str.size()? (len < str.size() - off? len : str.size() - off)
+                           : 0) {}
+    ///Constructs a Slice over the given raw range.
+    Slice(const wchar_t* data_, unsigned size_)
+    : data(data_), size(size_) {}
+
+    bool empty() const { return !size; }
+    wchar_t operator[](unsigned ix) const { return data[ix]; }
+    const wchar_t* begin() const { return data; }
+    const wchar_t* end() const { return data + size; }
+
+    /**
+     * Returns the part of this Slice starting at off and extending for up to
+     * len characters.
+     */
+    Slice sub(unsigned off, unsigned len = ~0u) const {
+      if (off > size) off = size;
+      if (len > size - off) len = size - off;
+      return Slice(data + off, len);
+    }
+
+    ///Copies the referenced characters into an owned string.
+    std::wstring str() const { return std::wstring(data, size); }
+    ///Replaces the contents of dst with the referenced characters.
+    void assignTo(std::wstring& dst) const { dst.assign(data, size); }
+    ///Appends the referenced characters to dst.
+    void appendTo(std::wstring& dst) const { dst.append(data, size); }
+
+    bool operator==(const Slice& that) const {
+      return size == that.size &&
+        std::wstring::traits_type::compare(data, that.data, size) == 0;
+    }
+    bool operator!=(const Slice& that) const { return !(*this == that); }
+  };
+}
+
+#endif /* SLICE_HXX_ */
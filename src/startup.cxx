@@ -74,7 +74,8 @@ namespace tglng {
     if (!in) return;
 
     if (!interp.exec(discard, in, Interpreter::ParseModeCommand))
-      exit(EXIT_PARSE_ERROR_IN_USER_LIBRARY);
+      exit(interp.limitExceeded()? EXIT_RESOURCE_LIMIT :
+           EXIT_PARSE_ERROR_IN_USER_LIBRARY);
   }
 
   static bool readAuxConfigs(Interpreter& interp,
@@ -118,6 +118,11 @@ static void executePrimaryInput(Interpreter& interp, wistream& in) {
     wstring out;
     bool res = interp.exec(out, root);
 
+    if (!res && interp.limitExceeded()) {
+      interp.error(L"Execution aborted here.", text,
+                   interp.abortTrace.empty()? 0 : interp.abortTrace.back());
+      exit(EXIT_RESOURCE_LIMIT);
+    }
     if (!res) exit(EXIT_EXEC_ERROR_IN_INPUT);
 
     wcout << out;
@@ -128,6 +133,17 @@ static void executePrimaryInput(Interpreter& interp, wistream& in) {
 
 static void printUsage(bool);
 
+static void parseLimit(unsigned long& dst, const char* str, const char* opt) {
+  char* end;
+  errno = 0;
+  dst = strtoul(str, &end, 10);
+  if (!*str || *end || errno || *str == '-') {
+    wcerr << L"Invalid non-negative integer for " << opt << L": "
+          << str << endl;
+    exit(EXIT_INCORRECT_USAGE);
+  }
+}
+
 static void parseCmdlineArgs(unsigned argc, const char*const* argv) {
 #ifdef USE_GETOPT_LONG
   static const struct option long_options[] = {
@@ -140,10 +156,13 @@ static void parseCmdlineArgs(unsigned argc, const char*const* argv) {
     { "register", 1, NULL, 'D' },
     { "dry-run", 0, NULL, 'd' },
     { "locate-parse-error", 0, NULL, 'l' },
+    { "max-commands", 1, NULL, 'N' },
+    { "max-memory", 1, NULL, 'M' },
+    { "max-time", 1, NULL, 'T' },
     {0}
   };
 #endif
-  static const char short_options[] = "hf:Hc:Ce:D:dl";
+  static const char short_options[] = "hf:Hc:Ce:D:dlN:M:T:";
 
   int cmdstat;
   wstring wstr;
@@ -206,6 +225,18 @@ static void parseCmdlineArgs(unsigned argc, const char*const* argv) {
       locateParseError = true;
       break;
 
+    case 'N':
+      parseLimit(commandLimit, optarg, "--max-commands");
+      break;
+
+    case 'M':
+      parseLimit(memoryLimit, optarg, "--max-memory");
+      break;
+
+    case 'T':
+      parseLimit(timeLimit, optarg, "--max-time");
+      break;
+
     default:
       wcerr << L"BUG: Unhandled cmdstat: " << cmdstat << endl;
       abort();
@@ -257,6 +288,16 @@ static void printUsage(bool error) {
     "    the primary input where the error was encountered to standard\n"
     "    output, in addition to writing information about the error to\n"
     "    standard output.\n"
+    "  -N, --max-commands=<count>\n"
+    "    Abort if more than <count> commands are executed in total.\n"
+    "  -M, --max-memory=<bytes>\n"
+    "    Abort if registers and pending command outputs hold more than <bytes>\n"
+    "    bytes of string data at once.\n"
+    "  -T, --max-time=<seconds>\n"
+    "    Abort if execution takes more than <seconds> seconds of wall time.\n"
+    "    Any limit which is zero (the default) is not enforced. If a limit\n"
+    "    is exceeded, the offset within the primary input where execution\n"
+    "    stopped is reported, and TglNG exits with status 5.\n"
     #ifndef USE_GETOPT_LONG
     "\n(Long options are not available on your system.)"
     #endif
@@ -0,0 +1,82 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <vector>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "thread.hxx"
+
+using namespace std;
+
+namespace tglng {
+#ifdef TGLNG_THREADS
+  Mutex::Mutex() { pthread_mutex_init(&mutex, NULL); }
+  Mutex::~Mutex() { pthread_mutex_destroy(&mutex); }
+  void Mutex::lock() { pthread_mutex_lock(&mutex); }
+  void Mutex::unlock() { pthread_mutex_unlock(&mutex); }
+  bool Mutex::tryLock() { return !pthread_mutex_trylock(&mutex); }
+#else
+  Mutex::Mutex() : locked(false) {}
+  Mutex::~Mutex() {}
+  void Mutex::lock() { locked = true; }
+  void Mutex::unlock() { locked = false; }
+  bool Mutex::tryLock() {
+    if (locked) return false;
+    return locked = true;
+  }
+#endif
+
+  unsigned hardwareConcurrency() {
+#if defined(TGLNG_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return n;
+#endif
+    return 1;
+  }
+
+#ifdef TGLNG_THREADS
+  namespace {
+    struct ThreadStart {
+      void (*fun)(void*);
+      void* arg;
+    };
+  }
+
+  extern "C" {
+    static void* threadMain(void* vstart) {
+      ThreadStart* start = (ThreadStart*)vstart;
+      start->fun(start->arg);
+      return NULL;
+    }
+  }
+#endif
+
+  void runParallel(void (*fun)(void*), void*const* args, unsigned count) {
+#ifdef TGLNG_THREADS
+    vector<ThreadStart> starts(count);
+    vector<pthread_t> threads(count);
+    vector<bool> started(count, false);
+    for (unsigned i = 1; i < count; ++i) {
+      starts[i].fun = fun;
+      starts[i].arg = args[i];
+      started[i] = !pthread_create(&threads[i], NULL, threadMain, &starts[i]);
+    }
+
+    if (count) fun(args[0]);
+
+    for (unsigned i = 1; i < count; ++i) {
+      if (started[i])
+        pthread_join(threads[i], NULL);
+      else
+        fun(args[i]);
+    }
+#else
+    for (unsigned i = 0; i < count; ++i)
+      fun(args[i]);
+#endif
+  }
+}
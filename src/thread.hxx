@@ -0,0 +1,167 @@
+#ifndef THREAD_HXX_
+#define THREAD_HXX_
+
+/* Minimal threading support. If the platform has no POSIX threads, everything
+ * here degrades to single-threaded equivalents. config.h must have been
+ * included before this file.
+ */
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PTHREAD_CREATE)
+#define TGLNG_THREADS 1
+#include <pthread.h>
+#endif
+
+namespace tglng {
+  /**
+   * A plain, non-recursive mutual exclusion lock.
+   */
+  class Mutex {
+#ifdef TGLNG_THREADS
+    pthread_mutex_t mutex;
+#else
+    bool locked;
+#endif
+
+    //Not defined
+    Mutex(const Mutex&);
+
+  public:
+    Mutex();
+    ~Mutex();
+
+    void lock();
+    void unlock();
+    /**
+     * Locks the mutex if it is not currently held, by any thread including
+     * the caller. Returns whether the lock was acquired.
+     */
+    bool tryLock();
+  };
+
+  /**
+   * Holds a Mutex for the lifetime of this object.
+   */
+  class MutexLock {
+    Mutex& mutex;
+
+    //Not defined
+    MutexLock(const MutexLock&);
+
+  public:
+    explicit MutexLock(Mutex& m) : mutex(m) { mutex.lock(); }
+    ~MutexLock() { mutex.unlock(); }
+  };
+
+  /**
+   * Tries to acquire a Mutex (see Mutex::tryLock()), holding it for the
+   * lifetime of this object if successful.
+   */
+  class TryMutexLock {
+    Mutex* mutex;
+
+    //Not defined
+    TryMutexLock(const TryMutexLock&);
+
+  public:
+    explicit TryMutexLock(Mutex& m) : mutex(m.tryLock()? &m : NULL) {}
+    ~TryMutexLock() { if (mutex) mutex->unlock(); }
+
+    ///Returns whether the lock was acquired.
+    bool acquired() const { return !!mutex; }
+  };
+
+  /**
+   * An unsigned long which may be read and updated by several threads at
+   * once. This uses the compiler's atomic builtins where available, and a
+   * Mutex otherwise.
+   */
+  class AtomicCounter {
+    unsigned long value;
+#if defined(TGLNG_THREADS) && !defined(HAVE_ATOMIC_BUILTINS)
+    mutable Mutex mutex;
+#endif
+
+    //Not defined
+    AtomicCounter(const AtomicCounter&);
+
+  public:
+    explicit AtomicCounter(unsigned long initial = 0) : value(initial) {}
+
+    ///Returns the current value.
+    unsigned long get() const {
+#if !defined(TGLNG_THREADS)
+      return value;
+#elif defined(HAVE_ATOMIC_BUILTINS)
+      return __atomic_load_n(&value, __ATOMIC_ACQUIRE);
+#else
+      MutexLock lock(mutex);
+      return value;
+#endif
+    }
+
+    /**
+     * Adds delta to the value and returns the result. Since the arithmetic
+     * wraps around, adding the negation of an amount subtracts it.
+     */
+    unsigned long add(unsigned long delta) {
+#if !defined(TGLNG_THREADS)
+      return value += delta;
+#elif defined(HAVE_ATOMIC_BUILTINS)
+      return __atomic_add_fetch(&value, delta, __ATOMIC_SEQ_CST);
+#else
+      MutexLock lock(mutex);
+      return value += delta;
+#endif
+    }
+  };
+
+  /**
+   * Holds a separate, default-constructed instance of T for each thread. The
+   * instance for a thread is created on first use and destroyed when the
+   * thread exits (except for the main thread, whose instance lives until
+   * program exit).
+   */
+  template<typename T>
+  class ThreadLocal {
+#ifdef TGLNG_THREADS
+    pthread_key_t key;
+
+    static void destroy(void* ptr) {
+      delete (T*)ptr;
+    }
+
+  public:
+    ThreadLocal() { pthread_key_create(&key, destroy); }
+
+    T& get() {
+      T* ptr = (T*)pthread_getspecific(key);
+      if (!ptr) {
+        ptr = new T;
+        pthread_setspecific(key, ptr);
+      }
+
+      return *ptr;
+    }
+#else
+    T value;
+
+  public:
+    T& get() { return value; }
+#endif
+  };
+
+  /**
+   * Returns the number of threads worth running in parallel on this system;
+   * always at least 1, and exactly 1 if threads are not supported.
+   */
+  unsigned hardwareConcurrency();
+
+  /**
+   * Calls fun once for each element of args, each call on its own thread, and
+   * returns once all have finished. The first call is made on the calling
+   * thread. If threads are not supported, or a thread cannot be created, the
+   * calls are made in turn on the calling thread instead.
+   */
+  void runParallel(void (*fun)(void*), void*const* args, unsigned count);
+}
+
+#endif /* THREAD_HXX_ */
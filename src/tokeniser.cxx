@@ -3,9 +3,12 @@
 #endif
 
 #include <string>
+#include <iostream>
 
 #include "tokeniser.hxx"
 #include "function.hxx"
+#include "common.hxx"
+#include "thread.hxx"
 
 using namespace std;
 
@@ -19,6 +22,14 @@ namespace tglng {
 
   const Function Tokeniser::defaultInit(2, 1, defaultTokeniserInit);
 
+  bool Tokeniser::isNext(const Function& next, bool exact) {
+    if (exact)
+      return next.matches(2,2) || next.matches(2,3);
+    else
+      return next.compatible(2,2) ||
+        (next.compatible(2,3) && next.inputArity == 3);
+  }
+
   Tokeniser::Tokeniser(Interpreter& interp_,
                        Function finit_,
                        Function fnext_,
@@ -27,7 +38,9 @@ namespace tglng {
   : interp(interp_),
     finit(finit_), fnext(fnext_),
     options(opts), remainder(text),
-    hasInit(false), errorFlag(false)
+    hasInit(false), errorFlag(false), native(false),
+    offsets(fnext.inputArity == 3), offsetNext(dataTokeniserNext(fnext)),
+    trailing(false), offset(0), parallel(false), pendingIx(0)
   { }
 
   Tokeniser::Tokeniser(Interpreter& interp_,
@@ -37,29 +50,128 @@ namespace tglng {
   : interp(interp_),
     finit(defaultInit), fnext(fnext_),
     options(opts), remainder(text),
-    hasInit(false), errorFlag(false)
+    hasInit(false), errorFlag(false), native(false),
+    offsets(fnext.inputArity == 3), offsetNext(dataTokeniserNext(fnext)),
+    trailing(false), offset(0), parallel(false), pendingIx(0)
+  { }
+
+  Tokeniser::Tokeniser(const Tokeniser& that,
+                       Interpreter& interp_,
+                       const wstring& text)
+  : interp(interp_),
+    finit(that.finit), fnext(that.fnext),
+    options(that.options), remainder(text),
+    hasInit(false), errorFlag(false), native(false),
+    offsets(fnext.inputArity == 3), offsetNext(dataTokeniserNext(fnext)),
+    trailing(false), offset(0), parallel(false), pendingIx(0)
   { }
 
   void Tokeniser::reset(const wstring& str) {
-    hasInit = errorFlag = false;
+    hasInit = errorFlag = native = trailing = parallel = false;
+    offset = pendingIx = 0;
+    pending.clear();
     remainder = str;
   }
 
+  /**
+   * If the Functions are the default tokeniser with either the default
+   * preprocessor or defaultInit, performs init natively and returns true.
+   * Otherwise, returns false without doing anything.
+   */
+  bool Tokeniser::initNative() {
+    if (fnext.execBatch != defaultTokeniserBatch)
+      return false;
+
+    bool preprocess = (finit.execView == defaultTokeniserPreprocessor);
+    if (!preprocess && finit.exec != defaultInit.exec)
+      return false;
+
+    //Like any other init, defaultInit replaces the options, with nothing
+    if (!preprocess)
+      options.clear();
+
+    nativeOptions = defaultTokeniserOptions(options, interp);
+    offset = preprocess?
+      defaultTokeniserSkip(remainder, 0, nativeOptions) : 0;
+    native = true;
+    parallel = remainder.size() - offset >= DEFAULT_TOKENISER_PARALLEL_MIN &&
+      hardwareConcurrency() > 1;
+    return true;
+  }
+
+  /**
+   * Implements next() for the offset protocol. The text is kept intact in
+   * remainder; only offset advances.
+   */
+  bool Tokeniser::nextByOffset(wstring& dst) {
+    if (offsetNext) {
+      if (offset < remainder.size()) {
+        offset = offsetNext(dst, remainder, offset, trailing);
+      } else {
+        dst.clear();
+        trailing = false;
+      }
+      return true;
+    }
+
+    wstring offsetStr(intToStr(offset));
+    Slice in[3] = { Slice(remainder), Slice(offsetStr), Slice(options) };
+    wstring out[2];
+    signed nextOffset;
+    if (!fnext.call(out, in, interp)) {
+      errorFlag = true;
+      return false;
+    }
+
+    if (!parseInteger(nextOffset, out[1]) || nextOffset <= (signed)offset) {
+      wcerr << L"tglng: error: Tokeniser returned invalid next offset "
+            << out[1] << L" at offset " << offset << endl;
+      errorFlag = true;
+      return false;
+    }
+
+    offset = (unsigned)nextOffset < remainder.size()?
+      (unsigned)nextOffset : remainder.size();
+    dst.swap(out[0]);
+    return true;
+  }
+
   bool Tokeniser::next(wstring& dst) {
     if (!hasMore()) return false;
 
-    //Get the next
-    wstring in[2], out[2];
-    in[0] = remainder;
-    in[1] = options;
-    if (!fnext.exec(out, in, interp, fnext.parm)) {
+    if (native) {
+      if (pendingIx == pending.size() && parallel &&
+          remainder.size() - offset >= DEFAULT_TOKENISER_PARALLEL_MIN)
+        offset = defaultTokeniserSome(pending, remainder, offset,
+                                      nativeOptions);
+
+      if (pendingIx < pending.size()) {
+        dst.swap(pending[pendingIx++]);
+        if (pendingIx == pending.size()) {
+          pending.clear();
+          pendingIx = 0;
+        }
+      } else {
+        offset = defaultTokeniserNext(dst, remainder, offset, nativeOptions);
+      }
+      return true;
+    }
+
+    if (offsets)
+      return nextByOffset(dst);
+
+    //Get the next. The inputs are only viewed, so the remainder is not copied
+    //for native tokenisers; the new remainder is swapped in afterwards.
+    Slice in[2] = { Slice(remainder), Slice(options) };
+    wstring out[2];
+    if (!fnext.call(out, in, interp)) {
       errorFlag = true;
       return false;
     }
 
     //OK
-    remainder = out[1];
-    dst = out[0];
+    remainder.swap(out[1]);
+    dst.swap(out[0]);
     return true;
   }
 
@@ -68,30 +180,34 @@ namespace tglng {
     if (errorFlag) return false;
 
     //Run init if this hasn't happened yet
-    if (!hasInit) {
-      wstring in[2];
-      in[0] = remainder;
-      in[1] = options;
+    if (!hasInit && initNative()) {
+      hasInit = true;
+    } else if (!hasInit) {
+      Slice in[2] = { Slice(remainder), Slice(options) };
       wstring out[2];
       out[1] = options;
-      if (!finit.exec(out, in, interp, finit.parm)) {
+      if (!finit.call(out, in, interp)) {
         errorFlag = true;
         return false;
       }
 
       hasInit = true;
-      remainder = out[0];
-      options = out[1];
+      remainder.swap(out[0]);
+      options.swap(out[1]);
     }
 
     //Check whether there is anything more.
-    return !remainder.empty();
+    return native || offsets?
+      offset < remainder.size() || pendingIx < pending.size() || trailing :
+      !remainder.empty();
   }
 
   bool Tokeniser::isExhausted() const {
     if (errorFlag) return true; //Can't do anything more
     if (!hasInit) return false; //Don't know
     //Normal conditions
-    return remainder.empty();
+    return native || offsets?
+      offset >= remainder.size() && pendingIx >= pending.size() && !trailing :
+      remainder.empty();
   }
 }
@@ -2,8 +2,11 @@
 #define TOKENISER_HXX_
 
 #include <string>
+#include <vector>
 
 #include "function.hxx"
+#include "cmd/default_tokeniser.hxx"
+#include "cmd/data_tokenisers.hxx"
 
 namespace tglng {
   class Interpreter;
@@ -26,6 +29,22 @@ namespace tglng {
    * next, or was returned by str from init. options is a user-supplied string
    * of ASCII alphanumeric characters. token is the next token. If the output
    * remainder is the empty string, the sequence is considered exhausted.
+   *
+   * Since the remainder is passed back and forth in full, the above protocol
+   * costs time proportional to the length of the text for every token. A
+   * next Function taking three inputs instead uses the offset protocol:
+   *   (token next-offset) <- (text offset options)
+   * text is always the full string returned by init, and offset is the
+   * (decimal) offset within it at which the next token begins; it is 0 on
+   * the first call. next-offset is the offset at which the token after it
+   * begins, which must be greater than offset. The sequence is exhausted once
+   * next-offset reaches the length of text (any larger value is treated the
+   * same way).
+   *
+   * When the Functions are the default tokeniser and its preprocessor (or
+   * defaultInit), the Tokeniser does not call them at all. Instead, the
+   * options are parsed once and the tokens are read directly from the text,
+   * which is walked by offset rather than copied after every token.
    */
   class Tokeniser {
     Interpreter& interp;
@@ -33,6 +52,48 @@ namespace tglng {
     std::wstring options, remainder;
     bool hasInit, errorFlag;
 
+    /**
+     * Whether the native default tokeniser is in use. Only meaningful once
+     * hasInit is true.
+     */
+    bool native;
+    /**
+     * Whether fnext uses the offset protocol.
+     */
+    bool offsets;
+    /**
+     * If fnext is one of the native data tokenisers, its implementation,
+     * which is then called directly. NULL otherwise.
+     */
+    dataTokeniserNext_t offsetNext;
+    /**
+     * Whether offsetNext reported a separator at the end of the text, so that
+     * an empty token remains to be returned.
+     */
+    bool trailing;
+    /**
+     * When native or using the offset protocol, the offset within remainder
+     * of the actual remainder.
+     */
+    unsigned offset;
+    /**
+     * When native, the parsed options.
+     */
+    DefaultTokeniserOptions nativeOptions;
+    /**
+     * When native, whether large texts are to be tokenised on several
+     * threads. If so, and enough text remains, the tokens are extracted a
+     * stretch of text at a time into pending (and offset moved past them);
+     * pendingIx is the next to return. Each stretch is released as it is
+     * consumed, so the tokens of the whole text never exist at once.
+     */
+    bool parallel;
+    std::vector<std::wstring> pending;
+    unsigned pendingIx;
+
+    bool initNative();
+    bool nextByOffset(std::wstring&);
+
   public:
     /**
      * The default init Function.
@@ -41,6 +102,16 @@ namespace tglng {
      */
     static const Function defaultInit;
 
+    /**
+     * Returns whether the given Function can be used for next, under either
+     * protocol.
+     *
+     * @param next The Function to check.
+     * @param exact If true, the arity must match exactly; otherwise, the
+     * Function need only be compatible with the arity of the protocol.
+     */
+    static bool isNext(const Function& next, bool exact);
+
     /**
      * Constructs a Tokeniser using the two given Functions.
      *
@@ -66,6 +137,17 @@ namespace tglng {
     Tokeniser(Interpreter& interp, Function next,
               const std::wstring& text, const std::wstring& opts);
 
+    /**
+     * Constructs a Tokeniser using the same Functions and options as the
+     * given (unused) Tokeniser, but running in the given Interpreter on the
+     * given text.
+     *
+     * Commands keep a prototype Tokeniser built at parse time and use this
+     * to get a fresh one for each execution, so that they remain reentrant.
+     */
+    Tokeniser(const Tokeniser& prototype, Interpreter& interp,
+              const std::wstring& text);
+
     /**
      * Resets the Tokeniser to operate on the given string.
      */
@@ -74,8 +156,8 @@ namespace tglng {
     /**
      * Extracts the next token in the sequence, if possible.
      *
-     * init will be called if it has not been yet. If remainder is not the
-     * empty string, next is called and its result is used as the token, and
+     * init will be called if it has not been yet. If there is anything left
+     * of the text, next is called and its result is used as the token, and
      * true is returned. Otherwise, false is returned. Once false has been
      * returned, no more tokens can be extracted from this Tokeniser.
      *
@@ -0,0 +1,49 @@
+#ifndef UNORDERED_HXX_
+#define UNORDERED_HXX_
+
+/* Selects the best hash table implementation available, falling back to the
+ * ordered containers (with logarithmic rather than constant time access) if
+ * there is none. config.h must have been included before this file.
+ */
+#if defined(HAVE_UNORDERED_MAP) && defined(HAVE_UNORDERED_SET)
+#include <unordered_map>
+#include <unordered_set>
+#define TGLNG_HASH_NS std
+#elif defined(HAVE_TR1_UNORDERED_MAP) && defined(HAVE_TR1_UNORDERED_SET)
+#include <tr1/unordered_map>
+#include <tr1/unordered_set>
+#define TGLNG_HASH_NS std::tr1
+#else
+#include <map>
+#include <set>
+#endif
+
+namespace tglng {
+  /**
+   * Provides (as type) a hash table mapping K to V.
+   *
+   * Usage: hash_map<std::wstring,unsigned>::type counts;
+   */
+  template<typename K, typename V>
+  struct hash_map {
+#ifdef TGLNG_HASH_NS
+    typedef TGLNG_HASH_NS::unordered_map<K,V> type;
+#else
+    typedef std::map<K,V> type;
+#endif
+  };
+
+  /**
+   * Provides (as type) a hash set of K.
+   */
+  template<typename K>
+  struct hash_set {
+#ifdef TGLNG_HASH_NS
+    typedef TGLNG_HASH_NS::unordered_set<K> type;
+#else
+    typedef std::set<K> type;
+#endif
+  };
+}
+
+#endif /* UNORDERED_HXX_ */
@@ -0,0 +1,32 @@
+#! /bin/sh
+# The data tokenisers must see their text unchanged when used through
+# list-convert and for-each, and must not lose empty fields.
+
+. "$top_srcdir/tests/testlib.sh"
+
+tab=$(printf '\t')
+
+check "CSV keeps leading whitespace" "( a) b" \
+  '#list-convert##csv-tokeniser#{ a,b}'
+check "CSV leading empty field" "() a b" \
+  '#list-convert##csv-tokeniser#{,a,b}'
+check "CSV trailing empty field" "a b ()" \
+  '#list-convert##csv-tokeniser#{a,b,}'
+check "CSV two trailing empty fields" "a () ()" \
+  '#list-convert##csv-tokeniser#{a,,}'
+check "CSV trailing line break" "a b c d" \
+  '#list-convert##csv-tokeniser#{a,b
+c,d
+}'
+check "CSV with for-each" "< a><b><>" \
+  '#for-each##csv-tokeniser#{ a,b,}({<}$p{>})'
+
+check "TSV leading empty field" "() x y" \
+  "#list-convert##tsv-tokeniser#{${tab}x${tab}y}"
+check "TSV trailing empty field" "x y ()" \
+  "#list-convert##tsv-tokeniser#{x${tab}y${tab}}"
+
+check "JSON defaults to json-tokeniser-pre" "a ([1, 2]) b x" \
+  '#list-convert##json-tokeniser#{ {"a": [1, 2], "b": "x"} }'
+
+finish
@@ -0,0 +1,28 @@
+#! /bin/sh
+# The inputs of a user function are only copied into registers when needed;
+# they must still behave exactly like registers written on entry.
+
+. "$top_srcdir/tests/testlib.sh"
+
+check "input read whole" "abc" \
+  '#long-mode# defun f (t) ($t) f({abc})'
+check "input read through str-ix" "b" \
+  '#long-mode# defun f (t) (str-ix 1 $t) f({abc})'
+check "input overwritten" "x" \
+  '#long-mode# defun f (t) (@t {x} $t) f({abc})'
+check "input overwritten while str-ix reads it" "x" \
+  '#long-mode# defun f (t) (str-ix 0 (@t {x}) $t) f({abc})'
+check "caller register restored" "abc outer" \
+  '#long-mode# @t {outer} defun f (t) ($t) f({abc}) { } $t'
+check "caller register visible" "outer" \
+  '#long-mode# @t {outer} defun f (u) ($t) f({abc})'
+check "nested call sees the outer input" "ab" \
+  '#long-mode# defun g (u) (str-ix 0 $t)
+   defun f (t) (g({z}) str-ix 1 $t) f({abc})'
+check "later of two like-named inputs wins" "2" \
+  '#long-mode# defun f (aa) ($a) f({1}, {2})'
+check "tokeniser using the offset protocol" "ab cd ef g" \
+  '#long-mode# defun tok [n] (top) (@n + $o 2 str-ix $o. 2 $t)
+   list-convert#tok#{abcdefg}'
+
+finish
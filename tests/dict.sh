@@ -0,0 +1,28 @@
+#! /bin/sh
+# Dictionaries must behave the same whether or not their parsed form is
+# already cached, including ones which end with a key without a value.
+
+. "$top_srcdir/tests/testlib.sh"
+
+check "put after a dangling key" "a 1 b () c 3" \
+  '#dict-put#({a 1 b}, {c}, 3)'
+check "dangling key maps to the empty string" "[]" \
+  '{[}#dict-get#(#dict-put#({a 1 b}, {c}, 3), {b}, {none}){]}'
+check "replace a dangling key" "a 1 b 3" \
+  '#dict-put#({a 1 b}, {b}, 3)'
+check "repeated lookups in a dict with a dangling key" "1[]a 1 b () z ()" \
+  '#long-mode#
+  let d = {a 1 b} (dict-get(d, {a}, {x}) {[} dict-get(d, {b}, {x}) {]}
+                   dict-put(d, {z}, {}))'
+
+check "delete" "a 1 c 3" '#dict-del#({a 1 b 2 c 3}, {b})'
+check "lookup after delete" "none 3" \
+  '#long-mode#
+  let d = dict-del({a 1 b 2 c 3}, {a}) (
+    dict-get(d, {a}, {none}) { } dict-get(d, {c}, {none}))'
+check "keys after delete and reinsertion" "b c a" \
+  '#dict-keys#(#dict-put#(#dict-del#({a 1 b 2 c 3}, {a}), {a}, 4))'
+check "delete everything" "[]" \
+  '{[}#dict-del#(#dict-del#({a 1 b 2}, {a}), {b}){]}'
+
+finish
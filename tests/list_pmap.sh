@@ -0,0 +1,40 @@
+#! /bin/sh
+# list-pmap must give the same results as list-map, even when the function
+# uses let variables, since each thread has its own copy of them.
+
+. "$top_srcdir/tests/testlib.sh"
+
+range=$(seq -s ' ' 0 31)
+
+for i in 1 2 3 4 5; do
+  check "let in list-pmap, run $i" "$range" '#long-mode#
+    defun f (x) (let v = $x (for-integer 2000 i 0 ({}) v))
+    list-pmap({f}, list-range(32), {8})'
+done
+
+check "set in list-pmap" "$range" '#long-mode#
+  defun f (x) (let v = {} (for-integer 2000 i 0 (set v = $x) v))
+  list-pmap({f}, list-range(32), {8})'
+
+check "let variables start with the caller's values" "a-0 a-1 a-2 a-3" \
+  '#long-mode#
+  let v = {a} (list-pmap(lambda(x) (v {-} $x), list-range(4), {4}))'
+
+# The command limit applies to all threads together. Each item takes a few
+# hundred commands, so the workers must stop after about ten items in total,
+# rather than only failing once all 64 threads have finished theirs.
+dir=$(mktemp -d)
+printf '`(%s)' "#long-mode#
+  defun f (x) (for-integer 100 i 0 ({}) write(({$dir/} \$x), {}))
+  list-pmap({f}, list-range(64), {64})" |
+  "$TGLNG" -C -c "$top_srcdir/tglngrc" --max-commands=2000 >/dev/null 2>&1
+status=$?
+done=$(ls "$dir" | wc -l)
+rm -rf "$dir"
+if test $status -ne 5 || test $done -ge 32; then
+  echo "FAIL: command limit across threads"
+  echo "  exit status $status, $done of 64 items done"
+  failures=$(expr $failures + 1)
+fi
+
+finish
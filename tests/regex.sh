@@ -0,0 +1,119 @@
+#! /bin/sh
+# Regular expression matching. Most cases are run both with the configured
+# backend and with the native engine (option n), which must agree on the
+# syntax they have in common; the others are specific to the native engine.
+
+. "$top_srcdir/tests/testlib.sh"
+
+if test "x$(printf '`(#rx-support#())' |
+            "$TGLNG" -C -c "$top_srcdir/tglngrc")" = xNONE; then
+  exit 77
+fi
+
+# rx <pattern> <string> <options>
+#
+# Code which matches <pattern> against <string>, producing
+#   matched|captured|skipped|remaining
+rx() {
+  printf '#long-mode#rx-match[crs]({%s}, {%s}, {%s}) {|} $c {|} $s {|} $r' \
+    "$1" "$2" "$3"
+}
+
+# repl <pattern> <replacement> <string> <options>
+#
+# Code which replaces every match of <pattern> in <string>.
+repl() {
+  printf '#long-mode#rx-repl({%s}, {%s}, {%s}, {}, {%s})' "$1" "$2" "$3" "$4"
+}
+
+nl='
+'
+
+for o in '' n; do
+  check "simple match ($o)" "1|b12|xx |c yy" "$(rx 'b[0-9]+' 'xx b12c yy' "$o")"
+  check "groups ($o)" "1|k=v k v||" "$(rx '([a-z]+)=([a-z]+)' 'k=v' "$o")"
+  check "no match ($o)" "0|||" "$(rx 'b[0-9]+' 'xx bc yy' "$o")"
+
+  check "^ without line mode ($o)" "0|||" "$(rx '^b' "a${nl}bc" "$o")"
+  check "^ in line mode ($o)" "1|b|a$nl|c" "$(rx '^b' "a${nl}bc" "l$o")"
+  check "\$ without line mode ($o)" "1|b|ab$nl|" "$(rx 'b$' "ab${nl}b" "$o")"
+  check "\$ in line mode ($o)" "1|b|a|${nl}b" "$(rx 'b$' "ab${nl}b" "l$o")"
+  check ". and line breaks ($o)" "-" "$(repl 'a.b' '-' "a${nl}b" "$o")"
+  check ". in line mode ($o)" "a${nl}b" "$(repl 'a.b' '-' "a${nl}b" "l$o")"
+  check "anchors on each line ($o)" "-$nl-${nl}cd" \
+    "$(repl '^[a-z]$' '-' "a${nl}b${nl}cd" "l$o")"
+
+  check "case-insensitive ASCII ($o)" "1|FOO|x|" "$(rx 'foo' 'xFOO' "i$o")"
+done
+
+# Matches are never empty; patterns which could only match emptily at some
+# position move on to the next place a non-empty match is possible
+check "empty pattern" "0|||" "$(rx '' 'abc' n)"
+check "pattern matching only emptily" "0|||" "$(rx 'x*' 'abc' n)"
+check "replace only non-empty matches" "a-c" "$(repl 'b*' '-' 'abbc' n)"
+check "optional part skipped" "1|bb|a|c" "$(rx 'x*b+' 'abbc' n)"
+check "^ matches nothing by itself" "a${nl}b" "$(repl '^' '-' "a${nl}b" ln)"
+
+check "case-insensitive non-ASCII" "1|É|x|x" "$(rx 'é' 'xÉx' in)"
+check "case-insensitive non-ASCII, reversed" "1|é|x|x" "$(rx 'É' 'xéx' in)"
+check "case-insensitive non-ASCII class" "1|ÉÀ||" "$(rx '[à-é]+' 'ÉÀ' in)"
+check "case-sensitive non-ASCII" "0|||" "$(rx 'é' 'xÉx' n)"
+check "characters beyond the BMP" "1|𝄞𝄞|a|b" "$(rx '𝄞+' 'a𝄞𝄞b' n)"
+
+# Searches are first narrowed down to where a literal every match contains
+# occurs (see findRequiredLiteral in src/regex.cxx), which must not change
+# the results
+for o in '' n; do
+  check "required literal absent ($o)" "0|||" "$(rx 'foo[0-9]+' 'a fo12 b' "$o")"
+  check "required literal present but not matching ($o)" "0|||" \
+    "$(rx 'foo[0-9]+' 'a foo b foox' "$o")"
+  check "required literal matching at a later occurrence ($o)" \
+    "1|foo12|a foo x | b" "$(rx 'foo[0-9]+' 'a foo x foo12 b' "$o")"
+  check "bounded text before the literal ($o)" "1|foobar|xyzw |" \
+    "$(rx '[a-z]{0,3}bar' 'xyzw foobar' "$o")"
+  check "unbounded text before the literal ($o)" "1|abcdefbar|xyz |!" \
+    "$(rx '[a-z]*bar' 'xyz abcdefbar!' "$o")"
+  check "literal in a repeated group ($o)" "1|ababc ab|abc |" \
+    "$(rx '(ab){2}c' 'abc ababc' "$o")"
+  check "escaped literal ($o)" "1|a.b|axb |" "$(rx 'a\.b' 'axb a.b' "$o")"
+  check "literal under ^ in line mode ($o)" "1|foo|x foo$nl|" \
+    "$(rx '^foo' "x foo${nl}foo" "l$o")"
+  check "literal under ^ without line mode ($o)" "0|||" \
+    "$(rx '^foo' "x foo${nl}foo" "$o")"
+  check "case-insensitive literal ($o)" "1|foo|x|" "$(rx 'FOO' 'xfoo' "i$o")"
+  check "optional literal ($o)" "x- -" "$(repl '(ab)?c' '-' 'xc abc' "$o")"
+  check "alternatives ($o)" "- -" "$(repl 'foo|bar' '-' 'bar foo' "$o")"
+  check "successive matches ($o)" "-- a - x" \
+    "$(repl 'a[0-9]' '-' 'a1a2 a a3 x' "$o")"
+done
+
+sparse=$(printf '%05000d' 0 | tr 0 .)
+check "literal far into the text" "1|k=42" \
+  "#long-mode#rx-match[c]({k=[0-9]+}, {${sparse}k=42${sparse}}, {n}) {|} \$c"
+check "literal beyond the BMP" "1|x𝄞y|x𝄞 |" "$(rx 'x𝄞y' 'x𝄞 x𝄞y' n)"
+
+a1000=$(printf '%01000d' 0 | tr 0 a)
+check "repetition at the limit" "1" \
+  "#long-mode#rx-match({^a{1000}\$}, {$a1000}, {n})"
+check_error "repetition beyond the limit" "Repetition count too large" \
+  "$(rx 'a{1001}' 'a' n)"
+check_error "bounded repetition beyond the limit" \
+  "Repetition count too large" "$(rx 'a{1,1001}' 'a' n)"
+check_error "repetition counts out of order" "Repetition counts out of order" \
+  "$(rx 'a{2,1}' 'a' n)"
+check_error "pattern too large" "Pattern too large" \
+  "$(rx '(a{1000}){1000}' 'a' n)"
+
+check_error "backreference" "Backreferences are not supported" \
+  "$(rx '(a)\1' 'aa' n)"
+check_error "lookahead" "Lookaround assertions are not supported" \
+  "$(rx 'a(?=b)' 'ab' n)"
+check_error "lookbehind" "Lookaround assertions are not supported" \
+  "$(rx '(?<=a)b' 'ab' n)"
+check_error "possessive quantifier" "Possessive quantifiers are not supported" \
+  "$(rx 'a*+' 'a' n)"
+check_error "inline option" "Unsupported group syntax" "$(rx '(?i)a' 'A' n)"
+check_error "unknown escape" "Unsupported escape sequence" \
+  "$(rx '\p{L}' 'a' n)"
+
+finish
@@ -0,0 +1,42 @@
+# Definitions shared by the test scripts. TGLNG (the binary under test) and
+# top_srcdir are set by the Makefile.
+
+LC_ALL=C.UTF-8
+export LC_ALL
+failures=0
+
+# check <description> <expected> <code>
+#
+# Runs <code> as a command-mode program with the distributed configuration,
+# and records a failure if its output is not exactly <expected>.
+check() {
+  actual=$(printf '`(%s)' "$3" | "$TGLNG" -C -c "$top_srcdir/tglngrc")
+  if test "x$actual" != "x$2"; then
+    echo "FAIL: $1"
+    echo "  expected: $2"
+    echo "  actual:   $actual"
+    failures=$(expr $failures + 1)
+  fi
+}
+
+# check_error <description> <message> <code>
+#
+# Runs <code> as check does, and records a failure unless it fails with
+# <message> among its diagnostics.
+check_error() {
+  actual=$(printf '`(%s)' "$3" | "$TGLNG" -C -c "$top_srcdir/tglngrc" \
+             2>&1 >/dev/null)
+  status=$?
+  case "$actual" in
+    *"$2"*) test $status -ne 0 && return ;;
+  esac
+  echo "FAIL: $1"
+  echo "  expected an error: $2"
+  echo "  exit status $status, diagnostics: $actual"
+  failures=$(expr $failures + 1)
+}
+
+# Exits with the status expected by the test harness.
+finish() {
+  test $failures -eq 0
+}